@@ -0,0 +1,239 @@
+#include "alloc.h"
+
+#ifdef MAT_ALLOC_STATS
+
+#include <ctype.h>
+#include <pthread.h>
+#include <string.h>
+
+// Each block carries a small header so frees and reallocs can be charged back
+// to the subsystem that made the allocation.
+union alloc_header
+{
+    struct
+    {
+        size_t size;
+        int tag;
+    } h;
+    long double align;
+};
+
+struct alloc_counter
+{
+    size_t allocs;
+    size_t frees;
+    size_t bytes;
+    size_t live;
+    size_t peak;
+};
+
+// one entry per key handled by handleKeyPress
+struct alloc_op
+{
+    size_t count;
+    size_t allocs;
+    size_t bytes;
+    size_t peak;
+};
+
+static const char *ALLOC_TAG_NAMES[ALLOC_TAGS] = {
+    "rows", "render", "hl", "frame", "search", "prompt", "buffers", "index", "journal", "syntax", "rowtree", "register", "undo", "words"};
+
+// the loader's workers allocate rows concurrently
+static pthread_mutex_t allocLock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct alloc_counter tagStats[ALLOC_TAGS];
+static size_t liveTotal, peakTotal;
+
+static struct alloc_op opStats[256];
+static int curKey = -1;
+static struct alloc_counter curOp[ALLOC_TAGS];
+static size_t curPeak;
+
+static int lastKey = -1;
+static struct alloc_counter lastOp[ALLOC_TAGS];
+static size_t lastPeak;
+
+static void allocCharge(int tag, size_t size)
+{
+    tagStats[tag].allocs++;
+    tagStats[tag].bytes += size;
+    tagStats[tag].live += size;
+    if (tagStats[tag].live > tagStats[tag].peak)
+        tagStats[tag].peak = tagStats[tag].live;
+
+    curOp[tag].allocs++;
+    curOp[tag].bytes += size;
+
+    liveTotal += size;
+    if (liveTotal > peakTotal)
+        peakTotal = liveTotal;
+    if (liveTotal > curPeak)
+        curPeak = liveTotal;
+}
+
+static void allocRelease(int tag, size_t size)
+{
+    tagStats[tag].frees++;
+    tagStats[tag].live -= size;
+    curOp[tag].frees++;
+    liveTotal -= size;
+}
+
+void *allocMalloc(enum alloc_tag tag, size_t size)
+{
+    union alloc_header *hdr = malloc(sizeof(*hdr) + size);
+    if (hdr == NULL)
+        return NULL;
+
+    hdr->h.size = size;
+    hdr->h.tag = tag;
+    pthread_mutex_lock(&allocLock);
+    allocCharge(tag, size);
+    pthread_mutex_unlock(&allocLock);
+    return hdr + 1;
+}
+
+void *allocRealloc(enum alloc_tag tag, void *ptr, size_t size)
+{
+    if (ptr == NULL)
+        return allocMalloc(tag, size);
+
+    union alloc_header *hdr = (union alloc_header *)ptr - 1;
+    size_t old = hdr->h.size;
+    int oldTag = hdr->h.tag;
+
+    union alloc_header *new = realloc(hdr, sizeof(*new) + size);
+    if (new == NULL)
+        return NULL;
+
+    pthread_mutex_lock(&allocLock);
+    allocRelease(oldTag, old);
+    allocCharge(tag, size);
+    pthread_mutex_unlock(&allocLock);
+    new->h.size = size;
+    new->h.tag = tag;
+    return new + 1;
+}
+
+void allocFree(void *ptr)
+{
+    if (ptr == NULL)
+        return;
+
+    union alloc_header *hdr = (union alloc_header *)ptr - 1;
+    pthread_mutex_lock(&allocLock);
+    allocRelease(hdr->h.tag, hdr->h.size);
+    pthread_mutex_unlock(&allocLock);
+    free(hdr);
+}
+
+size_t allocSize(void *ptr)
+{
+    if (ptr == NULL)
+        return 0;
+    return allocUsable((union alloc_header *)ptr - 1) - sizeof(union alloc_header);
+}
+
+static void allocEndOp()
+{
+    if (curKey < 0)
+        return;
+
+    struct alloc_op *op = &opStats[curKey];
+    op->count++;
+    for (int t = 0; t < ALLOC_TAGS; t++)
+    {
+        op->allocs += curOp[t].allocs;
+        op->bytes += curOp[t].bytes;
+    }
+    if (curPeak > op->peak)
+        op->peak = curPeak;
+
+    lastKey = curKey;
+    memcpy(lastOp, curOp, sizeof(lastOp));
+    lastPeak = curPeak;
+}
+
+// Operations are delimited by keystrokes: everything allocated from one key
+// press until the next, including the frame drawn in between, is charged to
+// the key that started it.
+void allocBeginOp(int key)
+{
+    allocEndOp();
+
+    curKey = key & 0xff;
+    memset(curOp, 0, sizeof(curOp));
+    curPeak = liveTotal;
+}
+
+static const char *allocKeyName(int key)
+{
+    static char name[12];
+
+    if (key == 27)
+        snprintf(name, sizeof(name), "ESC");
+    else if (key == 127)
+        snprintf(name, sizeof(name), "BS");
+    else if (key < 32)
+        snprintf(name, sizeof(name), "^%c", key + '@');
+    else if (isprint(key))
+        snprintf(name, sizeof(name), "'%c'", key);
+    else
+        snprintf(name, sizeof(name), "%d", key);
+
+    return name;
+}
+
+void allocStatusLine(char *buf, size_t len)
+{
+    size_t allocs = 0, bytes = 0;
+    for (int t = 0; t < ALLOC_TAGS; t++)
+    {
+        allocs += lastOp[t].allocs;
+        bytes += lastOp[t].bytes;
+    }
+
+    if (lastKey < 0)
+        snprintf(buf, len, "alloc: live %zuB peak %zuB", liveTotal, peakTotal);
+    else
+        snprintf(buf, len, "alloc: %s %zu allocs %zuB peak %zuB | live %zuB",
+                 allocKeyName(lastKey), allocs, bytes, lastPeak, liveTotal);
+}
+
+void allocReport(FILE *out)
+{
+    allocEndOp();
+    curKey = -1;
+
+    fprintf(out, "mat allocation report\n\n");
+    fprintf(out, "%-8s %10s %10s %14s %12s %12s\n",
+            "subsys", "allocs", "frees", "bytes", "live", "peak");
+    for (int t = 0; t < ALLOC_TAGS; t++)
+    {
+        struct alloc_counter *s = &tagStats[t];
+        fprintf(out, "%-8s %10zu %10zu %14zu %12zu %12zu\n",
+                ALLOC_TAG_NAMES[t], s->allocs, s->frees, s->bytes, s->live, s->peak);
+    }
+    fprintf(out, "%-8s %10s %10s %14s %12zu %12zu\n\n",
+            "total", "", "", "", liveTotal, peakTotal);
+
+    fprintf(out, "%-6s %8s %12s %14s %12s %12s\n",
+            "key", "ops", "allocs", "bytes", "allocs/op", "peak");
+    for (int k = 0; k < 256; k++)
+    {
+        struct alloc_op *op = &opStats[k];
+        if (op->count == 0)
+            continue;
+        fprintf(out, "%-6s %8zu %12zu %14zu %12.1f %12zu\n",
+                allocKeyName(k), op->count, op->allocs, op->bytes,
+                (double)op->allocs / op->count, op->peak);
+    }
+}
+
+void allocReportAtExit()
+{
+    allocReport(stderr);
+}
+
+#endif
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// bytes the C library actually set aside for a block, which each one asks
+// for under its own name
+#if defined(__APPLE__)
+#include <malloc/malloc.h>
+#define allocUsable(ptr) malloc_size((ptr))
+#elif defined(__FreeBSD__)
+#include <malloc_np.h>
+#define allocUsable(ptr) malloc_usable_size((ptr))
+#else
+#include <malloc.h>
+#define allocUsable(ptr) malloc_usable_size((ptr))
+#endif
+
+// Every allocation made by the editor is tagged with the subsystem that owns
+// it. In normal builds the tags compile away; building with
+// -DMAT_ALLOC_STATS routes the call sites through a counting allocator.
+enum alloc_tag
+{
+    ALLOC_ROWS,
+    ALLOC_RENDER,
+    ALLOC_HL,
+    ALLOC_FRAME,
+    ALLOC_SEARCH,
+    ALLOC_PROMPT,
+    ALLOC_BUFFERS,
+    ALLOC_INDEX,
+    ALLOC_JOURNAL,
+    ALLOC_SYNTAX,
+    ALLOC_ROWTREE,
+    ALLOC_REGISTER,
+    ALLOC_UNDO,
+    ALLOC_WORDS,
+    ALLOC_TAGS
+};
+
+#ifdef MAT_ALLOC_STATS
+
+void *allocMalloc(enum alloc_tag tag, size_t size);
+void *allocRealloc(enum alloc_tag tag, void *ptr, size_t size);
+void allocFree(void *ptr);
+size_t allocSize(void *ptr);
+
+void allocBeginOp(int key);
+void allocStatusLine(char *buf, size_t len);
+void allocReport(FILE *out);
+void allocReportAtExit();
+
+#define matMalloc(tag, size) allocMalloc((tag), (size))
+#define matRealloc(tag, ptr, size) allocRealloc((tag), (ptr), (size))
+#define matFree(ptr) allocFree((ptr))
+#define matSize(ptr) allocSize((ptr))
+
+#else
+
+#define matMalloc(tag, size) ((void)(tag), malloc(size))
+#define matRealloc(tag, ptr, size) ((void)(tag), realloc((ptr), (size)))
+#define matFree(ptr) free((ptr))
+// bytes the allocator actually set aside for a block, at least what was asked
+#define matSize(ptr) allocUsable((ptr))
+
+#define allocBeginOp(key) ((void)(key))
+
+#endif
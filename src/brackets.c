@@ -0,0 +1,303 @@
+#include "brackets.h"
+#include "rowtree.h"
+#include "syntax.h"
+
+#include <string.h>
+
+extern struct config E;
+
+// Each row contributes the net nesting change and the lowest nesting it
+// reaches for (), [] and {}, kept in E.brackets. Brackets inside strings and
+// comments are skipped using the row's highlight classes. The index is built
+// on first use and then kept current by the row functions.
+static const char BRACKET_OPEN[RT_CHANNELS] = {'(', '[', '{'};
+static const char BRACKET_CLOSE[RT_CHANNELS] = {')', ']', '}'};
+
+// enclosing {} block shown while :scope is on
+static struct
+{
+    int on;
+    int openRow, openRx;
+    int closeRow, closeRx;
+} S = {0, -1, -1, -1, -1};
+
+static int bracketCode(erow *row, int i)
+{
+    unsigned char hl = row->hl[i];
+    return hl != HL_STRING && hl != HL_COMMENT && hl != HL_MLCOMMENT;
+}
+
+static void bracketRowValues(erow *row, struct rtbrackets out[RT_CHANNELS])
+{
+    memset(out, 0, sizeof(struct rtbrackets) * RT_CHANNELS);
+
+    for (int i = 0; i < row->rsize; i++)
+    {
+        char c = row->render[i];
+        for (int ch = 0; ch < RT_CHANNELS; ch++)
+        {
+            if (c == BRACKET_OPEN[ch] && bracketCode(row, i))
+                out[ch].delta++;
+            else if (c == BRACKET_CLOSE[ch] && bracketCode(row, i))
+            {
+                out[ch].delta--;
+                if (out[ch].delta < out[ch].min)
+                    out[ch].min = out[ch].delta;
+            }
+        }
+    }
+}
+
+// Rows whose highlighting was dropped keep their values, which stay right as
+// long as they were lexed from the comment state the row above now ends in.
+// Lexing a row again records the state it ends in, so only the rows up to
+// where the states agree again are redone.
+static void bracketBuild()
+{
+    if (E.brackets)
+    {
+        int j, last = -1;
+        while ((j = rowtreeBroken(E.brackets)) > last)
+        {
+            if (E.row[j].hl)
+                updateSyntax(&E.row[j]);
+            else
+                syntaxEnsure(j);
+            last = j;
+        }
+        return;
+    }
+
+    int *states = matMalloc(ALLOC_ROWTREE, sizeof(int) * (E.numRws + 1));
+    struct rtbrackets(*values)[RT_CHANNELS] = matMalloc(ALLOC_ROWTREE, sizeof(*values) * (E.numRws + 1));
+    for (int j = 0; j < E.numRws; j++)
+    {
+        syntaxEnsure(j);
+        states[j] = E.row[j].hl_open_comment != 0;
+        bracketRowValues(&E.row[j], values[j]);
+    }
+
+    E.brackets = rowtreeBuild(values, states, E.numRws);
+    matFree(values);
+    matFree(states);
+}
+
+// `in` is the comment state the row was lexed from
+void bracketRowChanged(erow *row, int in)
+{
+    if (E.brackets == NULL)
+        return;
+
+    struct rtbrackets values[RT_CHANNELS];
+    bracketRowValues(row, values);
+    rowtreeSet(E.brackets, row->idx, values);
+    rowtreeLink(E.brackets, row->idx, in, row->hl_open_comment != 0);
+}
+
+// new rows start out unlinked and are filled in once they are lexed
+void bracketRowsInserted(int at, int count)
+{
+    if (E.brackets == NULL)
+        return;
+
+    rowtreeInsert(E.brackets, at, count);
+}
+
+void bracketRowsDeleted(int at, int count)
+{
+    if (E.brackets == NULL)
+        return;
+
+    rowtreeDelete(E.brackets, at, count);
+}
+
+// Every row lost its highlighting, as when the syntax changes; the index is
+// rebuilt the next time it is needed.
+void bracketDrop()
+{
+    rowtreeFree(E.brackets);
+    E.brackets = NULL;
+}
+
+// Finds the first position at or after render index `from` in row `at` where
+// the nesting of channel ch drops to `target`; returns the render index of the
+// bracket that got it there, or -1.
+static int bracketScanForward(int at, int from, int ch, int depth, int target)
+{
+    erow *row = &E.row[at];
+    for (int i = from; i < row->rsize; i++)
+    {
+        if (!bracketCode(row, i))
+            continue;
+        if (row->render[i] == BRACKET_OPEN[ch])
+            depth++;
+        else if (row->render[i] == BRACKET_CLOSE[ch] && --depth <= target)
+            return i;
+    }
+    return -1;
+}
+
+// Finds the last open bracket of channel ch before render index `to` in row
+// `at` that leaves the nesting at target + 1, given the depth at row start.
+static int bracketScanBackward(int at, int to, int ch, int depth, int target)
+{
+    erow *row = &E.row[at];
+    int found = -1;
+    for (int i = 0; i < to && i < row->rsize; i++)
+    {
+        if (!bracketCode(row, i))
+            continue;
+        if (row->render[i] == BRACKET_OPEN[ch])
+        {
+            if (depth <= target)
+                found = i;
+            depth++;
+        }
+        else if (row->render[i] == BRACKET_CLOSE[ch])
+            depth--;
+    }
+    return found;
+}
+
+// depth of channel ch just before render index rx of row `at`
+static int bracketDepthAt(int at, int rx, int ch)
+{
+    erow *row = &E.row[at];
+    int depth = rowtreeDepth(E.brackets, at, ch);
+    for (int i = 0; i < rx && i < row->rsize; i++)
+    {
+        if (!bracketCode(row, i))
+            continue;
+        if (row->render[i] == BRACKET_OPEN[ch])
+            depth++;
+        else if (row->render[i] == BRACKET_CLOSE[ch])
+            depth--;
+    }
+    return depth;
+}
+
+// Locates the close bracket matching an open one at (at, rx).
+static int bracketFindClose(int at, int rx, int ch, int *outRow, int *outRx)
+{
+    int target = bracketDepthAt(at, rx, ch);
+    int i = bracketScanForward(at, rx + 1, ch, target + 1, target);
+    if (i < 0)
+    {
+        at = rowtreeFindForward(E.brackets, at + 1, ch, target);
+        if (at < 0)
+            return -1;
+        i = bracketScanForward(at, 0, ch, rowtreeDepth(E.brackets, at, ch), target);
+    }
+    *outRow = at;
+    *outRx = i;
+    return i < 0 ? -1 : 0;
+}
+
+// Locates the open bracket enclosing render index rx of row `at`, at the
+// given depth.
+static int bracketFindOpen(int at, int rx, int ch, int target, int *outRow, int *outRx)
+{
+    int i = bracketScanBackward(at, rx, ch, rowtreeDepth(E.brackets, at, ch), target);
+    if (i < 0)
+    {
+        at = rowtreeFindBackward(E.brackets, at - 1, ch, target);
+        if (at < 0)
+            return -1;
+        i = bracketScanBackward(at, E.row[at].rsize, ch, rowtreeDepth(E.brackets, at, ch), target);
+    }
+    *outRow = at;
+    *outRx = i;
+    return i < 0 ? -1 : 0;
+}
+
+static void bracketGoto(int row, int rx)
+{
+    E.cy = row;
+    E.cx = rwsRxToCx(&E.row[row], rx);
+}
+
+void bracketJump()
+{
+    if (E.cy >= E.numRws)
+        return;
+
+    bracketBuild();
+
+    erow *row = &E.row[E.cy];
+    int rx = rwsCxToRx(row, E.cx);
+    if (rx >= row->rsize || !bracketCode(row, rx))
+        return;
+
+    int r, x;
+    for (int ch = 0; ch < RT_CHANNELS; ch++)
+    {
+        if (row->render[rx] == BRACKET_OPEN[ch])
+        {
+            if (bracketFindClose(E.cy, rx, ch, &r, &x) == 0)
+                bracketGoto(r, x);
+            else
+                setStatusMessage("No matching %c", BRACKET_CLOSE[ch]);
+            return;
+        }
+        if (row->render[rx] == BRACKET_CLOSE[ch])
+        {
+            int depth = bracketDepthAt(E.cy, rx, ch);
+            if (bracketFindOpen(E.cy, rx, ch, depth - 1, &r, &x) == 0)
+                bracketGoto(r, x);
+            else
+                setStatusMessage("No matching %c", BRACKET_OPEN[ch]);
+            return;
+        }
+    }
+}
+
+// enclosing {} block around the cursor
+static int bracketBlock(int *openRow, int *openRx, int *closeRow, int *closeRx)
+{
+    if (E.cy >= E.numRws)
+        return -1;
+
+    bracketBuild();
+
+    int rx = rwsCxToRx(&E.row[E.cy], E.cx);
+    int depth = bracketDepthAt(E.cy, rx, 2);
+    if (depth <= 0 || bracketFindOpen(E.cy, rx, 2, depth - 1, openRow, openRx) == -1)
+        return -1;
+    if (bracketFindClose(*openRow, *openRx, 2, closeRow, closeRx) == -1)
+        *closeRow = *closeRx = -1;
+    return 0;
+}
+
+void bracketEnclosing(int dir)
+{
+    int openRow, openRx, closeRow, closeRx;
+    if (bracketBlock(&openRow, &openRx, &closeRow, &closeRx) == -1)
+        return;
+
+    if (dir < 0)
+        bracketGoto(openRow, openRx);
+    else if (closeRow >= 0)
+        bracketGoto(closeRow, closeRx);
+}
+
+void bracketScopeToggle()
+{
+    S.on = !S.on;
+    S.openRow = S.closeRow = -1;
+    setStatusMessage("scope %s", S.on ? "on" : "off");
+}
+
+void bracketScopeUpdate()
+{
+    if (!S.on)
+        return;
+
+    if (bracketBlock(&S.openRow, &S.openRx, &S.closeRow, &S.closeRx) == -1)
+        S.openRow = S.closeRow = -1;
+}
+
+int bracketMarked(int filerow, int rx)
+{
+    return S.on && ((filerow == S.openRow && rx == S.openRx) ||
+                    (filerow == S.closeRow && rx == S.closeRx));
+}
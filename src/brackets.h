@@ -0,0 +1,14 @@
+#pragma once
+
+#include "mat.h"
+
+void bracketRowChanged(erow *row, int in);
+void bracketRowsInserted(int at, int count);
+void bracketRowsDeleted(int at, int count);
+void bracketDrop();
+
+void bracketJump();
+void bracketEnclosing(int dir);
+void bracketScopeToggle();
+void bracketScopeUpdate();
+int bracketMarked(int filerow, int rx);
@@ -0,0 +1,287 @@
+#include "buffer.h"
+#include "hex.h"
+#include "journal.h"
+#include "pager.h"
+#include "rowtree.h"
+#include "undo.h"
+#include "words.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+extern struct config E;
+
+struct buffers B;
+
+// combined size of the render and highlight caches and word indexes of all
+// buffers, in MiB
+#define MAT_MEMORY_BUDGET 256
+
+static void bufferResetState()
+{
+    E.cx = 0;
+    E.cy = 0;
+    E.vx = 0;
+    E.vy = 0;
+    E.rx = 0;
+    E.rowOff = 0;
+    E.colOff = 0;
+    E.numRws = 0;
+    E.row = NULL;
+    E.dirty = 0;
+    E.syntax = NULL;
+    E.journal = NULL;
+    E.brackets = NULL;
+    E.undo = NULL;
+    E.wraps = NULL;
+    E.wrapWidth = 0;
+    E.wrapOff = 0;
+    E.words = NULL;
+    E.pager = NULL;
+    E.current_file_name = NULL;
+    E.current_file_extension = NULL;
+    E.diskSize = 0;
+    E.diskMtime = 0;
+}
+
+// fields of E that belong to the terminal rather than to a file
+static void bufferKeepGlobals(struct config *from)
+{
+    E.screenRws = from->screenRws;
+    E.screenCls = from->screenCls;
+    E.current_mode = from->current_mode;
+    memcpy(E.statusmsg, from->statusmsg, sizeof(E.statusmsg));
+    E.statusmsg_time = from->statusmsg_time;
+    E.orig_termios = from->orig_termios;
+}
+
+size_t bufferCacheBytes(struct config *state)
+{
+    size_t bytes = 0;
+    for (int j = 0; j < state->numRws; j++)
+    {
+        // the render of a row that is not plain ASCII carries its marks too
+        erow *row = &state->row[j];
+        bytes += matSize(row->render) + matSize(row->hl);
+    }
+    return bytes + wordsMemory(state->words);
+}
+
+// Drops the render and highlight caches and the word index of an inactive
+// buffer. Its rows and their multi-line comment state are kept, so bringing
+// it back only has to re-render rows, not re-read or re-parse the file.
+static void bufferEvict(struct buffer *buf)
+{
+    for (int j = 0; j < buf->state.numRws; j++)
+    {
+        erow *row = &buf->state.row[j];
+        matFree(row->render);
+        matFree(row->hl);
+        row->render = NULL;
+        row->hl = NULL;
+    }
+
+    // the bracket index assumes every row is highlighted
+    rowtreeFree(buf->state.brackets);
+    buf->state.brackets = NULL;
+    wordsFree(buf->state.words);
+    buf->state.words = NULL;
+    buf->cached = 0;
+}
+
+static void bufferEnforceBudget()
+{
+    size_t total = bufferCacheBytes(&E);
+    for (int i = 0; i < B.count; i++)
+        if (i != B.current && B.b[i].cached)
+            total += bufferCacheBytes(&B.b[i].state);
+
+    while (total > B.budget)
+    {
+        struct buffer *lru = NULL;
+        for (int i = 0; i < B.count; i++)
+        {
+            struct buffer *buf = &B.b[i];
+            if (i == B.current || !buf->cached)
+                continue;
+            if (lru == NULL || buf->lastUsed < lru->lastUsed)
+                lru = buf;
+        }
+
+        if (lru == NULL)
+            break;
+
+        total -= bufferCacheBytes(&lru->state);
+        bufferEvict(lru);
+    }
+}
+
+static void bufferStash()
+{
+    struct buffer *buf = &B.b[B.current];
+    journalSync(E.journal, 1);
+    buf->state = E;
+    buf->cached = 1;
+    buf->lastUsed = ++B.clock;
+}
+
+static void bufferActivate(int n)
+{
+    struct config globals = E;
+    struct buffer *buf = &B.b[n];
+
+    E = buf->state;
+    bufferKeepGlobals(&globals);
+    B.current = n;
+
+    // highlighting comes back lazily from the kept comment states
+    if (!buf->cached)
+    {
+        for (int j = 0; j < E.numRws; j++)
+            updateRender(&E.row[j]);
+        buf->cached = 1;
+    }
+
+    buf->lastUsed = ++B.clock;
+    bufferEnforceBudget();
+}
+
+void bufferSwitch(int n)
+{
+    if (n < 0 || n >= B.count || n == B.current)
+        return;
+
+    bufferStash();
+    bufferActivate(n);
+
+    setStatusMessage("[%d/%d] %s", n + 1, B.count,
+                     E.current_file_name ? E.current_file_name : "[No Name]");
+}
+
+void bufferNext(int dir)
+{
+    if (B.count < 2)
+        return;
+    bufferSwitch((B.current + dir + B.count) % B.count);
+}
+
+static char *bufferName(int n)
+{
+    return n == B.current ? E.current_file_name : B.b[n].state.current_file_name;
+}
+
+// Makes an empty buffer current and returns its index. An untouched empty
+// buffer is reused instead of kept around.
+int bufferNew()
+{
+    if (E.current_file_name != NULL || E.numRws != 0 || E.dirty)
+    {
+        bufferStash();
+        B.b = matRealloc(ALLOC_BUFFERS, B.b, sizeof(struct buffer) * (B.count + 1));
+        memset(&B.b[B.count], 0, sizeof(struct buffer));
+        B.current = B.count++;
+        bufferResetState();
+    }
+    return B.current;
+}
+
+// Runs fn with buffer n's state in E, for work that arrives for a buffer while
+// another one may be on screen. Nothing is re-rendered or evicted on the way.
+void bufferRun(int n, void (*fn)(void *), void *arg)
+{
+    if (n == B.current)
+    {
+        fn(arg);
+        return;
+    }
+
+    struct config globals = E;
+    struct buffer *buf = &B.b[n];
+
+    E = buf->state;
+    bufferKeepGlobals(&globals);
+    fn(arg);
+    buf->state = E;
+    E = globals;
+}
+
+int bufferOpen(char *filename)
+{
+    for (int i = 0; i < B.count; i++)
+    {
+        char *name = bufferName(i);
+        if (name && strcmp(name, filename) == 0)
+        {
+            bufferSwitch(i);
+            return i;
+        }
+    }
+
+    if (access(filename, R_OK) == -1)
+    {
+        setStatusMessage("Cannot open %s", filename);
+        return -1;
+    }
+
+    // binary files would be cut into rows at arbitrary bytes
+    if (hexProbe(filename))
+        return pagerOpenHex(filename) == 0 ? B.current : -1;
+
+    bufferNew();
+
+    // loading and recovering are not something to undo
+    undoSuspend(1);
+    E.current_file_name = strdup(filename);
+    openFile(E.current_file_name);
+    E.current_file_extension = get_file_extension(E.current_file_name);
+    E.journal = journalOpen(E.current_file_name);
+    undoSuspend(0);
+
+    B.b[B.current].cached = 1;
+    B.b[B.current].lastUsed = ++B.clock;
+    bufferEnforceBudget();
+
+    return B.current;
+}
+
+void bufferList()
+{
+    char list[sizeof(E.statusmsg)];
+    int len = 0;
+
+    for (int i = 0; i < B.count && len < (int)sizeof(list); i++)
+    {
+        char *name = bufferName(i);
+        int dirty = i == B.current ? E.dirty : B.b[i].state.dirty;
+        len += snprintf(list + len, sizeof(list) - len, "%s%d:%s%s ",
+                        i == B.current ? "%" : "", i + 1,
+                        name ? name : "[No Name]", dirty ? "*" : "");
+    }
+
+    setStatusMessage("%s", list);
+}
+
+// journals of buffers with unsaved edits are kept for recovery
+static void bufferCloseJournals()
+{
+    for (int i = 0; i < B.count; i++)
+    {
+        struct config *state = i == B.current ? &E : &B.b[i].state;
+        journalClose(state->journal, state->dirty);
+        state->journal = NULL;
+    }
+}
+
+void initBuffers()
+{
+    B.b = matMalloc(ALLOC_BUFFERS, sizeof(struct buffer));
+    memset(B.b, 0, sizeof(struct buffer));
+    B.count = 1;
+    B.current = 0;
+    B.clock = 0;
+    atexit(bufferCloseJournals);
+
+    char *budget = getenv("MAT_MEMORY_BUDGET");
+    B.budget = (size_t)(budget ? atol(budget) : MAT_MEMORY_BUDGET) << 20;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "mat.h"
+
+// Every open file lives in a buffer. The active buffer's state is held in
+// the global E so the rest of the editor is unaware of buffers; inactive
+// buffers keep a snapshot of it, rows included.
+struct buffer
+{
+    struct config state;
+    unsigned long lastUsed;
+    int cached;
+};
+
+struct buffers
+{
+    struct buffer *b;
+    int count;
+    int current;
+    unsigned long clock;
+    size_t budget;
+};
+
+int bufferOpen(char *filename);
+int bufferNew();
+void bufferRun(int n, void (*fn)(void *), void *arg);
+void bufferSwitch(int n);
+void bufferNext(int dir);
+void bufferList();
+size_t bufferCacheBytes(struct config *state);
+void initBuffers();
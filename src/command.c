@@ -0,0 +1,101 @@
+#include "command.h"
+#include "brackets.h"
+#include "buffer.h"
+#include "filter.h"
+#include "follow.h"
+#include "grep.h"
+#include "meminfo.h"
+#include "mat.h"
+#include "motion.h"
+#include "pager.h"
+#include "reload.h"
+#include "register.h"
+#include "substitute.h"
+#include "wrap.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+extern struct config E;
+extern struct buffers B;
+
+// splits "name args" in place, returning the argument part (possibly empty)
+static char *commandArgs(char *cmd)
+{
+    while (*cmd && !isspace((unsigned char)*cmd))
+        cmd++;
+    if (*cmd)
+        *cmd++ = '\0';
+    while (isspace((unsigned char)*cmd))
+        cmd++;
+    return cmd;
+}
+
+void runCommand(char *cmd)
+{
+    while (isspace((unsigned char)*cmd))
+        cmd++;
+
+    if (substituteCommand(cmd) || filterCommand(cmd))
+        return;
+
+    char *args = commandArgs(cmd);
+
+    if (isdigit((unsigned char)*cmd) && cmd[strspn(cmd, "0123456789")] == '\0')
+    {
+        if (E.pager)
+            pagerGotoLine(atoll(cmd) > 0 ? atoll(cmd) : 1);
+        else
+            motionGotoLine(atoi(cmd) > 0 ? atoi(cmd) : 1);
+    }
+    else if (!strcmp(cmd, "e") || !strcmp(cmd, "edit"))
+    {
+        if (*args)
+            bufferOpen(args);
+        else
+            setStatusMessage("Usage: e <file>");
+    }
+    else if (!strcmp(cmd, "b") || !strcmp(cmd, "buffer"))
+    {
+        int n = atoi(args);
+        if (n < 1 || n > B.count)
+            setStatusMessage("No buffer %s", args);
+        else
+            bufferSwitch(n - 1);
+    }
+    else if (!strcmp(cmd, "bn"))
+        bufferNext(1);
+    else if (!strcmp(cmd, "bp"))
+        bufferNext(-1);
+    else if (!strcmp(cmd, "ls"))
+        bufferList();
+    else if (!strcmp(cmd, "w"))
+        save();
+    else if (!strcmp(cmd, "wrap"))
+        wrapToggle();
+    else if (!strcmp(cmd, "clip"))
+        registerExport();
+    else if (!strcmp(cmd, "reload"))
+        reloadBuffer();
+    else if (!strcmp(cmd, "mem"))
+        meminfoReport();
+    else if (!strcmp(cmd, "follow"))
+        followToggle();
+    else if (!strcmp(cmd, "scope"))
+        bracketScopeToggle();
+    else if (!strcmp(cmd, "grep"))
+        grepCommand(args);
+    else if (*cmd)
+        setStatusMessage("Unknown command: %s", cmd);
+}
+
+void command()
+{
+    char *cmd = prompt(":%s", NULL);
+    if (cmd == NULL)
+        return;
+
+    runCommand(cmd);
+    matFree(cmd);
+}
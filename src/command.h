@@ -0,0 +1,4 @@
+#pragma once
+
+void command();
+void runCommand(char *cmd);
@@ -0,0 +1,210 @@
+#include "complete.h"
+#include "input.h"
+#include "syntax.h"
+#include "utf8.h"
+#include "words.h"
+
+#include <stdio.h>
+#include <string.h>
+
+extern struct config E;
+
+// INSERT mode completion from the buffer's word index. Ctrl-N lists the words
+// that start with the identifier before the cursor in a popup under it,
+// Ctrl-P does the same starting from the last one; both then move through the
+// list, Tab or Enter puts in the rest of the chosen word, and typing or
+// deleting goes on narrowing it. Any other key closes the popup and does what
+// it always does. The popup is laid over the text lines of the frame, so it
+// goes through the same line by line comparison as the text and only lines it
+// changed are sent.
+static struct
+{
+    int open;
+    int count, selected;
+    int first; // the entry shown at the top
+    char words[COMPLETE_MAX][WORDS_MAX + 1];
+    int x, y, rows, width; // place on the frame being drawn, no rows when hidden
+} CP;
+
+// the start of the identifier that ends at the cursor
+static int completeStart()
+{
+    erow *row = &E.row[E.cy];
+    int start = E.cx;
+    while (start > 0 && wordsChar((unsigned char)row->chars[start - 1]))
+        start--;
+    return start;
+}
+
+// looks up what is typed now; the popup closes when nothing matches
+static int completeLookup()
+{
+    CP.count = 0;
+    if (E.cy < E.numRws)
+    {
+        int start = completeStart();
+        int len = E.cx - start;
+        if (len > 0 && len < WORDS_MAX)
+            CP.count = wordsComplete(&E.row[E.cy].chars[start], len, CP.words, COMPLETE_MAX);
+    }
+
+    CP.selected = 0;
+    CP.first = 0;
+    CP.open = CP.count > 0;
+    return CP.count;
+}
+
+static void completeMove(int dir)
+{
+    CP.selected = (CP.selected + dir + CP.count) % CP.count;
+}
+
+static void completeAccept()
+{
+    int len = E.cx - completeStart();
+    char *word = CP.words[CP.selected];
+    int rest = strlen(word) - len;
+
+    rwsInsertString(&E.row[E.cy], E.cx, word + len, rest);
+    E.cx += rest;
+    CP.open = 0;
+}
+
+// Takes the keys completion handles in INSERT mode. Returns 0 for keys that
+// are left to the caller.
+int completeKey(int c)
+{
+    if (!CP.open)
+    {
+        if (c != CTRL_KEY('n') && c != CTRL_KEY('p'))
+            return 0;
+        if (completeLookup() == 0)
+            setStatusMessage("No completions");
+        else if (c == CTRL_KEY('p'))
+            completeMove(-1);
+        return 1;
+    }
+
+    switch (c)
+    {
+    case CTRL_KEY('n'):
+        completeMove(1);
+        return 1;
+
+    case CTRL_KEY('p'):
+        completeMove(-1);
+        return 1;
+
+    case '\t':
+    case '\r':
+        completeAccept();
+        return 1;
+
+    case BACKSPACE:
+        deleteChar();
+        completeLookup();
+        return 1;
+    }
+
+    if (c > 0 && wordsChar(c))
+    {
+        insertChar(c);
+        completeLookup();
+        return 1;
+    }
+
+    CP.open = 0;
+    return 0;
+}
+
+// columns of a word, or how many bytes of it fit in *cols columns when less
+static int completeFit(const char *s, int *cols)
+{
+    int len = strlen(s), i = 0, col = 0, w;
+    while (i < len)
+    {
+        int n = utf8Char(&s[i], len - i, &w);
+        if (col + w > *cols)
+            break;
+        col += w;
+        i += n;
+    }
+    *cols = col;
+    return i;
+}
+
+// Puts the popup under the word being completed, or over it when there is
+// more room above, for the frame about to be drawn.
+void completePlace(int cursorY, int cursorX)
+{
+    CP.rows = 0;
+    if (!CP.open || E.current_mode != INSERT || E.cy >= E.numRws)
+        return;
+
+    CP.width = 0;
+    for (int i = 0; i < CP.count; i++)
+    {
+        int cols = E.screenCls;
+        completeFit(CP.words[i], &cols);
+        if (cols > CP.width)
+            CP.width = cols;
+    }
+    // a space either side, the first one left of the word's start
+    CP.width += 2;
+    if (CP.width > E.screenCls)
+        CP.width = E.screenCls;
+
+    erow *row = &E.row[E.cy];
+    CP.x = cursorX - (rwsCxToCol(row, E.cx) - rwsCxToCol(row, completeStart())) - 1;
+    if (CP.x + CP.width > E.screenCls)
+        CP.x = E.screenCls - CP.width;
+    if (CP.x < 0)
+        CP.x = 0;
+
+    int rows = CP.count < COMPLETE_ROWS ? CP.count : COMPLETE_ROWS;
+    int below = E.screenRws - cursorY - 1, above = cursorY;
+    if (rows > below && above > below)
+    {
+        CP.rows = rows < above ? rows : above;
+        CP.y = cursorY - CP.rows;
+    }
+    else
+    {
+        CP.rows = rows < below ? rows : below;
+        CP.y = cursorY + 1;
+    }
+
+    if (CP.selected < CP.first)
+        CP.first = CP.selected;
+    if (CP.selected >= CP.first + CP.rows)
+        CP.first = CP.selected - CP.rows + 1;
+}
+
+// Draws the popup's part of screen line y over the text already on it.
+void completeDraw(struct abuf *ab, int y)
+{
+    if (y < CP.y || y >= CP.y + CP.rows)
+        return;
+
+    int i = CP.first + y - CP.y;
+    char buf[16];
+    snprintf(buf, sizeof(buf), "\x1b[%dG", CP.x + 1);
+    abAppend(ab, buf, strlen(buf));
+
+    // hexToAnsiFore sets the background
+    const char *color = hexToAnsiFore(i == CP.selected ? "#89b4fa" : "#313244");
+    abAppend(ab, color, strlen(color));
+    if (i == CP.selected)
+    {
+        color = hexToAnsiBackground("#1E1D2D");
+        abAppend(ab, color, strlen(color));
+    }
+
+    int cols = CP.width - 2;
+    int len = completeFit(CP.words[i], &cols);
+    abAppend(ab, " ", 1);
+    abAppend(ab, CP.words[i], len);
+    for (cols++; cols < CP.width; cols++)
+        abAppend(ab, " ", 1);
+    abAppend(ab, "\x1b[0m", 4);
+}
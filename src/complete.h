@@ -0,0 +1,11 @@
+#pragma once
+
+#include "mat.h"
+
+// candidates looked up at a time, and how many of them the popup shows
+#define COMPLETE_MAX 64
+#define COMPLETE_ROWS 8
+
+int completeKey(int c);
+void completePlace(int cursorY, int cursorX);
+void completeDraw(struct abuf *ab, int y);
@@ -0,0 +1,142 @@
+#include "diff.h"
+#include "alloc.h"
+
+#include <string.h>
+
+// FNV-1a over the line's bytes, with the length folded in
+uint64_t diffHash(const char *s, int len)
+{
+    uint64_t h = 14695981039346656037ULL ^ (uint64_t)len;
+    for (int i = 0; i < len; i++)
+    {
+        h ^= (unsigned char)s[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static int diffPush(struct diff_hunk **out, int count, int a, int alen, int b, int blen)
+{
+    *out = matRealloc(ALLOC_UNDO, *out, sizeof(struct diff_hunk) * (count + 1));
+    (*out)[count] = (struct diff_hunk){a, alen, b, blen};
+    return count + 1;
+}
+
+// Myers' greedy search over the trimmed middle. Each round's furthest
+// reaching paths are kept, d * 2 + 1 of them for round d, so the edit path
+// can be walked back afterwards. Marks the lines that are not part of the
+// common subsequence and returns 0, or -1 when it needs more than
+// DIFF_MAX_EDITS edits.
+static int diffMyers(const uint64_t *a, int n, const uint64_t *b, int m, char *gone, char *added)
+{
+    int max = n + m < DIFF_MAX_EDITS ? n + m : DIFF_MAX_EDITS;
+    int *v = matMalloc(ALLOC_UNDO, sizeof(int) * (2 * max + 3));
+    int *trace = NULL;
+    int d, found = 0;
+
+    v[max + 1] = 0;
+    for (d = 0; d <= max && !found; d++)
+    {
+        trace = matRealloc(ALLOC_UNDO, trace, sizeof(int) * (d + 1) * (d + 1));
+        for (int k = -d; k <= d; k += 2)
+        {
+            int x;
+            if (k == -d || (k != d && v[max + k - 1] < v[max + k + 1]))
+                x = v[max + k + 1];
+            else
+                x = v[max + k - 1] + 1;
+            int y = x - k;
+            while (x < n && y < m && a[x] == b[y])
+                x++, y++;
+            v[max + k] = x;
+            if (x >= n && y >= m)
+                found = 1;
+        }
+        // round d occupies trace[d * d, (d + 1) * (d + 1)), indexed by k + d
+        for (int k = -d; k <= d; k++)
+            trace[d * d + k + d] = v[max + k];
+    }
+    matFree(v);
+
+    if (!found)
+    {
+        matFree(trace);
+        return -1;
+    }
+
+    int x = n, y = m;
+    for (d = d - 1; d > 0; d--)
+    {
+        int *prev = &trace[(d - 1) * (d - 1) + d - 1];
+        int k = x - y;
+        int down = k == -d || (k != d && prev[k - 1] < prev[k + 1]);
+        int pk = down ? k + 1 : k - 1;
+        int px = prev[pk], py = px - pk;
+
+        // one step from (px, py), then the snake up to (x, y)
+        if (down)
+            added[py] = 1;
+        else
+            gone[px] = 1;
+        x = px;
+        y = py;
+    }
+
+    matFree(trace);
+    return 0;
+}
+
+// Diffs two sequences of line hashes. The hunks, in order, are stored in
+// *out for the caller to free; returns how many there are. Edits beyond
+// DIFF_MAX_EDITS are not searched for: everything between the common
+// prefix and suffix becomes a single hunk instead.
+int diffLines(const uint64_t *a, int n, const uint64_t *b, int m, struct diff_hunk **out)
+{
+    int pre = 0, suf = 0, count = 0;
+    *out = NULL;
+
+    while (pre < n && pre < m && a[pre] == b[pre])
+        pre++;
+    while (suf < n - pre && suf < m - pre && a[n - 1 - suf] == b[m - 1 - suf])
+        suf++;
+
+    a += pre;
+    b += pre;
+    n -= pre + suf;
+    m -= pre + suf;
+    if (n == 0 && m == 0)
+        return 0;
+
+    char *gone = matMalloc(ALLOC_UNDO, n + m + 2);
+    char *added = gone + n + 1;
+    memset(gone, 0, n + m + 2);
+
+    if (n == 0 || m == 0 || diffMyers(a, n, b, m, gone, added) == -1)
+    {
+        matFree(gone);
+        return diffPush(out, 0, pre, n, pre, m);
+    }
+
+    int i = 0, j = 0;
+    while (i < n || j < m)
+    {
+        if (i < n && j < m && !gone[i] && !added[j])
+        {
+            i++, j++;
+            continue;
+        }
+
+        int ai = i, bj = j;
+        while ((i < n && gone[i]) || (j < m && added[j]))
+        {
+            while (i < n && gone[i])
+                i++;
+            while (j < m && added[j])
+                j++;
+        }
+        count = diffPush(out, count, pre + ai, i - ai, pre + bj, j - bj);
+    }
+
+    matFree(gone);
+    return count;
+}
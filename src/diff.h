@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdint.h>
+
+// most edits diffLines searches for before settling for one big hunk
+#define DIFF_MAX_EDITS 2048
+
+// rows [a, a + alen) of the old text became rows [b, b + blen) of the new
+struct diff_hunk
+{
+    int a, alen;
+    int b, blen;
+};
+
+uint64_t diffHash(const char *s, int len);
+int diffLines(const uint64_t *a, int n, const uint64_t *b, int m, struct diff_hunk **out);
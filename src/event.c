@@ -0,0 +1,85 @@
+#include "event.h"
+
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+
+#define EVENT_MAX 16
+
+// Descriptors waited on alongside the keyboard. readKey polls them all in one
+// call, so pending output drains and background work is picked up while the
+// editor sits waiting for the next key.
+static struct
+{
+    struct pollfd fds[EVENT_MAX];
+    event_fn fn[EVENT_MAX];
+    void *arg[EVENT_MAX];
+    int count;
+} EV;
+
+static int eventFind(int fd)
+{
+    for (int i = 0; i < EV.count; i++)
+        if (EV.fds[i].fd == fd)
+            return i;
+    return -1;
+}
+
+// Starts, changes or, with no events, stops watching fd.
+void eventWatch(int fd, short events, event_fn fn, void *arg)
+{
+    int i = eventFind(fd);
+
+    if (events == 0)
+    {
+        if (i != -1)
+        {
+            EV.count--;
+            EV.fds[i] = EV.fds[EV.count];
+            EV.fn[i] = EV.fn[EV.count];
+            EV.arg[i] = EV.arg[EV.count];
+        }
+        return;
+    }
+
+    if (i == -1)
+    {
+        if (EV.count == EVENT_MAX)
+            return;
+        i = EV.count++;
+    }
+
+    EV.fds[i].fd = fd;
+    EV.fds[i].events = events;
+    EV.fn[i] = fn;
+    EV.arg[i] = arg;
+}
+
+// Waits up to timeout milliseconds and runs the callbacks of the descriptors
+// that became ready. Returns 1 when a key is waiting on stdin.
+int eventWait(int timeout)
+{
+    struct pollfd fds[EVENT_MAX + 1];
+    int count = EV.count;
+
+    fds[0].fd = STDIN_FILENO;
+    fds[0].events = POLLIN;
+    fds[0].revents = 0;
+    memcpy(&fds[1], EV.fds, sizeof(struct pollfd) * count);
+
+    if (poll(fds, count + 1, timeout) <= 0)
+        return 0;
+
+    // a callback may stop watching other descriptors, so each one is looked
+    // up again rather than run from the copy
+    for (int i = 1; i <= count; i++)
+    {
+        if (fds[i].revents == 0)
+            continue;
+        int at = eventFind(fds[i].fd);
+        if (at != -1)
+            EV.fn[at](fds[i].fd, fds[i].revents, EV.arg[at]);
+    }
+
+    return fds[0].revents != 0;
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+typedef void (*event_fn)(int fd, short revents, void *arg);
+
+void eventWatch(int fd, short events, event_fn fn, void *arg);
+int eventWait(int timeout);
@@ -0,0 +1,390 @@
+#include "filter.h"
+#include "alloc.h"
+#include "buffer.h"
+#include "event.h"
+#include "mat.h"
+#include "substitute.h"
+#include "undo.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/uio.h>
+#include <sys/wait.h>
+
+extern struct config E;
+extern struct buffers B;
+
+// `:[range]!cmd` pipes rows through a shell command and puts what it prints
+// in their place. The command runs in the background on non-blocking pipes
+// served by the event loop: rows go in as fast as it reads them while its
+// output is collected, so neither side ends up waiting on the other however
+// large the text, and the editor keeps taking keys meanwhile. The rows are
+// referenced, not copied, when the command starts, and streamed straight
+// from those blocks. Once it exits successfully the output replaces them as
+// one undo step, provided they are still where they were; a row edited in
+// the meantime has been copied off its shared block, which is how that is
+// noticed. Ctrl-C ends a command that runs too long or prints too much,
+// together with anything it started, and drops its output.
+static struct
+{
+    pid_t pid;
+    int in, out, err; // our ends of the command's pipes, -1 once closed
+    int buffer;       // the buffer the rows came from
+    int first, count; // rows [first, first + count), 0-based
+    struct line_slice *rows;
+    int next;   // first row not completely written
+    size_t off; // bytes of it written, its newline included
+    char *output;
+    size_t len, cap;
+    char err_text[FILTER_ERR];
+    size_t err_len;
+    char *cmd;
+    int finished; // both pipes are closed, the output waits for filterPoll
+    int stopped;  // killed with Ctrl-C, the output is dropped
+    int replaced; // rows the output became, -1 when it was dropped
+} FI = {0, -1, -1, -1, 0, 0, 0, NULL, 0, 0, NULL, 0, 0, "", 0, NULL, 0, 0, 0};
+
+static void filterClose(int *fd)
+{
+    if (*fd == -1)
+        return;
+    eventWatch(*fd, 0, NULL, NULL);
+    close(*fd);
+    *fd = -1;
+}
+
+// in the buffer the rows came from
+static void filterApply(void *arg)
+{
+    (void)arg;
+
+    FI.replaced = -1;
+    if (FI.first + FI.count > E.numRws)
+        return;
+    for (int j = 0; j < FI.count; j++)
+        if (E.row[FI.first + j].chars != FI.rows[j].chars)
+            return;
+
+    undoBoundary();
+    deleteRwsRange(FI.first, FI.count);
+    insertRwsBlock(FI.first, FI.output, FI.len);
+    undoBoundary();
+
+    FI.replaced = 0;
+    for (size_t i = 0; i < FI.len; i++)
+        if (FI.output[i] == '\n')
+            FI.replaced++;
+    if (FI.len > 0 && FI.output[FI.len - 1] != '\n')
+        FI.replaced++;
+
+    E.cy = FI.first < E.numRws ? FI.first : E.numRws;
+    E.cx = 0;
+}
+
+// Puts in the output of a finished command. Called from idleTick while no
+// prompt is up and in NORMAL mode, like a reload, since a prompt keeps
+// pointers into the rows. A command can close its output and go on running,
+// so it is only reaped once it has exited, on a later tick if need be.
+void filterPoll()
+{
+    if (!FI.finished)
+        return;
+
+    int status = 0;
+    pid_t done;
+    while ((done = waitpid(FI.pid, &status, WNOHANG)) == -1 && errno == EINTR)
+        ;
+    if (done == 0)
+        return;
+    FI.finished = 0;
+    filterClose(&FI.in);
+
+    if (FI.stopped)
+        setStatusMessage("Stopped %s", FI.cmd);
+    else if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        // the command's own complaint, up to its first newline
+        char *nl = memchr(FI.err_text, '\n', FI.err_len);
+        int len = nl ? nl - FI.err_text : (int)FI.err_len;
+        int code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+        setStatusMessage("%s: exit %d%s%.*s", FI.cmd, code, len ? ": " : "", len, FI.err_text);
+    }
+    else
+    {
+        bufferRun(FI.buffer, filterApply, NULL);
+        if (FI.replaced == -1)
+            setStatusMessage("Rows changed while filtering, output of %s dropped", FI.cmd);
+        else
+            setStatusMessage("Filtered %d line%s through %s into %d", FI.count, FI.count == 1 ? "" : "s",
+                             FI.cmd, FI.replaced);
+    }
+
+    for (int j = 0; j < FI.count; j++)
+        lineFree(FI.rows[j].chars);
+    matFree(FI.rows);
+    matFree(FI.output);
+    free(FI.cmd);
+    FI.rows = NULL;
+    FI.output = NULL;
+    FI.cmd = NULL;
+    FI.pid = 0;
+    FI.stopped = 0;
+
+    refreshScreen();
+}
+
+// Kills the running command with everything it started, for Ctrl-C. Returns
+// 0 when there is none. filterPoll reaps it and drops what it printed.
+int filterStop()
+{
+    if (FI.pid == 0 || FI.stopped)
+        return 0;
+
+    if (kill(-FI.pid, SIGKILL) == -1)
+        kill(FI.pid, SIGKILL);
+    filterClose(&FI.in);
+    filterClose(&FI.out);
+    filterClose(&FI.err);
+    FI.stopped = 1;
+    FI.finished = 1;
+    return 1;
+}
+
+// feeds as many rows as the pipe takes; each is its text and a newline
+static void filterWritable(int fd, short revents, void *arg)
+{
+    (void)revents;
+    (void)arg;
+
+    while (FI.next < FI.count)
+    {
+        struct iovec iov[FILTER_IOV * 2];
+        int n = 0;
+        size_t off = FI.off;
+
+        for (int j = FI.next; j < FI.count && n + 2 <= FILTER_IOV * 2; j++, off = 0)
+        {
+            struct line_slice *row = &FI.rows[j];
+            size_t size = row->to - row->from;
+            if (off < size)
+                iov[n++] = (struct iovec){row->chars + off, size - off};
+            iov[n++] = (struct iovec){"\n", 1};
+        }
+
+        ssize_t written = writev(fd, iov, n);
+        if (written == -1 && errno == EINTR)
+            continue;
+        if (written == -1 && errno == EAGAIN)
+            return;
+        if (written == -1)
+            break; // the command stopped reading, which is up to it
+
+        // advance row by row through what the pipe took
+        size_t left = written;
+        while (left > 0)
+        {
+            size_t rest = FI.rows[FI.next].to - FI.rows[FI.next].from + 1 - FI.off;
+            if (left < rest)
+            {
+                FI.off += left;
+                break;
+            }
+            left -= rest;
+            FI.next++;
+            FI.off = 0;
+        }
+    }
+
+    // end of input
+    filterClose(&FI.in);
+}
+
+static void filterReadable(int fd, short revents, void *arg)
+{
+    (void)revents;
+    (void)arg;
+
+    if (FI.len == FI.cap)
+    {
+        FI.cap = FI.cap ? FI.cap * 2 : 1 << 16;
+        FI.output = matRealloc(ALLOC_ROWS, FI.output, FI.cap);
+    }
+
+    ssize_t n = read(fd, FI.output + FI.len, FI.cap - FI.len);
+    if (n > 0)
+        FI.len += n;
+    else if (n == 0 || (errno != EINTR && errno != EAGAIN))
+    {
+        filterClose(&FI.out);
+        FI.finished = FI.err == -1;
+    }
+}
+
+// error output past what the status line shows is read and dropped
+static void filterErrors(int fd, short revents, void *arg)
+{
+    (void)revents;
+    (void)arg;
+
+    char buf[4096];
+    ssize_t n = read(fd, buf, sizeof(buf));
+    if (n > 0)
+    {
+        size_t keep = sizeof(FI.err_text) - FI.err_len;
+        if ((size_t)n < keep)
+            keep = n;
+        memcpy(FI.err_text + FI.err_len, buf, keep);
+        FI.err_len += keep;
+    }
+    else if (n == 0 || (errno != EINTR && errno != EAGAIN))
+    {
+        filterClose(&FI.err);
+        FI.finished = FI.out == -1;
+    }
+}
+
+// a pipe the editor keeps to itself, made without pipe2, which macOS lacks
+static int filterPipe(int p[2])
+{
+    if (pipe(p) == -1)
+        return -1;
+    fcntl(p[0], F_SETFD, FD_CLOEXEC);
+    fcntl(p[1], F_SETFD, FD_CLOEXEC);
+    return 0;
+}
+
+static pid_t filterSpawn(const char *cmd, int *in, int *out, int *err)
+{
+    int pin[2], pout[2], perr[2];
+    if (filterPipe(pin) == -1)
+        return -1;
+    if (filterPipe(pout) == -1)
+    {
+        close(pin[0]);
+        close(pin[1]);
+        return -1;
+    }
+    if (filterPipe(perr) == -1)
+    {
+        close(pin[0]);
+        close(pin[1]);
+        close(pout[0]);
+        close(pout[1]);
+        return -1;
+    }
+
+    // in a process group of its own, so Ctrl-C reaches a whole pipeline
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        setpgid(0, 0);
+        dup2(pin[0], STDIN_FILENO);
+        dup2(pout[1], STDOUT_FILENO);
+        dup2(perr[1], STDERR_FILENO);
+        // ignored here, but the command may rely on it
+        signal(SIGPIPE, SIG_DFL);
+        execl("/bin/sh", "sh", "-c", cmd, (char *)NULL);
+        _exit(127);
+    }
+
+    if (pid > 0)
+        setpgid(pid, pid);
+    close(pin[0]);
+    close(pout[1]);
+    close(perr[1]);
+    if (pid == -1)
+    {
+        close(pin[1]);
+        close(pout[0]);
+        close(perr[0]);
+        return -1;
+    }
+
+    fcntl(pin[1], F_SETFL, O_NONBLOCK);
+    fcntl(pout[0], F_SETFL, O_NONBLOCK);
+    fcntl(perr[0], F_SETFL, O_NONBLOCK);
+    *in = pin[1];
+    *out = pout[0];
+    *err = perr[0];
+    return pid;
+}
+
+// Starts filtering rows [first, last], 1-based, through cmd.
+void filterStart(int first, int last, const char *cmd)
+{
+    if (FI.pid)
+    {
+        setStatusMessage("%s is still running, Ctrl-C stops it", FI.cmd);
+        return;
+    }
+    if (E.pager)
+    {
+        setStatusMessage("Read-only buffer");
+        return;
+    }
+
+    if (first < 1)
+        first = 1;
+    if (last > E.numRws)
+        last = E.numRws;
+    if (first > last + 1)
+        first = last + 1;
+
+    // a write to a command that has exited must fail rather than kill us
+    signal(SIGPIPE, SIG_IGN);
+
+    FI.pid = filterSpawn(cmd, &FI.in, &FI.out, &FI.err);
+    if (FI.pid == -1)
+    {
+        FI.pid = 0;
+        setStatusMessage("Cannot run %s: %s", cmd, strerror(errno));
+        return;
+    }
+
+    FI.buffer = B.current;
+    FI.first = first - 1;
+    FI.count = last - first + 1;
+    FI.rows = matMalloc(ALLOC_ROWS, sizeof(struct line_slice) * (FI.count ? FI.count : 1));
+    for (int j = 0; j < FI.count; j++)
+    {
+        erow *row = &E.row[FI.first + j];
+        FI.rows[j] = (struct line_slice){lineRef(row->chars), 0, row->size};
+    }
+    FI.next = 0;
+    FI.off = 0;
+    FI.len = FI.cap = 0;
+    FI.err_len = 0;
+    FI.cmd = strdup(cmd);
+
+    eventWatch(FI.in, POLLOUT, filterWritable, NULL);
+    eventWatch(FI.out, POLLIN, filterReadable, NULL);
+    eventWatch(FI.err, POLLIN, filterErrors, NULL);
+    setStatusMessage("Filtering %d line%s through %s", FI.count, FI.count == 1 ? "" : "s", cmd);
+}
+
+// Handles [range]!cmd, the range defaulting to the cursor line. Returns 0
+// when cmd is not a filter.
+int filterCommand(char *cmd)
+{
+    int first, last;
+    char *p = substituteRange(cmd, &first, &last);
+
+    if (p == NULL || *p != '!')
+        return 0;
+    while (*++p == ' ')
+        ;
+    if (*p == '\0')
+    {
+        setStatusMessage("Usage: [range]!command");
+        return 1;
+    }
+
+    filterStart(first, last, p);
+    return 1;
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+// rows handed to one writev while feeding a filter
+#define FILTER_IOV 64
+// bytes of the command's error output kept for the status line
+#define FILTER_ERR 64
+
+int filterCommand(char *cmd);
+void filterStart(int first, int last, const char *cmd);
+void filterPoll();
+int filterStop();
@@ -0,0 +1,368 @@
+#include "follow.h"
+#include "alloc.h"
+#include "buffer.h"
+#include "event.h"
+#include "journal.h"
+#include "mat.h"
+#include "reload.h"
+#include "undo.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+extern struct config E;
+extern struct buffers B;
+
+// Following is built on inotify, which only Linux has; elsewhere :follow
+// says so and nothing else here is compiled.
+#ifdef __linux__
+
+#include <sys/inotify.h>
+
+#define FOLLOW_CHUNK (1 << 20)
+
+// A followed buffer keeps its file open and reads only what was appended
+// past the bytes it already holds. The file's directory is watched as well,
+// so a log rotated by rename or delete-and-create is picked up at its path.
+struct follow
+{
+    int buffer;
+    int fd;
+    int wd, dirwd;
+    char *name; // the file's name within its directory
+    long long offset;
+    int open; // the last row has no newline yet and grows with the next read
+};
+
+static struct
+{
+    int ifd;
+    struct follow *items;
+    int count;
+} FL = {-1, NULL, 0};
+
+static struct follow *followFind(int buffer)
+{
+    for (int i = 0; i < FL.count; i++)
+        if (FL.items[i].buffer == buffer)
+            return &FL.items[i];
+    return NULL;
+}
+
+// appends file bytes to the last rows, called with the buffer's state in E
+static void followAppend(struct follow *f, char *s, size_t len)
+{
+    char *end = s + len;
+
+    if (f->open && E.numRws > 0)
+    {
+        char *nl = memchr(s, '\n', len);
+        size_t n = (nl ? nl : end) - s;
+        if (n)
+            rwsAppendString(&E.row[E.numRws - 1], s, n);
+        s += n;
+        if (nl)
+        {
+            s++;
+            f->open = 0;
+        }
+    }
+
+    if (s == end)
+        return;
+
+    insertRwsBlock(E.numRws, s, end - s);
+    f->open = end[-1] != '\n';
+}
+
+static void followRead(struct follow *f, long long size)
+{
+    if (f->offset >= size)
+        return;
+
+    char *buf = matMalloc(ALLOC_ROWS, FOLLOW_CHUNK);
+    while (f->offset < size)
+    {
+        size_t want = size - f->offset < FOLLOW_CHUNK ? size - f->offset : FOLLOW_CHUNK;
+        ssize_t n = pread(f->fd, buf, want, f->offset);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        followAppend(f, buf, n);
+        f->offset += n;
+    }
+    matFree(buf);
+}
+
+// Starts over from the file now at the buffer's path, after it was truncated
+// or replaced. Row positions mean nothing across that, so undo goes too. Only
+// done for a buffer without edits.
+static void followReload(struct follow *f)
+{
+    int fd = open(E.current_file_name, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return;
+
+    close(f->fd);
+    f->fd = fd;
+    f->offset = 0;
+    f->open = 0;
+
+    inotify_rm_watch(FL.ifd, f->wd);
+    f->wd = inotify_add_watch(FL.ifd, E.current_file_name, IN_MODIFY);
+
+    deleteRwsRange(0, E.numRws);
+    undoFree(E.undo);
+    E.undo = NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) == 0)
+    {
+        followRead(f, st.st_size);
+        E.diskMtime = reloadMtime(&st);
+    }
+
+    E.cy = E.cx = 0;
+    E.rowOff = E.colOff = 0;
+}
+
+struct follow_update
+{
+    struct follow *f;
+    int rotated;
+    int stop; // set when the file was replaced under unsaved edits
+};
+
+static void followUpdate(void *arg)
+{
+    struct follow_update *u = arg;
+    struct follow *f = u->f;
+    struct journal *journal = E.journal;
+    int dirty = E.dirty;
+    int atEnd = E.cy >= E.numRws - 1;
+    const char *changed = NULL;
+    int reload = 1;
+    struct stat st;
+
+    if (fstat(f->fd, &st) == 0 && st.st_size < f->offset)
+        changed = "truncated";
+    else if (u->rotated)
+        changed = "replaced";
+    else if (fstat(f->fd, &st) == 0 && st.st_size > f->offset)
+    {
+        changed = "appended to";
+        reload = 0;
+    }
+    if (changed == NULL)
+        return;
+
+    // The journal's records replay over the file as it was loaded, and rows
+    // read in past them could not be put back in the same order after a
+    // crash. So edits end following and the buffer is left as it is, as
+    // reloadPoll does for a changed file.
+    if (dirty)
+    {
+        u->stop = 1;
+        setStatusMessage("%s was %s, stopped following, :reload drops your edits", E.current_file_name, changed);
+        return;
+    }
+
+    // tailing is nothing to undo, and the journal starts over below
+    E.journal = NULL;
+    undoSuspend(1);
+
+    // whatever was written to the old file before it was moved away still
+    // belongs to it
+    if (fstat(f->fd, &st) == 0)
+        followRead(f, st.st_size);
+
+    if (reload)
+    {
+        followReload(f);
+        setStatusMessage("%s was %s, reloaded", E.current_file_name, changed);
+    }
+
+    // a cursor on the last row stays there, keeping the tail in view
+    if (atEnd && E.numRws > 0 && E.cy != E.numRws - 1)
+    {
+        E.cy = E.numRws - 1;
+        E.cx = 0;
+    }
+
+    E.diskSize = f->offset;
+    if (fstat(f->fd, &st) == 0)
+        E.diskMtime = reloadMtime(&st);
+    undoSuspend(0);
+    E.journal = journal;
+    E.dirty = 0;
+
+    // edits from here on apply to the file as it now is on disk
+    journalReset(E.current_file_name);
+}
+
+static void followStop(struct follow *f)
+{
+    inotify_rm_watch(FL.ifd, f->wd);
+
+    int shared = 0;
+    for (int i = 0; i < FL.count; i++)
+        if (&FL.items[i] != f && FL.items[i].dirwd == f->dirwd)
+            shared = 1;
+    if (!shared)
+        inotify_rm_watch(FL.ifd, f->dirwd);
+
+    close(f->fd);
+    free(f->name);
+    *f = FL.items[--FL.count];
+}
+
+static void followEvents(int fd, short revents, void *arg)
+{
+    (void)revents;
+    (void)arg;
+
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len = read(fd, buf, sizeof(buf));
+    if (len <= 0)
+        return;
+
+    // several events for one file come as a batch, one update covers them
+    int *hit = matMalloc(ALLOC_BUFFERS, sizeof(int) * FL.count);
+    memset(hit, 0, sizeof(int) * FL.count);
+
+    for (char *p = buf; p < buf + len;)
+    {
+        struct inotify_event *ev = (struct inotify_event *)p;
+        for (int i = 0; i < FL.count; i++)
+        {
+            struct follow *f = &FL.items[i];
+            if (ev->wd == f->wd)
+                hit[i] |= 1;
+            else if (ev->wd == f->dirwd && ev->len && strcmp(ev->name, f->name) == 0)
+                hit[i] |= 2;
+        }
+        p += sizeof(struct inotify_event) + ev->len;
+    }
+
+    // backwards, since followStop moves the last item into the one it ends
+    int redraw = 0;
+    for (int i = FL.count - 1; i >= 0; i--)
+    {
+        if (!hit[i])
+            continue;
+        struct follow_update u = {&FL.items[i], (hit[i] & 2) != 0, 0};
+        bufferRun(FL.items[i].buffer, followUpdate, &u);
+        redraw |= FL.items[i].buffer == B.current;
+        if (u.stop)
+            followStop(&FL.items[i]);
+    }
+    matFree(hit);
+
+    if (redraw)
+        refreshScreen();
+}
+
+static int followStart()
+{
+    if (FL.ifd == -1)
+    {
+        FL.ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (FL.ifd == -1)
+            return -1;
+        eventWatch(FL.ifd, POLLIN, followEvents, NULL);
+    }
+
+    int fd = open(E.current_file_name, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return -1;
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s", E.current_file_name);
+    char *dir = dirname(path);
+    int dirwd = inotify_add_watch(FL.ifd, dir, IN_CREATE | IN_MOVED_TO);
+    int wd = inotify_add_watch(FL.ifd, E.current_file_name, IN_MODIFY);
+    if (wd == -1 || dirwd == -1)
+    {
+        close(fd);
+        return -1;
+    }
+
+    FL.items = matRealloc(ALLOC_BUFFERS, FL.items, sizeof(struct follow) * (FL.count + 1));
+    struct follow *f = &FL.items[FL.count++];
+
+    snprintf(path, sizeof(path), "%s", E.current_file_name);
+    f->buffer = B.current;
+    f->fd = fd;
+    f->wd = wd;
+    f->dirwd = dirwd;
+    f->name = strdup(basename(path));
+    f->offset = E.diskSize;
+
+    // a file not ending in a newline was loaded with a partial last row
+    char last = '\n';
+    f->open = f->offset > 0 && pread(fd, &last, 1, f->offset - 1) == 1 && last != '\n';
+
+    // catch up with whatever was written since the file was read
+    struct follow_update u = {f, 0, 0};
+    followUpdate(&u);
+    if (u.stop)
+    {
+        followStop(f);
+        return 1;
+    }
+    return 0;
+}
+
+int followed(int buffer)
+{
+    return followFind(buffer) != NULL;
+}
+
+// Toggles following the current buffer's file as it grows.
+void followToggle()
+{
+    struct follow *f = followFind(B.current);
+    if (f)
+    {
+        followStop(f);
+        setStatusMessage("Stopped following %s", E.current_file_name);
+        return;
+    }
+
+    if (E.current_file_name == NULL)
+        setStatusMessage("Nothing to follow: buffer has no file");
+    else if (E.pager)
+        setStatusMessage("Cannot follow %s in the pager", E.current_file_name);
+    else
+    {
+        // 1 when the file was already replaced and followUpdate said so
+        int started = followStart();
+        if (started == -1)
+            setStatusMessage("Cannot follow %s: %s", E.current_file_name, strerror(errno));
+        else if (started == 0)
+            setStatusMessage("Following %s", E.current_file_name);
+    }
+}
+
+#else
+
+int followed(int buffer)
+{
+    (void)buffer;
+    return 0;
+}
+
+void followToggle()
+{
+    setStatusMessage("Cannot follow files: this system has no inotify");
+}
+
+#endif
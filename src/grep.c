@@ -0,0 +1,831 @@
+#include "grep.h"
+#include "alloc.h"
+#include "buffer.h"
+#include "event.h"
+#include "hex.h"
+#include "input.h"
+#include "mat.h"
+#include "motion.h"
+#include "pager.h"
+#include "undo.h"
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+extern struct config E;
+extern struct buffers B;
+
+// `:grep text` searches every file under the working directory for text and
+// lists the lines holding it, as path:line:text, in a results buffer where
+// Enter opens the file at the match. Matching is a plain substring search
+// over the file's bytes, as the pager's `/` does.
+//
+// Directories are the unit of work. Each worker has a deque of them: it takes
+// the newest one from its own end, which keeps it deep in one subtree, and an
+// idle worker steals the oldest one from another's, which is a large subtree
+// near the top. Listing a directory pushes its subdirectories and searches its
+// files. Files with a NUL in their first bytes are binary and skipped, as is
+// whatever a .gitignore on the way down excludes, and .git itself.
+//
+// Files are read a window at a time, so a worker holds at most GREP_WINDOW
+// bytes of one however large it is.
+//
+// Results are collected per worker and handed over in chunks through a pipe
+// the event loop watches, so the buffer fills while the search runs and the
+// editor keeps taking keys. Ctrl-C stops a search and keeps what it found.
+struct grep_rule
+{
+    char *pattern;
+    int negate;   // a leading '!' takes a path back in
+    int dironly;  // a trailing '/' only matches directories
+    int anchored; // a '/' in it matches from the .gitignore's directory
+};
+
+// the rules of one .gitignore, chained to those of the directories above
+struct grep_ignore
+{
+    struct grep_ignore *parent;
+    struct grep_ignore *next; // every one made by this search, freed at its end
+    int baselen;              // length of its directory's path, 0 at the top
+    struct grep_rule *rules;
+    int count;
+    char *text;
+};
+
+struct grep_task
+{
+    char *path; // "." for the working directory
+    struct grep_ignore *ignore;
+};
+
+struct grep_chunk
+{
+    struct grep_chunk *next;
+    char *text;
+    size_t len;
+};
+
+struct grep_worker
+{
+    pthread_t thread;
+    pthread_mutex_t lock; // the deque: the owner works at its tail, thieves at its head
+    struct grep_task *tasks;
+    int head, tail, cap;
+
+    char *file; // GREP_WINDOW bytes of the file being searched
+    char *out;  // results not handed over yet
+    size_t len, outCap;
+    long files, matches, skipped;
+};
+
+static struct
+{
+    int buffer; // the results buffer, -1 until the first search
+    int running;
+    char *pattern;
+    size_t plen;
+    int threads;
+    int spawned; // workers running on threads of their own, the first ones
+    struct grep_worker workers[GREP_MAX_THREADS];
+    int wake[2];
+    struct timespec started;
+
+    // guarded by grepLock
+    int queued;  // tasks in the deques
+    int pending; // tasks queued or being worked on
+    int stop;
+    int exited;
+    struct grep_chunk *chunks; // newest first
+    struct grep_ignore *ignores;
+    long files, matches, skipped;
+} GR = {-1, 0, NULL, 0, 0, 0, {{0}}, {-1, -1}, {0, 0}, 0, 0, 0, 0, NULL, NULL, 0, 0, 0};
+
+static pthread_mutex_t grepLock = PTHREAD_MUTEX_INITIALIZER;
+// signalled when a task is queued and when the last one is done
+static pthread_cond_t grepWork = PTHREAD_COND_INITIALIZER;
+
+static void grepWake()
+{
+    ssize_t w = write(GR.wake[1], "", 1);
+    (void)w;
+}
+
+// Reads the .gitignore in dir, if there is one, into rules that apply below
+// it. Returns parent when there is nothing to add.
+static struct grep_ignore *grepIgnoreLoad(const char *dir, struct grep_ignore *parent)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/.gitignore", dir);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return parent;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size == 0)
+    {
+        close(fd);
+        return parent;
+    }
+    char *text = matMalloc(ALLOC_SEARCH, st.st_size + 1);
+    ssize_t n = read(fd, text, st.st_size);
+    close(fd);
+    if (n <= 0)
+    {
+        matFree(text);
+        return parent;
+    }
+    text[n] = '\0';
+
+    struct grep_ignore *ig = matMalloc(ALLOC_SEARCH, sizeof(struct grep_ignore));
+    ig->parent = parent;
+    ig->baselen = strcmp(dir, ".") ? strlen(dir) : 0;
+    ig->text = text;
+    ig->count = 0;
+    ig->rules = matMalloc(ALLOC_SEARCH, sizeof(struct grep_rule) * (n / 2 + 1));
+
+    for (char *line = text, *next; line < text + n; line = next)
+    {
+        char *nl = strchr(line, '\n');
+        next = nl ? nl + 1 : text + n;
+        char *end = nl ? nl : text + n;
+        while (end > line && (end[-1] == '\r' || end[-1] == ' ' || end[-1] == '\t'))
+            end--;
+        *end = '\0';
+        if (*line == '\0' || *line == '#')
+            continue;
+
+        struct grep_rule r = {line, 0, 0, 0};
+        if (*r.pattern == '!')
+        {
+            r.negate = 1;
+            r.pattern++;
+        }
+        else if (*r.pattern == '\\')
+            r.pattern++;
+        if (end > r.pattern && end[-1] == '/')
+        {
+            r.dironly = 1;
+            *--end = '\0';
+        }
+        // everything inside a directory goes with the directory
+        if (end - r.pattern > 3 && strcmp(end - 3, "/**") == 0)
+        {
+            r.dironly = 1;
+            *(end -= 3) = '\0';
+        }
+        // fnmatch has no **; a leading one matches at any depth anyway
+        while (strncmp(r.pattern, "**/", 3) == 0)
+            r.pattern += 3;
+        if (*r.pattern == '/')
+        {
+            r.anchored = 1;
+            r.pattern++;
+        }
+        else
+            r.anchored = strchr(r.pattern, '/') != NULL;
+
+        if (*r.pattern)
+            ig->rules[ig->count++] = r;
+    }
+
+    pthread_mutex_lock(&grepLock);
+    ig->next = GR.ignores;
+    GR.ignores = ig;
+    pthread_mutex_unlock(&grepLock);
+    return ig;
+}
+
+// The nearest .gitignore with a rule for path decides, and within one the
+// last rule that matches.
+static int grepIgnored(struct grep_ignore *ig, const char *path, const char *name, int dir)
+{
+    for (; ig; ig = ig->parent)
+    {
+        const char *rel = ig->baselen ? path + ig->baselen + 1 : path;
+        for (int i = ig->count - 1; i >= 0; i--)
+        {
+            struct grep_rule *r = &ig->rules[i];
+            if (r->dironly && !dir)
+                continue;
+            if (fnmatch(r->pattern, r->anchored ? rel : name, r->anchored ? FNM_PATHNAME : 0) == 0)
+                return !r->negate;
+        }
+    }
+    return 0;
+}
+
+static void grepPush(struct grep_worker *w, char *path, struct grep_ignore *ignore)
+{
+    // counted first, so a worker waiting for tasks never misses one
+    pthread_mutex_lock(&grepLock);
+    GR.queued++;
+    GR.pending++;
+    pthread_cond_signal(&grepWork);
+    pthread_mutex_unlock(&grepLock);
+
+    pthread_mutex_lock(&w->lock);
+    if (w->tail == w->cap)
+    {
+        if (w->head > 0)
+        {
+            memmove(w->tasks, w->tasks + w->head, sizeof(struct grep_task) * (w->tail - w->head));
+            w->tail -= w->head;
+            w->head = 0;
+        }
+        else
+        {
+            w->cap = w->cap ? w->cap * 2 : 64;
+            w->tasks = matRealloc(ALLOC_SEARCH, w->tasks, sizeof(struct grep_task) * w->cap);
+        }
+    }
+    w->tasks[w->tail++] = (struct grep_task){path, ignore};
+    pthread_mutex_unlock(&w->lock);
+}
+
+// the newest task of the worker's own deque, or the oldest of another's
+static int grepTake(struct grep_worker *w, struct grep_task *task, int own)
+{
+    int found = 0;
+    pthread_mutex_lock(&w->lock);
+    if (w->head < w->tail)
+    {
+        *task = own ? w->tasks[--w->tail] : w->tasks[w->head++];
+        found = 1;
+    }
+    pthread_mutex_unlock(&w->lock);
+    return found;
+}
+
+static int grepNext(struct grep_worker *w, struct grep_task *task)
+{
+    int self = w - GR.workers;
+
+    while (1)
+    {
+        int found = grepTake(w, task, 1);
+        for (int k = 1; !found && k < GR.threads; k++)
+            found = grepTake(&GR.workers[(self + k) % GR.threads], task, 0);
+
+        pthread_mutex_lock(&grepLock);
+        if (found)
+            GR.queued--;
+        else
+            while (!GR.stop && GR.pending > 0 && GR.queued == 0)
+                pthread_cond_wait(&grepWork, &grepLock);
+        int more = !GR.stop && GR.pending > 0;
+        pthread_mutex_unlock(&grepLock);
+
+        if (found)
+            return 1;
+        if (!more)
+            return 0;
+    }
+}
+
+// checked between files and windows, so Ctrl-C does not wait out a large tree
+static int grepStopped()
+{
+    pthread_mutex_lock(&grepLock);
+    int stop = GR.stop;
+    pthread_mutex_unlock(&grepLock);
+    return stop;
+}
+
+static void grepFlush(struct grep_worker *w)
+{
+    if (w->len == 0)
+        return;
+
+    struct grep_chunk *c = matMalloc(ALLOC_SEARCH, sizeof(struct grep_chunk));
+    c->text = w->out;
+    c->len = w->len;
+    w->out = NULL;
+    w->len = w->outCap = 0;
+
+    pthread_mutex_lock(&grepLock);
+    int first = GR.chunks == NULL;
+    c->next = GR.chunks;
+    GR.chunks = c;
+    pthread_mutex_unlock(&grepLock);
+    if (first)
+        grepWake();
+}
+
+static void grepEmit(struct grep_worker *w, const char *path, int line, const char *text, size_t len)
+{
+    while (len > 0 && text[len - 1] == '\r')
+        len--;
+    if (len > GREP_LINE_MAX)
+        len = GREP_LINE_MAX;
+
+    size_t need = strlen(path) + len + 16;
+    if (w->len + need > w->outCap)
+    {
+        w->outCap = w->outCap * 2 > w->len + need ? w->outCap * 2 : w->len + need + GREP_CHUNK;
+        w->out = matRealloc(ALLOC_SEARCH, w->out, w->outCap);
+    }
+    w->len += snprintf(w->out + w->len, w->outCap - w->len, "%s:%d:", path, line);
+    memcpy(w->out + w->len, text, len);
+    w->len += len;
+    w->out[w->len++] = '\n';
+}
+
+// reads up to want bytes, fewer only at the end of the file or on an error
+static size_t grepRead(int fd, char *buf, size_t want)
+{
+    size_t len = 0;
+    while (len < want)
+    {
+        ssize_t n = read(fd, buf + len, want - len);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        len += n;
+    }
+    return len;
+}
+
+// Searches text for the pattern, one result per matching line. *line is the
+// number of its first line; with count set it is moved past the rest of the
+// text too, for a window more of the file follows. *emitted is the last line
+// reported, which keeps a long line cut by windows from being listed twice.
+static void grepText(struct grep_worker *w, const char *path, const char *text, size_t len,
+                     int *line, int *emitted, int count)
+{
+    // lines are only counted up to each hit unless more text follows
+    const char *end = text + len, *p = text, *counted = text, *bol = text;
+    const char *hit;
+    while (p < end && (hit = memmem(p, end - p, GR.pattern, GR.plen)) != NULL)
+    {
+        const char *nl;
+        while ((nl = memchr(counted, '\n', hit - counted)) != NULL)
+        {
+            (*line)++;
+            bol = counted = nl + 1;
+        }
+        counted = hit;
+
+        const char *eol = memchr(hit, '\n', end - hit);
+        if (eol == NULL)
+            eol = end;
+        if (*line != *emitted)
+        {
+            grepEmit(w, path, *line, bol, eol - bol);
+            w->matches++;
+            *emitted = *line;
+        }
+        p = eol;
+    }
+
+    if (count)
+        for (const char *nl; (nl = memchr(counted, '\n', end - counted)) != NULL; counted = nl + 1)
+            (*line)++;
+}
+
+static void grepFile(struct grep_worker *w, const char *path)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return;
+
+    struct stat st;
+    int stated = fstat(fd, &st) == 0;
+    if (!stated || st.st_size == 0 || st.st_size > GREP_FILE_MAX)
+    {
+        if (stated && st.st_size > GREP_FILE_MAX)
+            w->skipped++;
+        close(fd);
+        return;
+    }
+    if (w->file == NULL && (w->file = matMalloc(ALLOC_SEARCH, GREP_WINDOW)) == NULL)
+    {
+        close(fd);
+        return;
+    }
+
+    // a binary file is told by its first bytes and read no further
+    size_t len = grepRead(fd, w->file, GREP_WINDOW);
+    if (memchr(w->file, '\0', len < HEX_PROBE ? len : HEX_PROBE))
+    {
+        close(fd);
+        return;
+    }
+    w->files++;
+
+    // Each window is searched up to its last newline and the line it ends in
+    // starts the next one. A line that fills a whole window is searched in
+    // pieces that overlap by less than the pattern, so no hit is cut.
+    int eof = len < GREP_WINDOW, line = 1, emitted = 0;
+    while (len > 0)
+    {
+        size_t upto = len, keep = 0;
+        if (!eof)
+        {
+            // memrchr would do, where the C library has it
+            while (upto > 0 && w->file[upto - 1] != '\n')
+                upto--;
+            keep = upto ? len - upto : (GR.plen - 1 < len ? GR.plen - 1 : len);
+            if (upto == 0)
+                upto = len;
+        }
+        grepText(w, path, w->file, upto, &line, &emitted, !eof);
+        if (eof || grepStopped())
+            break;
+
+        memmove(w->file, w->file + len - keep, keep);
+        size_t got = grepRead(fd, w->file + keep, GREP_WINDOW - keep);
+        eof = got < GREP_WINDOW - keep;
+        len = keep + got;
+    }
+    close(fd);
+
+    if (w->len >= GREP_CHUNK)
+        grepFlush(w);
+}
+
+static void grepDirectory(struct grep_worker *w, struct grep_task *task)
+{
+    DIR *dir = opendir(task->path);
+    if (dir == NULL)
+        return;
+
+    struct grep_ignore *ignore = grepIgnoreLoad(task->path, task->ignore);
+    int top = strcmp(task->path, ".") == 0;
+    char path[PATH_MAX];
+    struct dirent *d;
+
+    while (!grepStopped() && (d = readdir(dir)) != NULL)
+    {
+        const char *name = d->d_name;
+        if (!strcmp(name, ".") || !strcmp(name, "..") || !strcmp(name, ".git"))
+            continue;
+        if (snprintf(path, sizeof(path), "%s%s%s", top ? "" : task->path, top ? "" : "/", name) >= (int)sizeof(path))
+            continue;
+
+        int type = d->d_type;
+        if (type == DT_UNKNOWN)
+        {
+            struct stat st;
+            if (fstatat(dirfd(dir), name, &st, AT_SYMLINK_NOFOLLOW) == -1)
+                continue;
+            type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_LNK;
+        }
+
+        // links are not followed, which also keeps cycles out
+        if (type == DT_DIR && !grepIgnored(ignore, path, name, 1))
+            grepPush(w, strdup(path), ignore);
+        else if (type == DT_REG && !grepIgnored(ignore, path, name, 0))
+            grepFile(w, path);
+    }
+    closedir(dir);
+}
+
+static void *grepWorker(void *arg)
+{
+    struct grep_worker *w = arg;
+    struct grep_task task;
+
+    while (grepNext(w, &task))
+    {
+        grepDirectory(w, &task);
+        free(task.path);
+
+        pthread_mutex_lock(&grepLock);
+        if (--GR.pending == 0)
+            pthread_cond_broadcast(&grepWork);
+        pthread_mutex_unlock(&grepLock);
+    }
+    grepFlush(w);
+
+    pthread_mutex_lock(&grepLock);
+    GR.files += w->files;
+    GR.matches += w->matches;
+    GR.skipped += w->skipped;
+    GR.exited++;
+    pthread_mutex_unlock(&grepLock);
+    grepWake();
+    return NULL;
+}
+
+// what the search found, once its workers are gone
+static void grepReport(const char *how)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double ms = (now.tv_sec - GR.started.tv_sec) * 1e3 + (now.tv_nsec - GR.started.tv_nsec) / 1e6;
+
+    char skipped[48] = "";
+    if (GR.skipped)
+        snprintf(skipped, sizeof(skipped), ", %ld too large to search", GR.skipped);
+    setStatusMessage("grep %s%s: %ld match%s in %ld files%s, %.0f ms", GR.pattern, how, GR.matches,
+                     GR.matches == 1 ? "" : "es", GR.files, skipped, ms);
+}
+
+// appends results to the end of the buffer, called with its state in E
+static void grepAppend(void *arg)
+{
+    struct grep_chunk *c = arg;
+    int dirty = E.dirty;
+
+    undoSuspend(1);
+    insertRwsBlock(E.numRws, c->text, c->len);
+    undoSuspend(0);
+    E.dirty = dirty;
+}
+
+static void grepClear()
+{
+    undoSuspend(1);
+    deleteRwsRange(0, E.numRws);
+    undoSuspend(0);
+    E.cx = E.cy = 0;
+    E.rowOff = E.colOff = 0;
+    E.dirty = 0;
+}
+
+// the chunks handed over so far, oldest first
+static struct grep_chunk *grepChunks()
+{
+    pthread_mutex_lock(&grepLock);
+    struct grep_chunk *c = GR.chunks, *ordered = NULL;
+    GR.chunks = NULL;
+    pthread_mutex_unlock(&grepLock);
+
+    while (c)
+    {
+        struct grep_chunk *next = c->next;
+        c->next = ordered;
+        ordered = c;
+        c = next;
+    }
+    return ordered;
+}
+
+// Waits for the workers, which have run out of work or been told to stop,
+// and frees what the search used.
+static void grepFinish()
+{
+    for (int t = 0; t < GR.threads; t++)
+    {
+        struct grep_worker *w = &GR.workers[t];
+        if (t < GR.spawned)
+            pthread_join(w->thread, NULL);
+        for (int i = w->head; i < w->tail; i++)
+            free(w->tasks[i].path);
+        matFree(w->tasks);
+        matFree(w->file);
+        matFree(w->out);
+        pthread_mutex_destroy(&w->lock);
+    }
+
+    while (GR.ignores)
+    {
+        struct grep_ignore *next = GR.ignores->next;
+        matFree(GR.ignores->rules);
+        matFree(GR.ignores->text);
+        matFree(GR.ignores);
+        GR.ignores = next;
+    }
+
+    eventWatch(GR.wake[0], 0, NULL, NULL);
+    close(GR.wake[0]);
+    close(GR.wake[1]);
+    GR.running = 0;
+}
+
+static void grepReadable(int fd, short revents, void *arg)
+{
+    (void)revents;
+    (void)arg;
+
+    char drain[64];
+    while (read(fd, drain, sizeof(drain)) > 0)
+        ;
+
+    for (struct grep_chunk *c = grepChunks(), *next; c; c = next)
+    {
+        next = c->next;
+        bufferRun(GR.buffer, grepAppend, c);
+        matFree(c->text);
+        matFree(c);
+    }
+
+    pthread_mutex_lock(&grepLock);
+    int done = GR.exited == GR.threads;
+    pthread_mutex_unlock(&grepLock);
+
+    if (done)
+    {
+        // what the last workers flushed on their way out
+        for (struct grep_chunk *c = grepChunks(), *next; c; c = next)
+        {
+            next = c->next;
+            bufferRun(GR.buffer, grepAppend, c);
+            matFree(c->text);
+            matFree(c);
+        }
+        grepFinish();
+
+        grepReport("");
+    }
+    else
+    {
+        int rows = GR.buffer == B.current ? E.numRws : B.b[GR.buffer].state.numRws;
+        setStatusMessage("grep %s: %d matches so far...", GR.pattern, rows);
+    }
+
+    if (GR.buffer == B.current)
+        refreshScreen();
+}
+
+// Stops a search still running, for Ctrl-C and before a new one; what it
+// found so far stays in the buffer. Returns 0 when none was running.
+int grepStop()
+{
+    if (!GR.running)
+        return 0;
+
+    pthread_mutex_lock(&grepLock);
+    GR.stop = 1;
+    pthread_cond_broadcast(&grepWork);
+    pthread_mutex_unlock(&grepLock);
+
+    grepFinish();
+    for (struct grep_chunk *c = grepChunks(), *next; c; c = next)
+    {
+        next = c->next;
+        bufferRun(GR.buffer, grepAppend, c);
+        matFree(c->text);
+        matFree(c);
+    }
+    grepReport(" stopped");
+    return 1;
+}
+
+static int grepThreads()
+{
+    char *env = getenv("MAT_GREP_THREADS");
+    long threads = env ? atol(env) : sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (threads > GREP_MAX_THREADS)
+        threads = GREP_MAX_THREADS;
+    return threads < 1 ? 1 : threads;
+}
+
+static int grepResults()
+{
+    return GR.buffer >= 0 && GR.buffer < B.count && GR.buffer == B.current;
+}
+
+// Searches the working directory for pattern into the results buffer. With
+// no pattern, goes back to the results of the last search.
+void grepCommand(char *pattern)
+{
+    if (*pattern == '\0')
+    {
+        if (GR.buffer >= 0 && GR.buffer < B.count)
+            bufferSwitch(GR.buffer);
+        else
+            setStatusMessage("Usage: grep <text>");
+        return;
+    }
+
+    grepStop();
+    if (pipe(GR.wake) == -1)
+    {
+        setStatusMessage("grep: %s", strerror(errno));
+        return;
+    }
+    for (int i = 0; i < 2; i++)
+    {
+        fcntl(GR.wake[i], F_SETFD, FD_CLOEXEC);
+        fcntl(GR.wake[i], F_SETFL, O_NONBLOCK);
+    }
+
+    if (GR.buffer >= 0 && GR.buffer < B.count)
+    {
+        bufferSwitch(GR.buffer);
+        grepClear();
+    }
+    else
+        GR.buffer = bufferNew();
+
+    free(GR.pattern);
+    GR.pattern = strdup(pattern);
+    GR.plen = strlen(pattern);
+    GR.threads = grepThreads();
+    GR.queued = GR.pending = GR.stop = GR.exited = 0;
+    GR.files = GR.matches = GR.skipped = 0;
+    GR.running = 1;
+    clock_gettime(CLOCK_MONOTONIC, &GR.started);
+
+    for (int t = 0; t < GR.threads; t++)
+    {
+        struct grep_worker *w = &GR.workers[t];
+        memset(w, 0, sizeof(*w));
+        pthread_mutex_init(&w->lock, NULL);
+    }
+    grepPush(&GR.workers[0], strdup("."), NULL);
+
+    eventWatch(GR.wake[0], POLLIN, grepReadable, NULL);
+    setStatusMessage("grep %s...", pattern);
+
+    // workers no thread could be started for run here, as the loader does;
+    // the search then finishes before the editor takes keys again
+    for (GR.spawned = 0; GR.spawned < GR.threads; GR.spawned++)
+        if (pthread_create(&GR.workers[GR.spawned].thread, NULL, grepWorker, &GR.workers[GR.spawned]) != 0)
+            break;
+    for (int t = GR.spawned; t < GR.threads; t++)
+        grepWorker(&GR.workers[t]);
+}
+
+// Opens the file of the result under the cursor at its match.
+static void grepOpen()
+{
+    if (E.cy >= E.numRws)
+        return;
+
+    // path:line:text, and a path may hold colons itself
+    erow *row = &E.row[E.cy];
+    int i, line = 0;
+    for (i = 0; i < row->size; i++)
+    {
+        if (row->chars[i] != ':' || i + 1 >= row->size || !isdigit((unsigned char)row->chars[i + 1]))
+            continue;
+        int j = i + 1;
+        while (j < row->size && isdigit((unsigned char)row->chars[j]))
+            j++;
+        if (j < row->size && row->chars[j] == ':')
+        {
+            line = atoi(&row->chars[i + 1]);
+            break;
+        }
+    }
+    if (line == 0 || i >= PATH_MAX)
+        return;
+
+    char path[PATH_MAX];
+    memcpy(path, row->chars, i);
+    path[i] = '\0';
+
+    if (bufferOpen(path) == -1)
+        return;
+    if (E.pager)
+    {
+        pagerGotoLine(line);
+        return;
+    }
+
+    motionGotoLine(line);
+    if (E.cy < E.numRws && GR.pattern)
+    {
+        char *hit = memmem(E.row[E.cy].chars, E.row[E.cy].size, GR.pattern, GR.plen);
+        if (hit)
+            E.cx = hit - E.row[E.cy].chars;
+    }
+}
+
+// Keys of the results buffer: Enter opens a result, and what would edit the
+// list is refused. Returns 0 for keys left to the caller.
+int grepKey(int c)
+{
+    if (!grepResults())
+        return 0;
+
+    switch (c)
+    {
+    case '\r':
+        if (E.current_mode == NORMAL)
+            grepOpen();
+        return E.current_mode == NORMAL;
+
+    case KEY_X:
+    case KEY_D:
+    case KEY_I:
+    case KEY_A:
+    case KEY_P:
+    case KEY_SHIFT_P:
+    case KEY_U:
+    case CTRL_KEY('r'):
+    case KEY_GT:
+    case KEY_LT:
+    case '!':
+        setStatusMessage("Read-only: grep results, Enter opens one");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#define GREP_MAX_THREADS 64
+// bytes of a matching line kept in its result row
+#define GREP_LINE_MAX 512
+// results a worker collects before handing them to the editor
+#define GREP_CHUNK (64 << 10)
+// bytes of a file read and searched at a time
+#define GREP_WINDOW (1 << 20)
+// files larger than this are skipped
+#define GREP_FILE_MAX (1LL << 30)
+
+void grepCommand(char *pattern);
+int grepStop();
+int grepKey(int c);
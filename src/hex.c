@@ -0,0 +1,537 @@
+#include "hex.h"
+#include "alloc.h"
+#include "input.h"
+#include "mat.h"
+#include "syntax.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+extern struct config E;
+
+// A mapped file shown HEX_COLS bytes a row, each row rendered from its offset
+// while it is drawn. The mapping is private and read-only; a page is made
+// writable when a byte in it is first overwritten, so only those pages count
+// against memory. Overwrites stay in memory until :w, which writes back only
+// the pages that differ from the file. The buffer is modified while the
+// edits differ from those in place at the last :w.
+struct hex_edit
+{
+    size_t off;
+    unsigned char old;
+};
+
+struct hexview
+{
+    unsigned char *map;
+    size_t size;
+    int width; // hex digits of the offset column
+
+    size_t cursor;
+    long long top; // first row on screen; E.rowOff, an int, stays 0
+    int nibble; // the high half of the byte under the cursor was just typed
+
+    unsigned char *dirty; // a bit per HEX_PAGE written since the last save
+    struct hex_edit *edits;
+    size_t nedits, cap;
+    size_t saved; // nedits at the last save, or SIZE_MAX once edits undone past it were replaced
+
+    unsigned char *query;
+    size_t qlen;
+
+    char render[HEX_ROW];
+    unsigned char hl[HEX_ROW];
+};
+
+struct hexview *hexNew(char *map, size_t size)
+{
+    struct hexview *h = matMalloc(ALLOC_INDEX, sizeof(struct hexview));
+    memset(h, 0, sizeof(*h));
+    h->map = (unsigned char *)map;
+    h->size = size;
+    h->width = 8;
+    while (size > 0 && h->width < 16 && (size - 1) >> (h->width * 4))
+        h->width++;
+    return h;
+}
+
+// a NUL in the first block marks a file as binary
+int hexProbe(const char *filename)
+{
+    char buf[HEX_PROBE];
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return 0;
+    ssize_t n = read(fd, buf, sizeof(buf));
+    close(fd);
+    return n > 0 && memchr(buf, '\0', n) != NULL;
+}
+
+// Rows are counted in long long: at HEX_COLS bytes a row, a file past
+// 32 GiB has more of them than an int holds.
+long long hexRows(struct hexview *h)
+{
+    return (h->size + HEX_COLS - 1) / HEX_COLS;
+}
+
+// the row the cursor is on
+long long hexRow(struct hexview *h)
+{
+    return h->cursor / HEX_COLS;
+}
+
+// rows from the top of the view on, which is as far as drawRws looks
+int hexScreenRows(struct hexview *h)
+{
+    long long rows = hexRows(h) - h->top;
+    return rows < INT_MAX ? rows : INT_MAX;
+}
+
+size_t hexMemory(struct hexview *h)
+{
+    return matSize(h) + matSize(h->dirty) + matSize(h->edits) + matSize(h->query);
+}
+
+// screen column of byte i of a row, in the hex or the character part
+static int hexColumn(struct hexview *h, int i, int text)
+{
+    if (text)
+        return h->width + 2 + HEX_COLS * 3 + 3 + i;
+    return h->width + 2 + i * 3 + (i >= HEX_COLS / 2);
+}
+
+static int hexClass(unsigned char c)
+{
+    if (c == 0)
+        return HL_COMMENT;
+    if (c >= 0x80)
+        return HL_KEYWORD2;
+    if (!isprint(c))
+        return HL_NUMBER;
+    return HL_NORMAL;
+}
+
+// filerow counts from the top of the view
+void hexDrawRow(struct hexview *h, struct abuf *ab, int filerow)
+{
+    static const char digits[] = "0123456789abcdef";
+    size_t start = (size_t)(h->top + filerow) * HEX_COLS;
+    int n = h->size - start < HEX_COLS ? h->size - start : HEX_COLS;
+
+    int len = snprintf(h->render, sizeof(h->render), "%0*zx", h->width, start);
+    memset(h->hl, HL_COMMENT, len);
+    int end = hexColumn(h, HEX_COLS, 1) + 1;
+    memset(h->render + len, ' ', end - len);
+    memset(h->hl + len, HL_NORMAL, end - len);
+    h->render[hexColumn(h, 0, 1) - 1] = '|';
+    h->render[hexColumn(h, n, 1)] = '|';
+
+    for (int i = 0; i < n; i++)
+    {
+        unsigned char c = h->map[start + i];
+        int x = hexColumn(h, i, 0), t = hexColumn(h, i, 1);
+        int cls = start + i == h->cursor ? HL_VISUAL : hexClass(c);
+
+        h->render[x] = digits[c >> 4];
+        h->render[x + 1] = digits[c & 0xf];
+        h->render[t] = isprint(c) ? c : '.';
+        h->hl[x] = h->hl[x + 1] = h->hl[t] = cls;
+    }
+
+    drawSpan(ab, filerow, h->render, h->hl, hexColumn(h, n, 1) + 1, E.colOff);
+}
+
+// puts the terminal cursor on the byte under the cursor and keeps it in view
+void hexCursor(struct hexview *h)
+{
+    long long row = hexRow(h);
+    if (row < h->top)
+        h->top = row;
+    if (row >= h->top + E.screenRws)
+        h->top = row - E.screenRws + 1;
+
+    E.rowOff = 0;
+    E.cy = row - h->top;
+    E.rx = hexColumn(h, h->cursor % HEX_COLS, 0) + h->nibble;
+    if (E.rx < E.colOff)
+        E.colOff = E.rx;
+    if (E.rx >= E.colOff + E.screenCls)
+        E.colOff = E.rx - E.screenCls + 1;
+}
+
+static void hexMove(struct hexview *h, long long by)
+{
+    long long to = (long long)h->cursor + by;
+    if (to >= (long long)h->size)
+        to = h->size ? h->size - 1 : 0;
+    if (to < 0)
+        to = 0;
+    h->cursor = to;
+    h->nibble = 0;
+}
+
+// what E.dirty counts: edits since the last save, or undone from before it
+static void hexDirty(struct hexview *h)
+{
+    if (h->saved == SIZE_MAX)
+        E.dirty = h->nedits + 1;
+    else
+        E.dirty = h->nedits > h->saved ? h->nedits - h->saved : h->saved - h->nedits;
+}
+
+static void hexMark(struct hexview *h, size_t off, int dirty)
+{
+    unsigned char bit = 1 << (off / HEX_PAGE % 8);
+    if (dirty)
+        h->dirty[off / HEX_PAGE / 8] |= bit;
+    else
+        h->dirty[off / HEX_PAGE / 8] &= ~bit;
+}
+
+static int hexPoke(struct hexview *h, size_t off, unsigned char c)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    unsigned char *at = h->map + off - off % page;
+    if (mprotect(at, page, PROT_READ | PROT_WRITE) == -1)
+    {
+        setStatusMessage("Cannot overwrite: %s", strerror(errno));
+        return -1;
+    }
+
+    if (h->dirty == NULL)
+    {
+        size_t bytes = (h->size / HEX_PAGE + 8) / 8;
+        h->dirty = matMalloc(ALLOC_INDEX, bytes);
+        memset(h->dirty, 0, bytes);
+    }
+    h->map[off] = c;
+    hexMark(h, off, 1);
+    return 0;
+}
+
+// overwrites one byte, remembering the old value for u
+static int hexWrite(struct hexview *h, size_t off, unsigned char c)
+{
+    if (h->nedits == h->cap)
+    {
+        h->cap = h->cap ? h->cap * 2 : 64;
+        h->edits = matRealloc(ALLOC_INDEX, h->edits, sizeof(struct hex_edit) * h->cap);
+    }
+    unsigned char old = h->map[off];
+    if (hexPoke(h, off, c) == -1)
+        return -1;
+    if (h->nedits < h->saved)
+        h->saved = SIZE_MAX;
+    h->edits[h->nedits].off = off;
+    h->edits[h->nedits++].old = old;
+    hexDirty(h);
+    return 0;
+}
+
+// Puts back the byte the last edit overwrote. Undoing an edit made since
+// the last save leaves its page as the file has it, unless a later one
+// touched the page too; undoing one from before makes the page differ.
+static struct hex_edit *hexRestore(struct hexview *h)
+{
+    struct hex_edit *e = &h->edits[--h->nedits];
+    h->map[e->off] = e->old;
+
+    int differs = h->nedits < h->saved;
+    for (size_t i = h->saved; !differs && i < h->nedits; i++)
+        differs = h->edits[i].off / HEX_PAGE == e->off / HEX_PAGE;
+    hexMark(h, e->off, differs);
+    hexDirty(h);
+    return e;
+}
+
+static void hexUndo(struct hexview *h)
+{
+    if (h->nedits == 0)
+    {
+        setStatusMessage("Already at oldest change");
+        return;
+    }
+    h->cursor = hexRestore(h)->off;
+    h->nibble = 0;
+}
+
+static int hexDigit(int c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+// Types hex digits over the bytes from the cursor on, until Esc. With once
+// set it stops after one byte, for r.
+static void hexReplace(struct hexview *h, int once)
+{
+    if (h->size == 0)
+        return;
+
+    setStatusMessage(once ? "r: two hex digits" : "-- REPLACE --");
+    while (1)
+    {
+        refreshScreen();
+        int c = readKey();
+        int d = hexDigit(c);
+        unsigned char byte = h->map[h->cursor];
+
+        if (c == KEY_ESC)
+            break;
+        if (c == BACKSPACE || c == KEY_H)
+        {
+            // a byte with only its high half typed goes back to what it was
+            if (h->nibble)
+                hexRestore(h);
+            hexMove(h, h->nibble ? 0 : -1);
+            continue;
+        }
+        if (d < 0)
+            continue;
+
+        if (!h->nibble)
+        {
+            if (hexWrite(h, h->cursor, d << 4 | (byte & 0x0f)) == -1)
+                return;
+            h->nibble = 1;
+            continue;
+        }
+
+        hexPoke(h, h->cursor, (byte & 0xf0) | d);
+        if (once || h->cursor + 1 == h->size)
+        {
+            h->nibble = 0;
+            break;
+        }
+        hexMove(h, 1);
+    }
+    h->nibble = 0;
+    setStatusMessage("");
+}
+
+// First occurrence of needle in s. Sixteen candidate positions are tested
+// at a time against the needle's first and last byte, and only those where
+// both match are compared in full.
+static const unsigned char *hexSearch(const unsigned char *s, size_t n, const unsigned char *needle, size_t m)
+{
+    if (m == 0 || m > n)
+        return NULL;
+
+    size_t i = 0;
+#ifdef __SSE2__
+    __m128i first = _mm_set1_epi8(needle[0]);
+    __m128i last = _mm_set1_epi8(needle[m - 1]);
+
+    for (; i + m - 1 + 16 <= n; i += 16)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *)(s + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(s + i + m - 1));
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+
+        while (mask)
+        {
+            int bit = __builtin_ctz(mask);
+            if (memcmp(s + i + bit, needle, m) == 0)
+                return s + i + bit;
+            mask &= mask - 1;
+        }
+    }
+#endif
+    return memmem(s + i, n - i, needle, m);
+}
+
+static void hexFind(struct hexview *h)
+{
+    if (h->query == NULL)
+        return;
+
+    size_t from = h->cursor + 1 < h->size ? h->cursor + 1 : h->size;
+    const unsigned char *hit = hexSearch(h->map + from, h->size - from, h->query, h->qlen);
+    if (hit == NULL)
+        hit = hexSearch(h->map, from + h->qlen - 1 < h->size ? from + h->qlen - 1 : h->size, h->query, h->qlen);
+
+    if (hit == NULL)
+    {
+        setStatusMessage("Pattern not found");
+        return;
+    }
+    h->cursor = hit - h->map;
+    h->nibble = 0;
+    setStatusMessage("found at 0x%zx", h->cursor);
+}
+
+// "de ad be ef" and "0xdeadbeef" are bytes; anything else, or text after a
+// double quote, is searched for as it is
+static void hexSearchPrompt(struct hexview *h)
+{
+    char *query = prompt("/%s", NULL);
+    if (query == NULL)
+        return;
+
+    size_t len = strlen(query), n = 0;
+    unsigned char *bytes = matMalloc(ALLOC_SEARCH, len + 1);
+    const char *s = query[0] == '0' && query[1] == 'x' ? query + 2 : query;
+    int high = -1, ok = query[0] != '"' && len > 0;
+
+    for (; ok && *s; s++)
+    {
+        int d = hexDigit(*s);
+        if (*s == ' ')
+            ok = high < 0;
+        else if (d < 0)
+            ok = 0;
+        else if (high < 0)
+            high = d;
+        else
+        {
+            bytes[n++] = high << 4 | d;
+            high = -1;
+        }
+    }
+
+    if (!ok || high >= 0 || n == 0)
+    {
+        s = query[0] == '"' ? query + 1 : query;
+        n = strlen(s);
+        memcpy(bytes, s, n);
+    }
+    matFree(query);
+
+    matFree(h->query);
+    h->query = bytes;
+    h->qlen = n;
+    hexFind(h);
+}
+
+void hexGotoRow(struct hexview *h, long long row)
+{
+    hexMove(h, row * HEX_COLS - (long long)h->cursor);
+}
+
+// Returns 0 for keys the normal handler should see, like pagerKey.
+int hexKey(struct hexview *h, int c, int count, int counted, int gg)
+{
+    switch (c)
+    {
+    case KEY_H:
+        hexMove(h, -count);
+        break;
+    case KEY_L:
+    case ' ':
+        hexMove(h, count);
+        break;
+    case KEY_J:
+    case '\r':
+        hexMove(h, (long long)count * HEX_COLS);
+        break;
+    case KEY_K:
+        hexMove(h, -(long long)count * HEX_COLS);
+        break;
+    case KEY_W:
+        hexMove(h, (long long)count * 4 - h->cursor % 4);
+        break;
+    case KEY_B:
+        hexMove(h, -(long long)count * 4 + (h->cursor % 4 ? 4 - h->cursor % 4 : 0));
+        break;
+    case '0':
+        hexMove(h, -(long long)(h->cursor % HEX_COLS));
+        break;
+    case '$':
+        hexMove(h, HEX_COLS - 1 - h->cursor % HEX_COLS);
+        break;
+    case CTRL_KEY('d'):
+        hexMove(h, (long long)count * (E.screenRws / 2) * HEX_COLS);
+        break;
+    case CTRL_KEY('u'):
+        hexMove(h, -(long long)count * (E.screenRws / 2) * HEX_COLS);
+        break;
+    case CTRL_KEY('f'):
+        hexMove(h, (long long)count * E.screenRws * HEX_COLS);
+        break;
+    case CTRL_KEY('b'):
+        hexMove(h, -(long long)count * E.screenRws * HEX_COLS);
+        break;
+    case KEY_SHIFT_G:
+        hexGotoRow(h, counted ? count - 1 : hexRows(h) - 1);
+        break;
+    case KEY_G:
+        if (!gg)
+            return 0;
+        hexGotoRow(h, count - 1);
+        break;
+    case KEY_SLASH:
+        hexSearchPrompt(h);
+        break;
+    case 'n':
+        hexFind(h);
+        break;
+    case 'r':
+        hexReplace(h, 1);
+        break;
+    case 'R':
+        hexReplace(h, 0);
+        break;
+    case KEY_U:
+        hexUndo(h);
+        break;
+
+    case KEY_COLON:
+    case KEY_Q:
+    case CTRL_KEY('s'):
+    case CTRL_KEY('n'):
+    case CTRL_KEY('p'):
+    case CTRL_KEY('a'):
+        return 0;
+
+    default:
+        setStatusMessage("Hex view: r/R overwrite, u undo, / search, :w write");
+        break;
+    }
+    return 1;
+}
+
+// Writes back the pages holding overwritten bytes; the file keeps its size.
+int hexSave(struct hexview *h, const char *filename)
+{
+    if (h->dirty == NULL)
+        return 0;
+
+    int fd = open(filename, O_WRONLY | O_CLOEXEC);
+    if (fd == -1)
+        return -1;
+
+    size_t pages = (h->size + HEX_PAGE - 1) / HEX_PAGE;
+    for (size_t p = 0; p < pages; p++)
+    {
+        if (!(h->dirty[p / 8] & 1 << (p % 8)))
+            continue;
+        size_t off = p * HEX_PAGE;
+        size_t len = h->size - off < HEX_PAGE ? h->size - off : HEX_PAGE;
+        if (pwrite(fd, h->map + off, len, off) != (ssize_t)len)
+        {
+            close(fd);
+            return -1;
+        }
+        h->dirty[p / 8] &= ~(1 << (p % 8));
+    }
+    close(fd);
+    h->saved = h->nedits;
+    return 0;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "mat.h"
+
+#include <stddef.h>
+
+#define HEX_COLS 16
+// longest row: a 16 digit offset, the hex part and the characters
+#define HEX_ROW 96
+// overwritten bytes are written back in pages of this size
+#define HEX_PAGE 4096
+// bytes read to tell a binary file from text
+#define HEX_PROBE 8192
+
+struct hexview;
+
+struct hexview *hexNew(char *map, size_t size);
+int hexProbe(const char *filename);
+long long hexRows(struct hexview *h);
+long long hexRow(struct hexview *h);
+int hexScreenRows(struct hexview *h);
+size_t hexMemory(struct hexview *h);
+void hexDrawRow(struct hexview *h, struct abuf *ab, int filerow);
+void hexCursor(struct hexview *h);
+void hexGotoRow(struct hexview *h, long long row);
+int hexKey(struct hexview *h, int c, int count, int counted, int gg);
+int hexSave(struct hexview *h, const char *filename);
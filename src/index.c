@@ -0,0 +1,207 @@
+#include "index.h"
+#include "mat.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// The sidecar holds the newline offsets of a file and its multi-line comment
+// state every INDEX_INTERVAL lines. It is only trusted while the file's
+// path, size, mtime, ctime and inode all still match the header. The times
+// are kept to the nanosecond, since a rewrite of the same size within one
+// second would otherwise pass.
+#define INDEX_MAGIC "MATIDX2"
+
+struct index_header
+{
+    char magic[8];
+    uint64_t size;
+    int64_t mtime, mtimeNsec;
+    int64_t ctime, ctimeNsec;
+    uint64_t ino;
+    uint64_t dev;
+    uint64_t lines;
+    uint32_t interval;
+    uint32_t pathlen;
+    char filetype[16];
+};
+
+int indexEnabled()
+{
+    const char *dir = getenv("MAT_INDEX_CACHE");
+    return dir == NULL || strcmp(dir, "off") != 0;
+}
+
+static int indexPath(const char *path, char *out, size_t len)
+{
+    const char *dir = getenv("MAT_INDEX_CACHE");
+    char base[PATH_MAX];
+
+    if (!indexEnabled())
+        return -1;
+
+    if (dir == NULL)
+    {
+        const char *cache = getenv("XDG_CACHE_HOME");
+        if (cache)
+            snprintf(base, sizeof(base), "%s/mat", cache);
+        else if (getenv("HOME"))
+        {
+            snprintf(base, sizeof(base), "%s/.cache", getenv("HOME"));
+            mkdir(base, 0700);
+            snprintf(base, sizeof(base), "%s/.cache/mat", getenv("HOME"));
+        }
+        else
+            return -1;
+        dir = base;
+    }
+    mkdir(dir, 0700);
+
+    // FNV-1a of the absolute path names the sidecar
+    uint64_t hash = 14695981039346656037ULL;
+    for (const char *p = path; *p; p++)
+    {
+        hash ^= (unsigned char)*p;
+        hash *= 1099511628211ULL;
+    }
+
+    snprintf(out, len, "%s/%016llx.idx", dir, (unsigned long long)hash);
+    return 0;
+}
+
+static void indexHeader(struct index_header *hdr, struct stat *st, const char *filetype)
+{
+    memset(hdr, 0, sizeof(*hdr));
+    memcpy(hdr->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    hdr->size = st->st_size;
+    hdr->mtime = st->st_mtim.tv_sec;
+    hdr->mtimeNsec = st->st_mtim.tv_nsec;
+    hdr->ctime = st->st_ctim.tv_sec;
+    hdr->ctimeNsec = st->st_ctim.tv_nsec;
+    hdr->ino = st->st_ino;
+    hdr->dev = st->st_dev;
+    hdr->interval = INDEX_INTERVAL;
+    snprintf(hdr->filetype, sizeof(hdr->filetype), "%s", filetype);
+}
+
+int indexLoad(const char *path, struct stat *st, const char *filetype, struct line_index *idx)
+{
+    char abspath[PATH_MAX], sidecar[PATH_MAX];
+    if (realpath(path, abspath) == NULL || indexPath(abspath, sidecar, sizeof(sidecar)) == -1)
+        return -1;
+
+    FILE *fp = fopen(sidecar, "rb");
+    if (fp == NULL)
+        return -1;
+
+    struct index_header hdr, want;
+    char stored[PATH_MAX];
+    indexHeader(&want, st, filetype);
+
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+        memcmp(hdr.magic, want.magic, sizeof(hdr.magic)) ||
+        hdr.size != want.size || hdr.mtime != want.mtime || hdr.mtimeNsec != want.mtimeNsec ||
+        hdr.ctime != want.ctime || hdr.ctimeNsec != want.ctimeNsec ||
+        hdr.ino != want.ino || hdr.dev != want.dev ||
+        hdr.interval != INDEX_INTERVAL || hdr.pathlen >= sizeof(stored) ||
+        hdr.lines > hdr.size + 1 || fread(stored, hdr.pathlen, 1, fp) != 1)
+    {
+        fclose(fp);
+        return -1;
+    }
+
+    stored[hdr.pathlen] = '\0';
+    if (strcmp(stored, abspath))
+    {
+        fclose(fp);
+        return -1;
+    }
+
+    size_t nstates = hdr.lines ? (hdr.lines - 1) / INDEX_INTERVAL + 1 : 0;
+    idx->lines = hdr.lines;
+    idx->cap = hdr.lines + 1;
+    idx->offsets = matMalloc(ALLOC_INDEX, sizeof(uint64_t) * (hdr.lines + 1));
+    idx->states = matMalloc(ALLOC_INDEX, nstates + 1);
+
+    if (fread(idx->offsets, sizeof(uint64_t), hdr.lines + 1, fp) != hdr.lines + 1 ||
+        fread(idx->states, 1, nstates, fp) != nstates)
+    {
+        indexFree(idx);
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+
+    // rows are sliced out of the mapped file with these, so a damaged
+    // sidecar whose header still matches must not get through
+    int sane = idx->offsets[0] == 0 && idx->offsets[hdr.lines] == hdr.size;
+    for (size_t i = 0; sane && i < hdr.lines; i++)
+        sane = idx->offsets[i] <= idx->offsets[i + 1];
+    if (!sane)
+    {
+        indexFree(idx);
+        return -1;
+    }
+
+    // comment states depend on the syntax the file was highlighted with
+    if (strcmp(hdr.filetype, want.filetype))
+    {
+        matFree(idx->states);
+        idx->states = NULL;
+    }
+
+    return 0;
+}
+
+void indexStore(const char *path, struct stat *st, const char *filetype, struct line_index *idx)
+{
+    char abspath[PATH_MAX], sidecar[PATH_MAX], tmp[PATH_MAX + 8];
+    if (realpath(path, abspath) == NULL || indexPath(abspath, sidecar, sizeof(sidecar)) == -1)
+        return;
+
+    struct index_header hdr;
+    indexHeader(&hdr, st, filetype);
+    hdr.lines = idx->lines;
+    hdr.pathlen = strlen(abspath);
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", sidecar);
+    FILE *fp = fopen(tmp, "wb");
+    if (fp == NULL)
+        return;
+
+    size_t nstates = idx->lines ? (idx->lines - 1) / INDEX_INTERVAL + 1 : 0;
+    int ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1 &&
+             fwrite(abspath, hdr.pathlen, 1, fp) == 1 &&
+             fwrite(idx->offsets, sizeof(uint64_t), idx->lines + 1, fp) == idx->lines + 1 &&
+             fwrite(idx->states, 1, nstates, fp) == nstates;
+
+    if (fclose(fp) != 0 || !ok)
+    {
+        unlink(tmp);
+        return;
+    }
+    rename(tmp, sidecar);
+}
+
+// records the start offset of the next line while a file is being scanned
+void indexAppend(struct line_index *idx, uint64_t offset)
+{
+    if (idx->lines == idx->cap)
+    {
+        idx->cap = idx->cap ? idx->cap * 2 : 1024;
+        idx->offsets = matRealloc(ALLOC_INDEX, idx->offsets, sizeof(uint64_t) * idx->cap);
+    }
+    idx->offsets[idx->lines++] = offset;
+}
+
+void indexFree(struct line_index *idx)
+{
+    matFree(idx->offsets);
+    matFree(idx->states);
+    idx->offsets = NULL;
+    idx->states = NULL;
+    idx->lines = 0;
+    idx->cap = 0;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+// rows between two saved multi-line comment states
+#define INDEX_INTERVAL 1024
+
+// files smaller than this are cheap enough to scan and never get a sidecar
+#define INDEX_MIN_SIZE (1 << 20)
+
+struct line_index
+{
+    size_t lines;
+    size_t cap;
+    uint64_t *offsets;     // start of every line, plus the end of the file
+    unsigned char *states; // comment state at the start of every INDEX_INTERVAL'th line
+};
+
+int indexEnabled();
+void indexAppend(struct line_index *idx, uint64_t offset);
+int indexLoad(const char *path, struct stat *st, const char *filetype, struct line_index *idx);
+void indexStore(const char *path, struct stat *st, const char *filetype, struct line_index *idx);
+void indexFree(struct line_index *idx);
@@ -1,4 +1,18 @@
 #include "mat.h"
+#include "brackets.h"
+#include "buffer.h"
+#include "command.h"
+#include "complete.h"
+#include "event.h"
+#include "filter.h"
+#include "grep.h"
+#include "motion.h"
+#include "output.h"
+#include "pager.h"
+#include "register.h"
+#include "server.h"
+#include "undo.h"
+#include "visual.h"
 
 #include <errno.h>
 #include <stdlib.h>
@@ -6,25 +20,83 @@
 
 extern struct config E;
 
+// count prefix typed before a NORMAL mode command, 0 when none
+static int pendingCount;
+// set after a lone 'g' while waiting for the second one
+static int pendingG;
+// bytes read from the terminal by someone else and handed back, see inputUnread
+static unsigned char unread[256];
+static int unreadLen, unreadAt;
+
+void inputUnread(const char *s, int len)
+{
+    if (unreadAt == unreadLen)
+        unreadAt = unreadLen = 0;
+    // typeahead past the buffer is dropped, as a full tty queue would
+    for (int i = 0; i < len && unreadLen < (int)sizeof(unread); i++)
+        unread[unreadLen++] = s[i];
+}
+
+// bytes taken off the terminal so far, see inputTaken
+static unsigned long long inputCount;
+
+int inputByte(void *c)
+{
+    int n = read(STDIN_FILENO, c, 1);
+    if (n == 1)
+        inputCount++;
+    return n;
+}
+
+// Bytes of input used up so far, not counting those handed back. A server
+// relay uses it to tell which client typed a key.
+unsigned long long inputTaken()
+{
+    return inputCount - (unreadLen - unreadAt);
+}
+
+static int inputRead(void *c)
+{
+    if (unreadAt < unreadLen)
+    {
+        *(unsigned char *)c = unread[unreadAt++];
+        return 1;
+    }
+    return inputByte(c);
+}
+
 int readKey()
 {
     int nread;
-    char c;
-    while ((nread = read(STDIN_FILENO, &c, 1)) != 1)
+    unsigned char c; // bytes of UTF-8 sequences stay positive
+    while (1)
     {
-        if (nread == -1 && errno != EAGAIN)
+        if (unreadAt < unreadLen)
+        {
+            c = unread[unreadAt++];
+            break;
+        }
+        // output drains and other watched descriptors are serviced while
+        // waiting; the timeout keeps idleTick running on a quiet terminal
+        int ready = eventWait(100);
+        idleTick();
+        if (!ready)
+            continue;
+        if ((nread = inputByte(&c)) == 1)
+            break;
+        if (nread == -1 && errno != EAGAIN && errno != EINTR)
             die("read");
     }
     if (c == '\x1b')
     {
         char seq[2];
-        if (read(STDIN_FILENO, &seq[0], 1) == 0)
+        if (inputRead(&seq[0]) == 0)
         {
             return KEY_ESC;
         }
         else
         {
-            read(STDIN_FILENO, &seq[1], 1);
+            inputRead(&seq[1]);
             return -1;
         }
     }
@@ -35,6 +107,8 @@ int readKey()
 
         case '/':
             return KEY_SLASH;
+        case ':':
+            return KEY_COLON;
         case 'k':
             return KEY_K;
         case 'j':
@@ -64,17 +138,47 @@ void handleKeyPress()
 {
     int c = readKey();
 
+    allocBeginOp(c);
+
     if (c == ESC_K)
         return;
 
+    if (E.current_mode == INSERT && completeKey(c))
+        return;
+
     if (c == KEY_ESC && E.current_mode == INSERT)
     {
         E.current_mode = NORMAL;
         return;
     }
 
-    if (E.current_mode == NORMAL)
+    if (E.current_mode != INSERT)
     {
+        // every command outside INSERT mode is its own undo step
+        undoBoundary();
+
+        if (c >= '0' && c <= '9' && (c != '0' || pendingCount))
+        {
+            if (pendingCount < 100000000)
+                pendingCount = pendingCount * 10 + (c - '0');
+            return;
+        }
+
+        int count = pendingCount ? pendingCount : 1;
+        int counted = pendingCount != 0;
+        int gg = pendingG && c == KEY_G;
+        pendingCount = 0;
+        pendingG = 0;
+
+        if (grepKey(c))
+            return;
+
+        if (E.current_mode != NORMAL && visualKey(c, count))
+            return;
+
+        if (E.pager && pagerKey(c, count, counted, gg))
+            return;
+
         switch (c)
         {
 
@@ -82,29 +186,76 @@ void handleKeyPress()
             save();
             break;
 
-        case CTRL_KEY('u'):
-            for (int y = 0; y < 4; y++)
-            {
-                if (E.cy - 1 <= E.numRws)
-                {
-                    moveCursor(KEY_K);
-                }
-            }
+        // stops what runs in the background
+        case CTRL_KEY('c'):
+        {
+            int stopped = filterStop();
+            stopped |= grepStop();
+            if (!stopped)
+                setStatusMessage("Nothing to stop");
+            break;
+        }
 
+#ifdef MAT_ALLOC_STATS
+        case CTRL_KEY('a'):
+        {
+            char stats[80];
+            allocStatusLine(stats, sizeof(stats));
+            setStatusMessage("%s", stats);
             break;
+        }
+#endif
+
+        case CTRL_KEY('n'):
+            bufferNext(1);
+            break;
+
+        case CTRL_KEY('p'):
+            bufferNext(-1);
+            break;
+
+        case CTRL_KEY('u'):
+            motionScroll(-count * (E.screenRws / 2));
+            break;
+
         case CTRL_KEY('d'):
-            for (int y = 0; y < 4; y++)
+            motionScroll(count * (E.screenRws / 2));
+            break;
+
+        case CTRL_KEY('b'):
+            motionScroll(-count * E.screenRws);
+            break;
+
+        case CTRL_KEY('f'):
+            motionScroll(count * E.screenRws);
+            break;
+
+        case KEY_G:
+            if (gg)
+                motionGotoLine(count);
+            else
             {
-                if (E.cy + 1 <= E.numRws)
-                {
-                    moveCursor(KEY_J);
-                }
+                pendingCount = counted ? count : 0;
+                pendingG = 1;
             }
             break;
 
+        case KEY_SHIFT_G:
+            motionGotoLine(counted ? count : 0);
+            break;
+
+        case KEY_W:
+        case KEY_B:
+        case KEY_E:
+            motionWord(c, count);
+            break;
+
         case KEY_Q:
+            if (E.current_mode != INSERT && serverDetach())
+                break;
             if (E.current_mode != INSERT)
             {
+                outputFlush();
                 write(STDOUT_FILENO, "\x1b[2J", 4);
                 write(STDOUT_FILENO, "\x1b[H", 3);
                 exit(0);
@@ -124,15 +275,57 @@ void handleKeyPress()
             E.current_mode = INSERT;
             break;
 
+        case KEY_V:
+            visualStart(0);
+            break;
+
+        case KEY_SHIFT_V:
+            visualStart(1);
+            break;
+
+        case KEY_U:
+            undo();
+            break;
+
+        case CTRL_KEY('r'):
+            redo();
+            break;
+
+        case KEY_P:
+        case KEY_SHIFT_P:
+            registerPut(c == KEY_P, count);
+            break;
+
         case KEY_SLASH:
             search();
             break;
 
+        case KEY_COLON:
+            command();
+            break;
+
+        case KEY_PERCENT:
+            bracketJump();
+            break;
+
+        case KEY_LBRACKET:
+            bracketEnclosing(-1);
+            break;
+
+        case KEY_RBRACKET:
+            bracketEnclosing(1);
+            break;
+
         case KEY_K:
         case KEY_J:
         case KEY_H:
         case KEY_L:
-            moveCursor(c);
+            if (!counted)
+                moveCursor(c);
+            else if (c == KEY_J || c == KEY_K)
+                motionVertical(c == KEY_J ? count : -count);
+            else
+                motionHorizontal(c == KEY_L ? count : -count);
             break;
         }
     }
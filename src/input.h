@@ -6,6 +6,11 @@
 #define ESC_K -1
 
 int readKey();
+// reads one byte off the terminal, counting it for inputTaken
+int inputByte(void *c);
+// hands bytes read off the terminal back to readKey, oldest first
+void inputUnread(const char *s, int len);
+unsigned long long inputTaken();
 void handleKeyPress();
 
 enum key
@@ -13,16 +18,34 @@ enum key
     BACKSPACE = 127,
 
     KEY_SLASH = '/',
+    KEY_COLON = ':',
+    KEY_PERCENT = '%',
+    KEY_LBRACKET = '[',
+    KEY_RBRACKET = ']',
     KEY_K = 'k',
     KEY_J = 'j',
     KEY_L = 'l',
     KEY_H = 'h',
 
+    KEY_G = 'g',
+    KEY_SHIFT_G = 'G',
+    KEY_W = 'w',
+    KEY_B = 'b',
+    KEY_E = 'e',
+
     KEY_I = 'i',
     KEY_A = 'a',
     KEY_V = 'v',
+    KEY_SHIFT_V = 'V',
 
     KEY_X = 'x',
+    KEY_D = 'd',
+    KEY_Y = 'y',
+    KEY_P = 'p',
+    KEY_SHIFT_P = 'P',
+    KEY_U = 'u',
+    KEY_GT = '>',
+    KEY_LT = '<',
 
     KEY_Q = 'q',
 };
@@ -0,0 +1,316 @@
+#include "journal.h"
+#include "mat.h"
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+extern struct config E;
+
+// The swap journal sits next to the file as .name.mat-swp. It starts with a
+// header naming the version of the file on disk the edits apply to, followed
+// by one record per row mutation, so its cost is proportional to the size of
+// each edit rather than to the size of the file.
+#define JOURNAL_MAGIC "MATSWP1"
+
+struct journal_header
+{
+    char magic[8];
+    uint64_t size;
+    int64_t mtime;
+    uint64_t ino;
+};
+
+struct journal_record
+{
+    uint8_t op;
+    uint32_t row;
+    uint32_t at;
+    uint32_t len;
+};
+
+static char *journalPath(const char *filename)
+{
+    const char *slash = strrchr(filename, '/');
+    int dirlen = slash ? slash - filename + 1 : 0;
+    char *path = matMalloc(ALLOC_JOURNAL, strlen(filename) + 16);
+
+    sprintf(path, "%.*s.%s.mat-swp", dirlen, filename, filename + dirlen);
+    return path;
+}
+
+static int journalHeader(const char *filename, struct journal_header *hdr)
+{
+    struct stat st;
+    memset(hdr, 0, sizeof(*hdr));
+    if (stat(filename, &st) == -1)
+        return -1;
+
+    memcpy(hdr->magic, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+    hdr->size = st.st_size;
+    hdr->mtime = st.st_mtime;
+    hdr->ino = st.st_ino;
+    return 0;
+}
+
+// writes the fixed part of a record; `len` bytes of data must follow
+static void journalWriteHeader(FILE *fp, enum journal_op op, int row, int at, size_t len)
+{
+    unsigned char rec[13];
+    uint32_t fields[3] = {row, at, len};
+
+    rec[0] = op;
+    memcpy(&rec[1], fields, sizeof(fields));
+    fwrite(rec, sizeof(rec), 1, fp);
+}
+
+static void journalWriteRecord(FILE *fp, enum journal_op op, int row, int at, const char *s, int len)
+{
+    journalWriteHeader(fp, op, row, at, len);
+    if (len)
+        fwrite(s, len, 1, fp);
+}
+
+// Applies the records of a journal over the freshly loaded file. Replay goes
+// through the normal row functions with journaling off; a truncated or
+// inconsistent tail, as left by a crash mid-write, ends the replay.
+static int journalReplay(FILE *fp, long *end)
+{
+    int applied = 0;
+    *end = ftell(fp);
+    char *data = NULL;
+    unsigned char rec[13];
+
+    while (fread(rec, sizeof(rec), 1, fp) == 1)
+    {
+        uint32_t fields[3];
+        memcpy(fields, &rec[1], sizeof(fields));
+        int row = fields[0], at = fields[1], len = fields[2];
+
+        if (len < 0 || (len && (data = matRealloc(ALLOC_JOURNAL, data, len)) == NULL) ||
+            (len && fread(data, len, 1, fp) != 1))
+            break;
+
+        int rowOk = row >= 0 && row < E.numRws;
+        switch (rec[0])
+        {
+        case J_INSERT_ROW:
+            if (row < 0 || row > E.numRws)
+                goto done;
+            insertRws(row, data, len);
+            break;
+        case J_DELETE_ROW:
+            if (!rowOk)
+                goto done;
+            deleteRws(row);
+            break;
+        case J_INSERT_CHAR:
+            if (!rowOk || len != 1)
+                goto done;
+            rwsInsertChar(&E.row[row], at, (unsigned char)data[0]);
+            break;
+        case J_DELETE_CHAR:
+            if (!rowOk)
+                goto done;
+            rwsDeleteChar(&E.row[row], at);
+            break;
+        case J_APPEND:
+            if (!rowOk)
+                goto done;
+            rwsAppendString(&E.row[row], data, len);
+            break;
+        case J_TRUNCATE:
+            if (!rowOk)
+                goto done;
+            rwsTruncate(&E.row[row], at);
+            break;
+        case J_INSERT_ROWS:
+            if (row < 0 || row > E.numRws)
+                goto done;
+            insertRwsBlock(row, data, len);
+            break;
+        case J_DELETE_ROWS:
+            if (!rowOk || at < 1 || row + at > E.numRws)
+                goto done;
+            deleteRwsRange(row, at);
+            break;
+        case J_INSERT_SPAN:
+            if (!rowOk)
+                goto done;
+            rwsInsertString(&E.row[row], at, data, len);
+            break;
+        case J_DELETE_SPAN:
+            if (!rowOk || at < 0 || at + len > E.row[row].size)
+                goto done;
+            rwsDeleteSpan(&E.row[row], at, len);
+            break;
+        case J_SET_ROW:
+            if (!rowOk)
+                goto done;
+            rwsSetLine(&E.row[row], lineNew(len ? data : "", len), len);
+            break;
+        default:
+            goto done;
+        }
+        applied++;
+        *end = ftell(fp);
+    }
+
+done:
+    matFree(data);
+    return applied;
+}
+
+static FILE *journalCreate(const char *path, struct journal_header *hdr)
+{
+    FILE *fp = fopen(path, "wb");
+    if (fp == NULL)
+        return NULL;
+    fwrite(hdr, sizeof(*hdr), 1, fp);
+    fflush(fp);
+    return fp;
+}
+
+// Opens the journal for a file that has just been loaded into E, offering to
+// recover the edits of a previous session first.
+struct journal *journalOpen(const char *filename)
+{
+    struct journal_header want, hdr;
+    if (journalHeader(filename, &want) == -1)
+        return NULL;
+
+    struct journal *j = matMalloc(ALLOC_JOURNAL, sizeof(struct journal));
+    j->path = journalPath(filename);
+    j->synced = time(NULL);
+    j->pending = 0;
+    j->fp = NULL;
+
+    FILE *old = fopen(j->path, "rb");
+    if (old)
+    {
+        int same = fread(&hdr, sizeof(hdr), 1, old) == 1 && !memcmp(&hdr, &want, sizeof(hdr));
+        int recover = 0;
+
+        // a journal without records has nothing to offer
+        int c = same ? fgetc(old) : EOF;
+        if (c != EOF)
+        {
+            ungetc(c, old);
+            char *answer = prompt("Swap file found. Recover unsaved edits? (y/n) %s", NULL);
+            recover = answer && !strcmp(answer, "y");
+            matFree(answer);
+        }
+
+        if (recover)
+        {
+            long end;
+            int applied = journalReplay(old, &end);
+            fclose(old);
+
+            // keep appending after the last record that replayed cleanly
+            if (truncate(j->path, end) == 0)
+                j->fp = fopen(j->path, "ab");
+            E.dirty = applied;
+            setStatusMessage("Recovered %d edits from %s", applied, j->path);
+        }
+        else
+        {
+            fclose(old);
+            if (!same)
+                setStatusMessage("Ignored stale swap file %s", j->path);
+        }
+    }
+
+    if (j->fp == NULL)
+        j->fp = journalCreate(j->path, &want);
+
+    if (j->fp == NULL)
+    {
+        matFree(j->path);
+        matFree(j);
+        return NULL;
+    }
+    return j;
+}
+
+void journalRecord(enum journal_op op, int row, int at, const char *s, int len)
+{
+    struct journal *j = E.journal;
+    if (j == NULL)
+        return;
+
+    journalWriteRecord(j->fp, op, row, at, s, len);
+    j->pending = 1;
+}
+
+// Writes an insert of one row per slice as a single J_INSERT_ROWS record,
+// streaming the slices instead of joining them first.
+void journalRecordSlices(int at, struct line_slice *slices, int count)
+{
+    struct journal *j = E.journal;
+    if (j == NULL)
+        return;
+
+    size_t len = 0;
+    for (int i = 0; i < count; i++)
+        len += slices[i].to - slices[i].from + 1;
+
+    journalWriteHeader(j->fp, J_INSERT_ROWS, at, 0, len);
+    for (int i = 0; i < count; i++)
+    {
+        fwrite(&slices[i].chars[slices[i].from], slices[i].to - slices[i].from, 1, j->fp);
+        fputc('\n', j->fp);
+    }
+    j->pending = 1;
+}
+
+void journalSync(struct journal *j, int force)
+{
+    if (j == NULL || !j->pending)
+        return;
+
+    time_t now = time(NULL);
+    if (!force && now - j->synced < JOURNAL_SYNC_INTERVAL)
+        return;
+
+    fflush(j->fp);
+    fsync(fileno(j->fp));
+    j->synced = now;
+    j->pending = 0;
+}
+
+// After a save the file on disk holds every edit, so the journal starts over
+// against the new version of the file.
+void journalReset(const char *filename)
+{
+    struct journal *j = E.journal;
+    struct journal_header hdr;
+    if (j == NULL || journalHeader(filename, &hdr) == -1)
+        return;
+
+    fclose(j->fp);
+    j->fp = journalCreate(j->path, &hdr);
+    j->pending = 0;
+    if (j->fp == NULL)
+    {
+        matFree(j->path);
+        matFree(j);
+        E.journal = NULL;
+    }
+}
+
+void journalClose(struct journal *j, int keep)
+{
+    if (j == NULL)
+        return;
+
+    journalSync(j, 1);
+    fclose(j->fp);
+    if (!keep)
+        unlink(j->path);
+    matFree(j->path);
+    matFree(j);
+}
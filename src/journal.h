@@ -0,0 +1,39 @@
+#pragma once
+
+#include "line.h"
+
+#include <stdio.h>
+#include <time.h>
+
+// seconds between fsyncs of the swap journal
+#define JOURNAL_SYNC_INTERVAL 2
+
+enum journal_op
+{
+    J_INSERT_ROW = 1,
+    J_DELETE_ROW,
+    J_INSERT_CHAR,
+    J_DELETE_CHAR,
+    J_APPEND,
+    J_TRUNCATE,
+    J_INSERT_ROWS,
+    J_DELETE_ROWS,
+    J_INSERT_SPAN,
+    J_DELETE_SPAN,
+    J_SET_ROW
+};
+
+struct journal
+{
+    FILE *fp;
+    char *path;
+    time_t synced;
+    int pending;
+};
+
+struct journal *journalOpen(const char *filename);
+void journalRecord(enum journal_op op, int row, int at, const char *s, int len);
+void journalRecordSlices(int at, struct line_slice *slices, int count);
+void journalSync(struct journal *j, int force);
+void journalReset(const char *filename);
+void journalClose(struct journal *j, int keep);
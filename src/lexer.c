@@ -0,0 +1,247 @@
+#include "lexer.h"
+#include "mat.h"
+#include "syntax.h"
+
+#include <ctype.h>
+#include <string.h>
+
+// state 0 is the dead state, tokens outside comments start at LX_ROOT and the
+// end of a multi-line comment is matched from LX_ROOT_END
+#define LX_ROOT 1
+#define LX_ROOT_END 2
+
+static int lexerAddState(struct lexer *lx)
+{
+    if (lx->nstates == lx->cap)
+    {
+        lx->cap = lx->cap ? lx->cap * 2 : 64;
+        lx->next = matRealloc(ALLOC_SYNTAX, lx->next, sizeof(int) * lx->cap * lx->nclasses);
+        lx->accept = matRealloc(ALLOC_SYNTAX, lx->accept, lx->cap);
+    }
+
+    int s = lx->nstates++;
+    memset(&lx->next[s * lx->nclasses], 0, sizeof(int) * lx->nclasses);
+    lx->accept[s] = TK_NONE;
+    return s;
+}
+
+static void lexerAddToken(struct lexer *lx, int root, const char *tok, int len, int kind)
+{
+    if (len <= 0)
+        return;
+
+    int s = root;
+    for (int i = 0; i < len; i++)
+    {
+        int *t = &lx->next[s * lx->nclasses + lx->cls[(unsigned char)tok[i]]];
+        if (*t == 0)
+        {
+            int n = lexerAddState(lx);
+            t = &lx->next[s * lx->nclasses + lx->cls[(unsigned char)tok[i]]];
+            *t = n;
+        }
+        s = *t;
+    }
+
+    // the first definition of a token wins, as in a keyword list
+    if (lx->accept[s] == TK_NONE)
+        lx->accept[s] = kind;
+}
+
+static void lexerClassify(struct lexer *lx, const char *tok)
+{
+    for (; tok && *tok; tok++)
+        if (lx->cls[(unsigned char)*tok] == 0)
+            lx->cls[(unsigned char)*tok] = lx->nclasses++;
+}
+
+static const char *lexerKeyword(const char *kw, int *len, int *kind)
+{
+    *len = strlen(kw);
+    *kind = TK_KEYWORD1;
+    if (*len && kw[*len - 1] == '|')
+    {
+        (*len)--;
+        *kind = TK_KEYWORD2;
+    }
+    return kw;
+}
+
+struct lexer *lexerCompile(struct syntax *syntax)
+{
+    struct lexer *lx = matMalloc(ALLOC_SYNTAX, sizeof(struct lexer));
+    memset(lx, 0, sizeof(*lx));
+
+    const char *seps = syntax->separators ? syntax->separators : ",.()+-/*=~%<>[]{};";
+    for (int c = 0; c < 256; c++)
+    {
+        if (isspace(c) || c == '\0' || (c && strchr(seps, c)))
+            lx->flags[c] |= LX_SEP;
+        if (isdigit(c))
+            lx->flags[c] |= LX_DIGIT;
+    }
+    if (syntax->flags & HL_HIGHLIGHT_STRINGS)
+        for (const char *q = syntax->quotes ? syntax->quotes : "\"'"; *q; q++)
+            lx->flags[(unsigned char)*q] |= LX_QUOTE;
+    lx->numbers = (syntax->flags & HL_HIGHLIGHT_NUMBERS) != 0;
+
+    // class 0 holds every byte that appears in no token
+    lx->nclasses = 1;
+    for (int j = 0; syntax->keywords && syntax->keywords[j]; j++)
+        lexerClassify(lx, syntax->keywords[j]);
+    lexerClassify(lx, syntax->singleline_comment_start);
+    lexerClassify(lx, syntax->multiline_comment_start);
+    lexerClassify(lx, syntax->multiline_comment_end);
+
+    lexerAddState(lx);
+    lexerAddState(lx);
+    lexerAddState(lx);
+
+    char *scs = syntax->singleline_comment_start;
+    char *mcs = syntax->multiline_comment_start;
+    char *mce = syntax->multiline_comment_end;
+
+    if (scs)
+        lexerAddToken(lx, LX_ROOT, scs, strlen(scs), TK_COMMENT);
+    if (mcs && mce)
+    {
+        lexerAddToken(lx, LX_ROOT, mcs, strlen(mcs), TK_MLSTART);
+        lexerAddToken(lx, LX_ROOT_END, mce, strlen(mce), TK_MLEND);
+    }
+    for (int j = 0; syntax->keywords && syntax->keywords[j]; j++)
+    {
+        int len, kind;
+        const char *kw = lexerKeyword(syntax->keywords[j], &len, &kind);
+        lexerAddToken(lx, LX_ROOT, kw, len, kind);
+    }
+
+    return lx;
+}
+
+// Walks the trie from `root` at text[i]; returns the length of the longest
+// comment token and of the longest keyword that ends at a separator.
+static void lexerMatch(struct lexer *lx, int root, const char *text, int i, int len,
+                       int *comment, int *commentKind, int *keyword, int *keywordKind)
+{
+    int s = root;
+    *comment = *keyword = 0;
+
+    for (int k = i; k < len; k++)
+    {
+        s = lx->next[s * lx->nclasses + lx->cls[(unsigned char)text[k]]];
+        if (s == 0)
+            break;
+
+        int kind = lx->accept[s];
+        if (kind == TK_COMMENT || kind == TK_MLSTART || kind == TK_MLEND)
+        {
+            *comment = k - i + 1;
+            *commentKind = kind;
+        }
+        else if (kind != TK_NONE &&
+                 (k + 1 == len || (lx->flags[(unsigned char)text[k + 1]] & LX_SEP)))
+        {
+            *keyword = k - i + 1;
+            *keywordKind = kind;
+        }
+    }
+}
+
+// Highlights one row of rendered text that starts in the given multi-line
+// comment state and returns the state it ends in.
+int lexerRun(struct lexer *lx, const char *text, int len, unsigned char *hl, int in_comment)
+{
+    int prev_sep = 1;
+    int in_string = 0;
+    int comment, commentKind = TK_NONE, keyword, keywordKind = TK_NONE;
+
+    int i = 0;
+    while (i < len)
+    {
+        unsigned char c = text[i];
+        unsigned char prev_hl = (i > 0) ? hl[i - 1] : HL_NORMAL;
+
+        if (in_comment)
+        {
+            lexerMatch(lx, LX_ROOT_END, text, i, len, &comment, &commentKind, &keyword, &keywordKind);
+            if (comment)
+            {
+                memset(&hl[i], HL_MLCOMMENT, comment);
+                i += comment;
+                in_comment = 0;
+                prev_sep = 1;
+            }
+            else
+                hl[i++] = HL_MLCOMMENT;
+            continue;
+        }
+
+        if (in_string)
+        {
+            hl[i] = HL_STRING;
+
+            if (c == '\\' && i + 1 < len)
+            {
+                hl[i + 1] = HL_STRING;
+                i += 2;
+                continue;
+            }
+
+            if (c == in_string)
+                in_string = 0;
+
+            i++;
+            prev_sep = 1;
+            continue;
+        }
+
+        comment = keyword = 0;
+        if (lx->next[LX_ROOT * lx->nclasses + lx->cls[c]])
+            lexerMatch(lx, LX_ROOT, text, i, len, &comment, &commentKind, &keyword, &keywordKind);
+
+        if (comment && commentKind == TK_COMMENT)
+        {
+            memset(&hl[i], HL_COMMENT, len - i);
+            break;
+        }
+
+        if (comment && commentKind == TK_MLSTART)
+        {
+            memset(&hl[i], HL_MLCOMMENT, comment);
+            i += comment;
+            in_comment = 1;
+            continue;
+        }
+
+        if (lx->flags[c] & LX_QUOTE)
+        {
+            in_string = c;
+            hl[i++] = HL_STRING;
+            continue;
+        }
+
+        if (lx->numbers)
+        {
+            if (((lx->flags[c] & LX_DIGIT) && (prev_sep || prev_hl == HL_NUMBER)) ||
+                (c == '.' && prev_hl == HL_NUMBER))
+            {
+                hl[i++] = HL_NUMBER;
+                prev_sep = 0;
+                continue;
+            }
+        }
+
+        if (prev_sep && keyword)
+        {
+            memset(&hl[i], keywordKind == TK_KEYWORD2 ? HL_KEYWORD2 : HL_KEYWORD1, keyword);
+            i += keyword;
+            prev_sep = 0;
+            continue;
+        }
+
+        prev_sep = lx->flags[c] & LX_SEP;
+        i++;
+    }
+
+    return in_comment;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+// A syntax definition compiled into tables. Every byte maps to a class, and
+// keywords and comment delimiters share one trie whose transitions are
+// indexed by (state, class), so lexing a byte costs a table lookup no matter
+// how many keywords a language has.
+#define LX_SEP (1 << 0)
+#define LX_DIGIT (1 << 1)
+#define LX_QUOTE (1 << 2)
+
+enum lexer_token
+{
+    TK_NONE = 0,
+    TK_KEYWORD1,
+    TK_KEYWORD2,
+    TK_COMMENT,
+    TK_MLSTART,
+    TK_MLEND
+};
+
+struct lexer
+{
+    unsigned char cls[256];
+    unsigned char flags[256];
+    int nclasses;
+    int nstates;
+    int cap;
+    int *next; // nstates rows of nclasses entries
+    unsigned char *accept;
+    int numbers;
+};
+
+struct syntax;
+
+struct lexer *lexerCompile(struct syntax *syntax);
+int lexerRun(struct lexer *lx, const char *text, int len, unsigned char *hl, int in_comment);
@@ -0,0 +1,81 @@
+#include "line.h"
+#include "alloc.h"
+
+#include <string.h>
+
+struct line_header
+{
+    int refs;
+};
+
+static struct line_header *lineHeader(char *chars)
+{
+    return (struct line_header *)(chars - sizeof(struct line_header));
+}
+
+// returns a block holding a copy of s followed by a NUL
+char *lineNew(const char *s, size_t len)
+{
+    struct line_header *hdr = matMalloc(ALLOC_ROWS, sizeof(*hdr) + len + 1);
+    char *chars = (char *)(hdr + 1);
+
+    hdr->refs = 1;
+    memcpy(chars, s, len);
+    chars[len] = '\0';
+    return chars;
+}
+
+char *lineRef(char *chars)
+{
+    lineHeader(chars)->refs++;
+    return chars;
+}
+
+void lineFree(char *chars)
+{
+    if (chars == NULL)
+        return;
+
+    struct line_header *hdr = lineHeader(chars);
+    if (--hdr->refs == 0)
+        matFree(hdr);
+}
+
+// Makes the block holding `size` bytes plus a NUL exclusive to the caller and
+// sized for `cap` bytes. The copy for a shared block is the only place the
+// text of a yank is ever duplicated.
+char *lineResize(char *chars, int size, size_t cap)
+{
+    struct line_header *hdr = lineHeader(chars);
+
+    if (hdr->refs > 1)
+    {
+        size_t keep = (size_t)size + 1 < cap ? (size_t)size + 1 : cap;
+        struct line_header *copy = matMalloc(ALLOC_ROWS, sizeof(*copy) + cap);
+        copy->refs = 1;
+        memcpy(copy + 1, chars, keep);
+        hdr->refs--;
+        return (char *)(copy + 1);
+    }
+
+    hdr = matRealloc(ALLOC_ROWS, hdr, sizeof(*hdr) + cap);
+    return (char *)(hdr + 1);
+}
+
+// bytes the block holding chars takes, header included
+size_t lineBytes(char *chars)
+{
+    return matSize(lineHeader(chars));
+}
+
+// true when a register or undo record holds the block too
+int lineShared(char *chars)
+{
+    return lineHeader(chars)->refs > 1;
+}
+
+// bytes of the block past the header, the text of a row of `size` and its NUL
+size_t lineSlack(char *chars, int size)
+{
+    return lineBytes(chars) - sizeof(struct line_header) - size - 1;
+}
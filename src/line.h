@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stddef.h>
+
+// Row text lives in reference-counted blocks so registers and rows can share
+// it. A shared block is never written to: the row functions call lineResize
+// first, which copies it only when someone else still holds a reference.
+struct line_slice
+{
+    char *chars; // a referenced block
+    int from, to;
+};
+
+char *lineNew(const char *s, size_t len);
+char *lineRef(char *chars);
+void lineFree(char *chars);
+char *lineResize(char *chars, int size, size_t cap);
+size_t lineBytes(char *chars);
+int lineShared(char *chars);
+size_t lineSlack(char *chars, int size);
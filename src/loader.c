@@ -0,0 +1,183 @@
+#include "loader.h"
+#include "alloc.h"
+#include "mat.h"
+#include "syntax.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+
+extern struct config E;
+
+// A large file is mapped and cut into one chunk per thread at newline
+// boundaries. A first pass counts each chunk's lines, so the row array is
+// allocated once and every worker knows where its rows start. A second pass
+// builds the rows in place: text, render, and highlighting lexed as if the
+// chunk began outside a comment. Chunks are then checked in order; from the
+// first one whose guess was wrong, highlighting is dropped and redone lazily.
+struct loader_chunk
+{
+    const char *base;
+    const char *from, *to;
+    int first, lines;
+    int state; // comment state after the last row, given the guessed start
+    uint64_t *offsets;
+    pthread_t thread;
+};
+
+static void *loaderCount(void *arg)
+{
+    struct loader_chunk *c = arg;
+    const char *p = c->from;
+    int lines = 0;
+
+    while (p < c->to && (p = memchr(p, '\n', c->to - p)) != NULL)
+    {
+        lines++;
+        p++;
+    }
+    if (c->to > c->from && c->to[-1] != '\n')
+        lines++;
+
+    c->lines = lines;
+    return NULL;
+}
+
+// E.wraps and E.brackets are NULL while a file loads, so building a row
+// touches nothing outside it and the workers need no locking.
+static void *loaderFill(void *arg)
+{
+    struct loader_chunk *c = arg;
+    const char *p = c->from;
+    int state = 0;
+
+    for (int j = c->first; j < c->first + c->lines; j++)
+    {
+        const char *nl = memchr(p, '\n', c->to - p);
+        size_t len = (nl ? nl : c->to) - p;
+        while (len > 0 && (p[len - 1] == '\n' || p[len - 1] == '\r'))
+            len--;
+
+        if (c->offsets)
+            c->offsets[j] = p - c->base;
+
+        erow *row = &E.row[j];
+        row->idx = j;
+        row->size = len;
+        row->chars = lineNew(p, len);
+        row->render = NULL;
+        updateRender(row);
+
+        row->hl = matMalloc(ALLOC_HL, row->rsize);
+        memset(row->hl, HL_NORMAL, row->rsize);
+        state = E.syntax ? syntaxLexRow(row, state) : 0;
+        row->hl_open_comment = state;
+
+        p = nl ? nl + 1 : c->to;
+    }
+
+    c->state = state;
+    return NULL;
+}
+
+// the calling thread takes the first chunk, and any a thread could not be
+// started for
+static void loaderRun(struct loader_chunk *chunks, int count, void *(*fn)(void *))
+{
+    int started = 1;
+    for (; started < count; started++)
+        if (pthread_create(&chunks[started].thread, NULL, fn, &chunks[started]) != 0)
+            break;
+
+    fn(&chunks[0]);
+    for (int t = started; t < count; t++)
+        fn(&chunks[t]);
+    for (int t = 1; t < started; t++)
+        pthread_join(chunks[t].thread, NULL);
+}
+
+static int loaderThreads(size_t size)
+{
+    char *env = getenv("MAT_LOAD_THREADS");
+    long threads = env ? atol(env) : sysconf(_SC_NPROCESSORS_ONLN);
+
+    if ((size_t)threads > size / LOADER_MIN_CHUNK)
+        threads = size / LOADER_MIN_CHUNK;
+    if (threads > LOADER_MAX_THREADS)
+        threads = LOADER_MAX_THREADS;
+    return threads < 1 ? 1 : threads;
+}
+
+// Loads the rows of an empty buffer from file. When idx is given it is
+// filled with every line's offset for the sidecar cache. Returns -1, having
+// loaded nothing, when the file cannot be mapped.
+int loaderRead(FILE *file, size_t size, struct line_index *idx)
+{
+    char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+    if (map == MAP_FAILED)
+        return -1;
+    madvise(map, size, MADV_SEQUENTIAL);
+
+    int threads = loaderThreads(size);
+    struct loader_chunk chunks[LOADER_MAX_THREADS];
+
+    const char *from = map;
+    for (int t = 0; t < threads; t++)
+    {
+        const char *to = map + size * (t + 1) / threads;
+        if (to < from)
+            to = from;
+        if (t < threads - 1)
+        {
+            const char *nl = memchr(to, '\n', map + size - to);
+            to = nl ? nl + 1 : map + size;
+        }
+        else
+            to = map + size;
+
+        chunks[t].base = map;
+        chunks[t].from = from;
+        chunks[t].to = to;
+        from = to;
+    }
+
+    loaderRun(chunks, threads, loaderCount);
+
+    int rows = 0;
+    for (int t = 0; t < threads; t++)
+    {
+        chunks[t].first = rows;
+        rows += chunks[t].lines;
+    }
+
+    uint64_t *offsets = NULL;
+    if (idx)
+    {
+        offsets = matMalloc(ALLOC_INDEX, sizeof(uint64_t) * (rows + 1));
+        offsets[rows] = size;
+        idx->offsets = offsets;
+        idx->lines = rows;
+        idx->cap = rows + 1;
+    }
+    for (int t = 0; t < threads; t++)
+        chunks[t].offsets = offsets;
+
+    E.row = matMalloc(ALLOC_ROWS, sizeof(erow) * (rows ? rows : 1));
+    loaderRun(chunks, threads, loaderFill);
+    E.numRws = rows;
+
+    for (int t = 1; t < threads; t++)
+    {
+        if (chunks[t - 1].state != 0)
+        {
+            syntaxInvalidate(chunks[t].first);
+            break;
+        }
+    }
+
+    munmap(map, size);
+    return 0;
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "index.h"
+
+#include <stdio.h>
+
+// files from this size on are loaded in parallel chunks
+#define LOADER_MIN_SIZE (4 << 20)
+// smallest chunk worth a thread of its own
+#define LOADER_MIN_CHUNK (1 << 20)
+#define LOADER_MAX_THREADS 64
+
+int loaderRead(FILE *file, size_t size, struct line_index *idx);
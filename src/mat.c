@@ -2,12 +2,45 @@
 #define _BSD_SOURCE
 #define _GNU_SOURCE
 
+#include "alloc.c"
+#include "utf8.c"
+#include "line.c"
 #include "input.c"
 #include "statusline.c"
 #include "syntax.c"
+#include "lexer.c"
+#include "index.c"
+#include "journal.c"
+#include "buffer.c"
+#include "command.c"
+#include "rowtree.c"
+#include "brackets.c"
+#include "motion.c"
+#include "visual.c"
+#include "register.c"
+#include "undo.c"
+#include "substitute.c"
+#include "wrap.c"
+#include "screen.c"
+#include "event.c"
+#include "output.c"
+#include "stream.c"
+#include "follow.c"
+#include "diff.c"
+#include "reload.c"
+#include "hex.c"
+#include "pager.c"
+#include "loader.c"
+#include "meminfo.c"
+#include "server.c"
+#include "filter.c"
+#include "words.c"
+#include "complete.c"
+#include "grep.c"
 
 #include <ctype.h>
 #include <errno.h>
+#include <signal.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -17,6 +50,8 @@
 #include <unistd.h>
 
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 
 // defines
@@ -26,28 +61,18 @@
 // globals
 int MAT_TABSTOP = 4;
 
-enum highlight
-{
-    HL_NORMAL = 0,
-    HL_COMMENT,
-    HL_MLCOMMENT,
-    HL_KEYWORD1,
-    HL_KEYWORD2,
-    HL_STRING,
-    HL_NUMBER,
-    HL_MATCH
-};
-
 // proto
 int getWindowSize(int *rws, int *cls);
 void setStatusMessage(const char *fmt, ...);
 void refreshScreen();
+void updateSyntax(erow *row);
 
 char *prompt(char *prompt, void (*callback)(char *, int));
 
 // terminal
 void die(const char *s)
 {
+    outputFlush();
     write(STDOUT_FILENO, "\x1b[2J", 4);
     write(STDOUT_FILENO, "\x1b[H", 3);
 
@@ -83,19 +108,27 @@ void enableRawMode()
     raw.c_cc[VMIN] = 0;
     raw.c_cc[VTIME] = 1;
 
-    if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == -1)
+    // a server's editor keeps keys that came early, the relay has counted them
+    if (tcsetattr(STDIN_FILENO, serverActive() ? TCSANOW : TCSAFLUSH, &raw) == -1)
         die("tcsetattr");
 }
 
+// set by the SIGWINCH handler, the resize itself is handled from idleTick
+static volatile sig_atomic_t windowResized;
+
+static void onWindowResize(int sig)
+{
+    (void)sig;
+    windowResized = 1;
+}
+
 void handleWindowSizeChange()
 {
     if (getWindowSize(&E.screenRws, &E.screenCls) == -1)
         die("getWindowSize");
 
-    if (E.cy > E.screenRws)
-        E.cy = E.screenRws - 1;
-    if (E.cx > E.screenCls)
-        E.cx = E.screenCls - 1;
+    // status and message lines, as in init; scroll() keeps the cursor in view
+    E.screenRws -= 2;
 
     refreshScreen();
 }
@@ -108,7 +141,7 @@ int getWindowSize(int *rws, int *cls)
     else
     {
         *rws = ws.ws_row;
-        *cls = ws.ws_col + 4;
+        *cls = ws.ws_col;
         return 0;
     }
 }
@@ -121,7 +154,7 @@ int getCursorPosition(int *rows, int *cols)
         return -1;
     while (i < sizeof(buf) - 1)
     {
-        if (read(STDIN_FILENO, &buf[i], 1) != 1)
+        if (inputByte(&buf[i]) != 1)
             break;
         if (buf[i] == 'R')
             break;
@@ -137,150 +170,80 @@ int getCursorPosition(int *rows, int *cols)
 
 // syntax
 
-int is_separator(int c)
+// Lexes one row starting in the given multi-line comment state and returns
+// the state the row ends in.
+int syntaxLexRow(erow *row, int in_comment)
 {
-    return isspace(c) || c == '\0' || strchr(",.()+-/*=~%<>[]{};", c) != NULL;
+    return lexerRun(E.syntax->lexer, row->render, row->rsize, row->hl, in_comment);
 }
 
-void updateSyntax(erow *row)
+// Drops highlighting from `from` onwards; those rows are lexed again the next
+// time they are needed.
+void syntaxInvalidate(int from)
 {
-    row->hl = realloc(row->hl, row->rsize);
-    memset(row->hl, HL_NORMAL, row->rsize);
+    // the bracket index finds the rows to lex again by their comment state,
+    // but a new syntax changes every row
+    if (from == 0)
+        bracketDrop();
+    for (int j = from; j < E.numRws; j++)
+    {
+        matFree(E.row[j].hl);
+        E.row[j].hl = NULL;
+        E.row[j].hl_open_comment = -1;
+    }
+}
 
-    if (E.syntax == NULL)
+// Highlighting is lazy: a row without hl is lexed when it is first needed,
+// starting from the closest row above it whose comment state is known. A
+// hl_open_comment of -1 marks that state as unknown.
+void syntaxEnsure(int at)
+{
+    if (E.row[at].hl)
         return;
 
-    char **keywords = E.syntax->keywords;
+    int start = at;
+    while (start > 0 && E.row[start - 1].hl_open_comment < 0)
+        start--;
 
-    char *scs = E.syntax->singleline_comment_start;
-    char *mcs = E.syntax->multiline_comment_start;
-    char *mce = E.syntax->multiline_comment_end;
-
-    int scs_len = scs ? strlen(scs) : 0;
-    int mcs_len = mcs ? strlen(mcs) : 0;
-    int mce_len = mce ? strlen(mce) : 0;
-
-    int prev_sep = 1;
-    int in_string = 0;
-    int in_comment = (row->idx > 0 && E.row[row->idx - 1].hl_open_comment);
+    for (int j = start; j <= at; j++)
+        updateSyntax(&E.row[j]);
+}
 
-    int i = 0;
-    while (i < row->rsize)
+void updateSyntax(erow *row)
+{
+    while (1)
     {
-        char c = row->render[i];
-        unsigned char prev_hl = (i > 0) ? row->hl[i - 1] : HL_NORMAL;
-
-        if (scs_len && !in_string && !in_comment)
-        {
-            if (!strncmp(&row->render[i], scs, scs_len))
-            {
-                memset(&row->hl[i], HL_COMMENT, row->rsize - i);
-                break;
-            }
-        }
+        row->hl = matRealloc(ALLOC_HL, row->hl, row->rsize);
+        memset(row->hl, HL_NORMAL, row->rsize);
 
-        if (mcs_len && mce_len && !in_string)
+        if (E.syntax == NULL)
         {
-            if (in_comment)
-            {
-                row->hl[i] = HL_MLCOMMENT;
-                if (!strncmp(&row->render[i], mce, mce_len))
-                {
-                    memset(&row->hl[i], HL_MLCOMMENT, mce_len);
-                    i += mce_len;
-                    in_comment = 0;
-                    prev_sep = 1;
-                    continue;
-                }
-                else
-                {
-                    i++;
-                    continue;
-                }
-            }
-            else if (!strncmp(&row->render[i], mcs, mcs_len))
-            {
-                memset(&row->hl[i], HL_MLCOMMENT, mcs_len);
-                i += mcs_len;
-                in_comment = 1;
-                continue;
-            }
+            row->hl_open_comment = 0;
+            bracketRowChanged(row, 0);
+            return;
         }
 
-        if (E.syntax->flags & HL_HIGHLIGHT_STRINGS)
-        {
-            if (in_string)
-            {
-                row->hl[i] = HL_STRING;
-
-                if (c == '\\' && i + 1 < row->rsize)
-                {
-                    row->hl[i + 1] = HL_STRING;
-                    i += 2;
-                    continue;
-                }
+        if (row->idx > 0 && E.row[row->idx - 1].hl_open_comment < 0)
+            syntaxEnsure(row->idx - 1);
 
-                if (c == in_string)
-                    in_string = 0;
+        int in = row->idx > 0 && E.row[row->idx - 1].hl_open_comment;
+        int in_comment = syntaxLexRow(row, in);
+        int prev = row->hl_open_comment;
+        row->hl_open_comment = in_comment;
+        bracketRowChanged(row, in);
 
-                i++;
-                prev_sep = 1;
-                continue;
-            }
-            else
-            {
-                if (c == '"' || c == '\'')
-                {
-                    in_string = c;
-                    row->hl[i] = HL_STRING;
-                    i++;
-                    continue;
-                }
-            }
-        }
-
-        if (E.syntax->flags & HL_HIGHLIGHT_NUMBERS)
-        {
-            if (isdigit(c) && (prev_sep || prev_hl == HL_NUMBER) || (c == '.' && prev_hl == HL_NUMBER))
-            {
-                row->hl[i] = HL_NUMBER;
-                i++;
-                prev_sep = 0;
-                continue;
-            }
-        }
+        // a changed state invalidates the rows below; highlighted ones are
+        // redone now, and everything past the first lazy row is dropped
+        if (prev < 0 || prev == in_comment || row->idx + 1 >= E.numRws)
+            return;
 
-        if (prev_sep)
+        row = &E.row[row->idx + 1];
+        if (row->hl == NULL)
         {
-            int j;
-            for (j = 0; keywords[j]; j++)
-            {
-                int klen = strlen(keywords[j]);
-                int kw2 = keywords[j][klen - 1] == '|';
-                if (kw2)
-                    klen--;
-                if (!strncmp(&row->render[i], keywords[j], klen) &&
-                    is_separator(row->render[i + klen]))
-                {
-                    memset(&row->hl[i], kw2 ? HL_KEYWORD2 : HL_KEYWORD1, klen);
-                    i += klen;
-                    break;
-                }
-            }
-            if (keywords[j] != NULL)
-            {
-                prev_sep = 0;
-                continue;
-            }
+            syntaxInvalidate(row->idx);
+            return;
         }
-
-        prev_sep = is_separator(c);
-        i++;
     }
-    int changed = (row->hl_open_comment != in_comment);
-    row->hl_open_comment = in_comment;
-    if (changed && row->idx + 1 < E.numRws)
-        updateSyntax(&E.row[row->idx + 1]);
 }
 
 const char *syntaxToColor(int hl)
@@ -300,6 +263,8 @@ const char *syntaxToColor(int hl)
         return hexToAnsiBackground("#fab387");
     case HL_MATCH:
         return hexToAnsiBackground("#f38ba8");
+    case HL_VISUAL:
+        return hexToAnsiBackground("#89b4fa");
     default:
         return hexToAnsiBackground("#f38ba8");
     }
@@ -326,12 +291,7 @@ void selectSyntaxHighlight()
                 (!is_ext && strstr(E.current_file_name, s->filematch[i])))
             {
                 E.syntax = s;
-                int filerow;
-                for (filerow = 0; filerow < E.numRws; filerow++)
-                {
-                    updateSyntax(&E.row[filerow]);
-                }
-
+                syntaxInvalidate(0);
                 return;
             }
             i++;
@@ -339,70 +299,276 @@ void selectSyntaxHighlight()
     }
 }
 
-int rwsRxToCx(erow *row, int rx)
+// Three positions describe a place in a row: cx indexes chars, rx indexes
+// render, and a column is where it lands on screen. In a plain ASCII row,
+// one without tabs, all three are the same. Other rows convert from the
+// mark at or before the position, see RENDER_MARKS, and decode at most one
+// stretch of RENDER_STEP bytes from there, however long the row.
+static struct render_mark *rwsMarks(erow *row)
+{
+    if (row->rsize == row->size && row->rwidth == row->rsize)
+        return NULL;
+    return (struct render_mark *)(row->render + RENDER_MARKS(row->rsize));
+}
+
+static int rwsMarkCount(erow *row)
+{
+    return row->size > 0 ? (row->size - 1) / RENDER_STEP + 1 : 0;
+}
+
+// what a render block with its marks takes, as updateRender allocates it
+size_t rwsRenderBytes(erow *row)
+{
+    if (row->rsize == row->size && row->rwidth == row->rsize)
+        return (size_t)row->rsize + 1;
+    return RENDER_MARKS(row->rsize) + sizeof(struct render_mark) * rwsMarkCount(row);
+}
+
+// moves p past the character it is at
+static void rwsAdvance(erow *row, struct render_mark *p)
+{
+    unsigned char c = row->chars[p->cx];
+    if (c == '\t')
+    {
+        int w = MAT_TABSTOP - p->col % MAT_TABSTOP;
+        p->cx++;
+        p->rx += w;
+        p->col += w;
+    }
+    else if (c < 0x80)
+    {
+        p->cx++;
+        p->rx++;
+        p->col++;
+    }
+    else
+    {
+        int cp;
+        int n = utf8Decode(&row->chars[p->cx], row->size - p->cx, &cp);
+        p->cx += n;
+        p->rx += cp < 0 ? (int)sizeof(UTF8_REPLACEMENT) - 1 : n;
+        p->col += cp < 0 ? 1 : utf8Width(cp);
+    }
+}
+
+// the last mark at or before render byte at, or column at when byCol is set
+static struct render_mark rwsMarkBefore(erow *row, struct render_mark *marks, int at, int byCol)
 {
-    int cur_rx = 0;
-    int cx;
-    for (cx = 0; cx < row->size; cx++)
+    int lo = 0, hi = rwsMarkCount(row);
+    while (hi - lo > 1)
     {
-        if (row->chars[cx] == '\t')
-            cur_rx += (MAT_TABSTOP - 1) - (cur_rx % MAT_TABSTOP);
+        int mid = (lo + hi) / 2;
+        if ((byCol ? marks[mid].col : marks[mid].rx) <= at)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return marks[lo];
+}
 
-        cur_rx++;
-        if (cur_rx > rx)
-            return cx;
+// the character covering render byte rx, or the end of the row
+static struct render_mark rwsAtRx(erow *row, struct render_mark *marks, int rx)
+{
+    struct render_mark p = rwsMarkBefore(row, marks, rx, 0);
+    while (p.cx < row->size)
+    {
+        struct render_mark q = p;
+        rwsAdvance(row, &q);
+        if (q.rx > rx)
+            break;
+        p = q;
     }
-    return cx;
+    return p;
+}
+
+int rwsRxToCol(erow *row, int rx)
+{
+    struct render_mark *marks = rwsMarks(row);
+    if (marks == NULL)
+        return rx;
+    if (rx >= row->rsize)
+        return row->rwidth + rx - row->rsize;
+
+    // the spaces a tab turns into take a column each, the bytes of any other
+    // character share its one
+    struct render_mark p = rwsAtRx(row, marks, rx);
+    return p.col + (row->chars[p.cx] == '\t' ? rx - p.rx : 0);
 }
 
+// the render index of the character covering column col
+int rwsColToRx(erow *row, int col)
+{
+    struct render_mark *marks = rwsMarks(row);
+    if (marks == NULL)
+        return col;
+    if (col >= row->rwidth)
+        return row->rsize + col - row->rwidth;
+
+    struct render_mark p = rwsMarkBefore(row, marks, col, 1);
+    while (p.cx < row->size)
+    {
+        struct render_mark q = p;
+        rwsAdvance(row, &q);
+        if (q.col > col)
+            break;
+        p = q;
+    }
+    return p.rx + (row->chars[p.cx] == '\t' ? col - p.col : 0);
+}
+
+int rwsRxToCx(erow *row, int rx)
+{
+    struct render_mark *marks = rwsMarks(row);
+    if (marks == NULL)
+        return rx < row->size ? rx : row->size;
+    return rwsAtRx(row, marks, rx).cx;
+}
+
+// the render index of the first character starting at or after cx
 int rwsCxToRx(erow *row, int cx)
 {
-    int rx = 0;
-    for (int j = 0; j < cx; j++)
+    struct render_mark *marks = rwsMarks(row);
+    if (cx > row->size)
+        cx = row->size;
+    if (marks == NULL || cx <= 0)
+        return cx > 0 ? cx : 0;
+
+    struct render_mark p = marks[(cx - 1) / RENDER_STEP];
+    while (p.cx < cx)
+        rwsAdvance(row, &p);
+    return p.rx;
+}
+
+int rwsCxToCol(erow *row, int cx)
+{
+    return rwsRxToCol(row, rwsCxToRx(row, cx));
+}
+
+int rwsColToCx(erow *row, int col)
+{
+    return rwsRxToCx(row, rwsColToRx(row, col));
+}
+
+// where the cursor lands moving one character right or left from cx
+int rwsNextCx(erow *row, int cx)
+{
+    if (cx >= row->size)
+        return row->size;
+    if (row->rwidth == row->rsize)
+        return cx + 1;
+    int cp;
+    return cx + utf8Decode(&row->chars[cx], row->size - cx, &cp);
+}
+
+// the start of the character byte cx belongs to; a sequence is at most four
+// bytes, and a byte none accounts for is a character of its own
+int rwsCharStart(erow *row, int cx)
+{
+    if (row->rwidth == row->rsize || cx >= row->size)
+        return cx;
+    for (int back = 1; back <= 3 && back <= cx; back++)
     {
-        if (row->chars[j] == '\t')
-        {
-            rx += (MAT_TABSTOP - 1) - (rx % MAT_TABSTOP);
-        }
-        rx++;
+        int cp;
+        if (utf8Decode(&row->chars[cx - back], row->size - (cx - back), &cp) > back)
+            return cx - back;
     }
-    return rx;
+    return cx;
 }
 
-void updateRws(erow *row)
+int rwsPrevCx(erow *row, int cx)
 {
-    int tabs = 0;
+    if (cx <= 0)
+        return 0;
+    return rwsCharStart(row, cx - 1);
+}
 
+// Builds render from chars: tabs become spaces up to the next stop and
+// invalid bytes become U+FFFD. A row whose chars are plain ASCII, checked
+// sixteen bytes at a time, takes the short way with no decoding.
+void updateRender(erow *row)
+{
+    int ascii = utf8Ascii(row->chars, row->size);
+    int rsize = 0, width = 0;
     int j;
 
     for (j = 0; j < row->size; j++)
-        if (row->chars[j] == '\t')
-            tabs++;
+    {
+        unsigned char c = row->chars[j];
+        if (c == '\t')
+        {
+            rsize += MAT_TABSTOP - width % MAT_TABSTOP;
+            width += MAT_TABSTOP - width % MAT_TABSTOP;
+        }
+        else if (ascii || c < 0x80)
+        {
+            rsize++;
+            width++;
+        }
+        else
+        {
+            int cp;
+            int n = utf8Decode(&row->chars[j], row->size - j, &cp);
+            rsize += cp < 0 ? (int)sizeof(UTF8_REPLACEMENT) - 1 : n;
+            width += cp < 0 ? 1 : utf8Width(cp);
+            j += n - 1;
+        }
+    }
 
-    free(row->render);
-    row->render = malloc(row->size + tabs * (MAT_TABSTOP - 1) + 1);
+    matFree(row->render);
+    row->rsize = rsize;
+    row->rwidth = width;
+    row->render = matMalloc(ALLOC_RENDER, rwsRenderBytes(row));
 
-    int idx = 0;
+    struct render_mark *marks = rwsMarks(row);
+    int idx = 0, col = 0, mark = 0;
 
     for (j = 0; j < row->size; j++)
     {
+        unsigned char c = row->chars[j];
+        int n = 1, cp = c;
+        if (c >= 0x80)
+            n = utf8Decode(&row->chars[j], row->size - j, &cp);
+
+        for (; marks && mark * RENDER_STEP < j + n; mark++)
+        {
+            marks[mark].cx = j;
+            marks[mark].rx = idx;
+            marks[mark].col = col;
+        }
 
-        if (row->chars[j] == '\t')
+        if (c == '\t')
         {
-            row->render[idx++] = ' ';
-            while (idx % MAT_TABSTOP != 0)
+            do
             {
                 row->render[idx++] = ' ';
-            }
+                col++;
+            } while (col % MAT_TABSTOP != 0);
+        }
+        else if (c < 0x80)
+        {
+            row->render[idx++] = c;
+            col++;
         }
         else
-            row->render[idx++] = row->chars[j];
+        {
+            const char *s = cp < 0 ? UTF8_REPLACEMENT : &row->chars[j];
+            int len = cp < 0 ? (int)sizeof(UTF8_REPLACEMENT) - 1 : n;
+            memcpy(&row->render[idx], s, len);
+            idx += len;
+            col += cp < 0 ? 1 : utf8Width(cp);
+            j += n - 1;
+        }
     }
 
     row->render[idx] = '\0';
-    row->rsize = idx;
+    wrapRowChanged(row);
+}
 
+void updateRws(erow *row)
+{
+    updateRender(row);
     updateSyntax(row);
+    wordsRowChanged(row);
 }
 
 // operations
@@ -411,22 +577,27 @@ void insertRws(int at, char *s, size_t len)
     if (at < 0 || at > E.numRws)
         return;
 
-    E.row = realloc(E.row, sizeof(erow) * (E.numRws + 1));
+    undoRecord(at, 0, 1);
+    journalRecord(J_INSERT_ROW, at, 0, s, len);
+
+    E.row = matRealloc(ALLOC_ROWS, E.row, sizeof(erow) * (E.numRws + 1));
     memmove(&E.row[at + 1], &E.row[at], sizeof(erow) * (E.numRws - at));
 
     for (int j = at + 1; j <= E.numRws; j++)
         E.row[j].idx++;
 
+    E.row[at].idx = at;
     E.row[at].size = len;
-    E.row[at].chars = malloc(len + 1);
-    memcpy(E.row[at].chars, s, len);
-    E.row[at].chars[len] = '\0';
+    E.row[at].chars = lineNew(s, len);
 
     E.row[at].rsize = 0;
-    E.row[at].hl_open_comment = 0;
+    E.row[at].rwidth = 0;
+    E.row[at].hl_open_comment = at > 0 ? E.row[at - 1].hl_open_comment : 0;
     E.row[at].render = NULL;
     E.row[at].hl = NULL;
 
+    bracketRowsInserted(at, 1);
+    wrapRowsInserted(at, 1);
     updateRws(&E.row[at]);
 
     E.numRws++;
@@ -443,10 +614,7 @@ void insertNewLine()
     {
         erow *row = &E.row[E.cy];
         insertRws(E.cy + 1, row->chars + E.cx, row->size - E.cx);
-        row = &E.row[E.cy];
-        row->size = E.cx;
-        row->chars[row->size] = '\0';
-        updateRws(row);
+        rwsTruncate(&E.row[E.cy], E.cx);
     }
 
     E.cy++;
@@ -458,6 +626,11 @@ void rwsDeleteChar(erow *row, int at)
     if (at < 0 || at >= row->size)
         return;
 
+    undoRecord(row->idx, 1, 1);
+    journalRecord(J_DELETE_CHAR, row->idx, at, NULL, 0);
+    wordsRowChanging(row);
+
+    row->chars = lineResize(row->chars, row->size, row->size + 1);
     memmove(&row->chars[at], &row->chars[at + 1], row->size - at);
     row->size--;
     updateRws(row);
@@ -468,7 +641,12 @@ void rwsInsertChar(erow *row, int at, int c)
     if (at < 0 || at > row->size)
         at = row->size;
 
-    row->chars = realloc(row->chars, row->size + 2);
+    char ch = c;
+    undoRecord(row->idx, 1, 1);
+    journalRecord(J_INSERT_CHAR, row->idx, at, &ch, 1);
+    wordsRowChanging(row);
+
+    row->chars = lineResize(row->chars, row->size, row->size + 2);
     memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
     row->chars[at] = c;
     row->size++;
@@ -478,7 +656,11 @@ void rwsInsertChar(erow *row, int at, int c)
 
 void rwsAppendString(erow *row, char *s, size_t len)
 {
-    row->chars = realloc(row->chars, row->size + len + 1);
+    undoRecord(row->idx, 1, 1);
+    journalRecord(J_APPEND, row->idx, 0, s, len);
+    wordsRowChanging(row);
+
+    row->chars = lineResize(row->chars, row->size, row->size + len + 1);
     memcpy(&row->chars[row->size], s, len);
     row->size += len;
     row->chars[row->size] = '\0';
@@ -486,17 +668,87 @@ void rwsAppendString(erow *row, char *s, size_t len)
     E.dirty++;
 }
 
+void rwsTruncate(erow *row, int at)
+{
+    if (at < 0 || at > row->size)
+        return;
+
+    undoRecord(row->idx, 1, 1);
+    journalRecord(J_TRUNCATE, row->idx, at, NULL, 0);
+    wordsRowChanging(row);
+
+    row->chars = lineResize(row->chars, at, at + 1);
+    row->size = at;
+    row->chars[at] = '\0';
+    updateRws(row);
+    E.dirty++;
+}
+
+void rwsInsertString(erow *row, int at, char *s, size_t len)
+{
+    if (at < 0 || at > row->size)
+        at = row->size;
+
+    undoRecord(row->idx, 1, 1);
+    journalRecord(J_INSERT_SPAN, row->idx, at, s, len);
+    wordsRowChanging(row);
+
+    row->chars = lineResize(row->chars, row->size, row->size + len + 1);
+    memmove(&row->chars[at + len], &row->chars[at], row->size - at + 1);
+    memcpy(&row->chars[at], s, len);
+    row->size += len;
+    updateRws(row);
+    E.dirty++;
+}
+
+void rwsDeleteSpan(erow *row, int at, int len)
+{
+    if (at < 0 || len <= 0 || at + len > row->size)
+        return;
+
+    undoRecord(row->idx, 1, 1);
+    journalRecord(J_DELETE_SPAN, row->idx, at, &row->chars[at], len);
+    wordsRowChanging(row);
+
+    row->chars = lineResize(row->chars, row->size, row->size + 1);
+    memmove(&row->chars[at], &row->chars[at + len], row->size - at - len + 1);
+    row->size -= len;
+    updateRws(row);
+    E.dirty++;
+}
+
+// Replaces the text of a row with a block handed over by the caller.
+void rwsSetLine(erow *row, char *chars, int size)
+{
+    undoRecord(row->idx, 1, 1);
+    journalRecord(J_SET_ROW, row->idx, 0, chars, size);
+    wordsRowChanging(row);
+
+    lineFree(row->chars);
+    row->chars = chars;
+    row->size = size;
+    updateRws(row);
+    E.dirty++;
+}
+
 void freeRws(erow *row)
 {
-    free(row->render);
-    free(row->chars);
-    free(row->hl);
+    matFree(row->render);
+    lineFree(row->chars);
+    matFree(row->hl);
 }
 
 void deleteRws(int at)
 {
     if (at < 0 || at >= E.numRws)
         return;
+
+    undoRecord(at, 1, 0);
+    journalRecord(J_DELETE_ROW, at, 0, NULL, 0);
+    bracketRowsDeleted(at, 1);
+    wrapRowsDeleted(at, 1);
+    wordsRowsDeleted(at, 1);
+
     freeRws(&E.row[at]);
     memmove(&E.row[at], &E.row[at + 1], sizeof(erow) * (E.numRws - at - 1));
     for (int j = at; j < E.numRws - 1; j++)
@@ -506,6 +758,142 @@ void deleteRws(int at)
     E.dirty++;
 }
 
+// Opens a gap of `count` rows before row `at` with a single move of the row
+// array and returns the comment state the rows below it were lexed with.
+static int rwsOpenGap(int at, int count)
+{
+    int before = at > 0 ? E.row[at - 1].hl_open_comment : 0;
+
+    E.row = matRealloc(ALLOC_ROWS, E.row, sizeof(erow) * (E.numRws + count));
+    memmove(&E.row[at + count], &E.row[at], sizeof(erow) * (E.numRws - at));
+    E.numRws += count;
+    for (int j = at + count; j < E.numRws; j++)
+        E.row[j].idx = j;
+
+    return before;
+}
+
+static void rwsFillGap(int at, char *chars, int size)
+{
+    erow *row = &E.row[at];
+    row->idx = at;
+    row->size = size;
+    row->chars = chars;
+    row->rsize = 0;
+    row->rwidth = 0;
+    row->render = NULL;
+    row->hl = NULL;
+    row->hl_open_comment = -1;
+}
+
+// The new rows are highlighted in one pass and the rows below are only
+// revisited if the comment state after them changed.
+static void rwsCloseGap(int at, int count, int before)
+{
+    bracketRowsInserted(at, count);
+    wrapRowsInserted(at, count);
+    for (int j = at; j < at + count; j++)
+        updateRws(&E.row[j]);
+
+    int next = at + count;
+    if (next < E.numRws && (before < 0 || E.row[next - 1].hl_open_comment != before))
+    {
+        if (E.row[next].hl)
+            updateSyntax(&E.row[next]);
+        else
+            syntaxInvalidate(next);
+    }
+
+    E.dirty++;
+}
+
+// Inserts the lines in s, each ended by '\n', before row `at`.
+void insertRwsBlock(int at, char *s, size_t len)
+{
+    if (at < 0 || at > E.numRws || len == 0)
+        return;
+
+    int count = 0;
+    for (size_t i = 0; i < len; i++)
+        if (s[i] == '\n')
+            count++;
+    if (s[len - 1] != '\n')
+        count++;
+
+    undoRecord(at, 0, count);
+    journalRecord(J_INSERT_ROWS, at, 0, s, len);
+    int before = rwsOpenGap(at, count);
+
+    char *p = s, *end = s + len;
+    for (int j = at; j < at + count; j++)
+    {
+        char *nl = memchr(p, '\n', end - p);
+        size_t n = nl ? (size_t)(nl - p) : (size_t)(end - p);
+
+        rwsFillGap(j, lineNew(p, n), n);
+        p = nl ? nl + 1 : end;
+    }
+
+    rwsCloseGap(at, count, before);
+}
+
+// Inserts one row per slice before row `at`. A slice covering a whole block
+// becomes a reference to it; only partial slices are copied.
+void insertRwsSlices(int at, struct line_slice *slices, int count)
+{
+    if (at < 0 || at > E.numRws || count <= 0)
+        return;
+
+    undoRecord(at, 0, count);
+    journalRecordSlices(at, slices, count);
+    int before = rwsOpenGap(at, count);
+
+    for (int j = 0; j < count; j++)
+    {
+        struct line_slice *sl = &slices[j];
+        int n = sl->to - sl->from;
+        if (sl->from == 0 && sl->chars[n] == '\0')
+            rwsFillGap(at + j, lineRef(sl->chars), n);
+        else
+            rwsFillGap(at + j, lineNew(&sl->chars[sl->from], n), n);
+    }
+
+    rwsCloseGap(at, count, before);
+}
+
+// Removes `count` rows starting at `at` with a single move of the row array.
+void deleteRwsRange(int at, int count)
+{
+    if (at < 0 || count <= 0 || at + count > E.numRws)
+        return;
+
+    undoRecord(at, count, 0);
+    journalRecord(J_DELETE_ROWS, at, count, NULL, 0);
+    bracketRowsDeleted(at, count);
+    wrapRowsDeleted(at, count);
+    wordsRowsDeleted(at, count);
+
+    int before = E.row[at + count - 1].hl_open_comment;
+    for (int j = at; j < at + count; j++)
+        freeRws(&E.row[j]);
+
+    memmove(&E.row[at], &E.row[at + count], sizeof(erow) * (E.numRws - at - count));
+    E.numRws -= count;
+    for (int j = at; j < E.numRws; j++)
+        E.row[j].idx = j;
+
+    int after = at > 0 ? E.row[at - 1].hl_open_comment : 0;
+    if (at < E.numRws && (before < 0 || before != after))
+    {
+        if (E.row[at].hl)
+            updateSyntax(&E.row[at]);
+        else
+            syntaxInvalidate(at);
+    }
+
+    E.dirty++;
+}
+
 void deleteChar()
 {
     if (E.cy == E.numRws)
@@ -516,8 +904,10 @@ void deleteChar()
     erow *row = &E.row[E.cy];
     if (E.cx > 0)
     {
-        rwsDeleteChar(row, E.cx - 1);
-        E.cx--;
+        // the whole character before the cursor, however many bytes
+        int from = rwsPrevCx(row, E.cx);
+        while (E.cx > from)
+            rwsDeleteChar(row, --E.cx);
     }
     else
     {
@@ -572,7 +962,49 @@ char *get_file_extension(const char *filename)
     return dot + 1;
 }
 
-void open(char *filename)
+// Builds the rows straight from a sidecar index: lines are cut at the saved
+// offsets without scanning for newlines, and nothing is highlighted up front.
+// The saved comment states let any row be highlighted later without lexing
+// the rows above its checkpoint.
+int openIndexed(FILE *file, struct stat *st, struct line_index *idx)
+{
+    char *map = mmap(NULL, st->st_size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+    if (map == MAP_FAILED)
+        return -1;
+
+    E.row = matMalloc(ALLOC_ROWS, sizeof(erow) * idx->lines);
+
+    for (size_t i = 0; i < idx->lines; i++)
+    {
+        char *s = map + idx->offsets[i];
+        size_t len = idx->offsets[i + 1] - idx->offsets[i];
+        while (len > 0 && (s[len - 1] == '\n' || s[len - 1] == '\r'))
+            len--;
+
+        erow *row = &E.row[i];
+        row->idx = i;
+        row->size = len;
+        row->chars = lineNew(s, len);
+
+        row->rsize = 0;
+        row->rwidth = 0;
+        row->hl_open_comment = -1;
+        row->render = NULL;
+        row->hl = NULL;
+
+        updateRender(row);
+    }
+    E.numRws = idx->lines;
+
+    if (idx->states)
+        for (size_t k = 1; k * INDEX_INTERVAL < idx->lines; k++)
+            E.row[k * INDEX_INTERVAL - 1].hl_open_comment = idx->states[k];
+
+    munmap(map, st->st_size);
+    return 0;
+}
+
+void openFile(char *filename)
 {
     selectSyntaxHighlight();
 
@@ -580,21 +1012,77 @@ void open(char *filename)
     if (!file)
         die("file open");
 
-    char *line = NULL;
-    size_t cap = 0;
-    size_t len;
+    struct stat st;
+    struct line_index idx = {0, 0, NULL, NULL};
+    const char *filetype = E.syntax ? E.syntax->filetype : "";
+    int stated = fstat(fileno(file), &st) == 0;
+    int indexed = indexEnabled() && stated && st.st_size >= INDEX_MIN_SIZE;
+
+    if (stated)
+        E.diskMtime = reloadMtime(&st);
 
-    while ((len = getline(&line, &cap, file)) != -1)
+    if (indexed && indexLoad(filename, &st, filetype, &idx) == 0)
     {
-        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+        int loaded = openIndexed(file, &st, &idx) == 0;
+        indexFree(&idx);
+        if (loaded)
         {
-            len--;
+            fclose(file);
+            E.diskSize = st.st_size;
+            E.dirty = 0;
+            return;
+        }
+    }
+
+    if (stated && st.st_size >= LOADER_MIN_SIZE && loaderRead(file, st.st_size, indexed ? &idx : NULL) == 0)
+    {
+        fclose(file);
+        E.diskSize = st.st_size;
+
+        // a chunk that began inside a comment left the rows from it on
+        // unhighlighted; the index needs their states
+        if (indexed && E.numRws > 0)
+            syntaxEnsure(E.numRws - 1);
+    }
+    else
+    {
+        char *line = NULL;
+        size_t cap = 0;
+        ssize_t len;
+        uint64_t offset = 0;
+
+        while ((len = getline(&line, &cap, file)) != -1)
+        {
+            if (indexed)
+                indexAppend(&idx, offset);
+            offset += len;
+
+            while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+                len--;
             insertRws(E.numRws, line, len);
         }
+
+        free(line);
+        fclose(file);
+        E.diskSize = offset;
+
+        if (indexed)
+        {
+            indexAppend(&idx, offset);
+            idx.lines--;
+        }
     }
 
-    free(line);
-    fclose(file);
+    // the whole file was just highlighted, so every checkpoint state is known
+    if (indexed)
+    {
+        idx.states = matMalloc(ALLOC_INDEX, idx.lines / INDEX_INTERVAL + 1);
+        for (size_t k = 0; k * INDEX_INTERVAL < idx.lines; k++)
+            idx.states[k] = k ? E.row[k * INDEX_INTERVAL - 1].hl_open_comment : 0;
+
+        indexStore(filename, &st, filetype, &idx);
+        indexFree(&idx);
+    }
 
     E.dirty = 0;
 }
@@ -606,7 +1094,7 @@ struct config E;
 
 void abAppend(struct abuf *ab, const char *s, int len)
 {
-    char *new = realloc(ab->b, ab->len + len);
+    char *new = matRealloc(ALLOC_FRAME, ab->b, ab->len + len);
     if (new == NULL)
         return;
     memcpy(&new[ab->len], s, len);
@@ -614,17 +1102,35 @@ void abAppend(struct abuf *ab, const char *s, int len)
     ab->len += len;
 }
 
-void abFree(struct abuf *ab) { free(ab->b); }
+void abFree(struct abuf *ab) { matFree(ab->b); }
 
 // output
 void scroll()
 {
+    // the pager moves the view itself
+    if (E.pager)
+    {
+        pagerCursor();
+        return;
+    }
+
+    // E.rx is the cursor's screen column; a cursor left inside a multibyte
+    // character by a vertical move goes to its start
     E.rx = 0;
+    int rxEnd = 1; // the cursor's column, or past it for a wide character
     if (E.cy < E.numRws)
     {
-        E.rx = rwsCxToRx(&E.row[E.cy], E.cx);
+        erow *row = &E.row[E.cy];
+        E.cx = rwsCharStart(row, E.cx);
+        E.rx = rwsCxToCol(row, E.cx);
+        rxEnd = E.rx + 1;
+        if (E.cx < row->size && (unsigned char)row->chars[E.cx] >= 0x80)
+            rxEnd = rwsCxToCol(row, rwsNextCx(row, E.cx));
     }
 
+    if (wrapScroll())
+        return;
+
     if (E.cy < E.rowOff)
     {
         E.rowOff = E.cy;
@@ -634,13 +1140,13 @@ void scroll()
         E.rowOff = E.cy - E.screenRws + 1;
     }
 
-    if (E.cx < E.colOff)
+    if (E.rx < E.colOff)
     {
         E.colOff = E.rx;
     }
-    if (E.cx >= E.colOff + E.screenCls)
+    if (rxEnd > E.colOff + E.screenCls)
     {
-        E.colOff = E.rx - E.screenCls + 1;
+        E.colOff = rxEnd - E.screenCls;
     }
 }
 
@@ -653,8 +1159,9 @@ void setStatusMessage(const char *fmt, ...)
     E.statusmsg_time = time(NULL);
 }
 
-void drawMessage(struct abuf *ab)
+void drawMessage(struct frame *f)
 {
+    struct abuf *ab = &f->ab;
     abAppend(ab, "\x1b[K", 3);
     int msglen = strlen(E.statusmsg);
 
@@ -665,67 +1172,139 @@ void drawMessage(struct abuf *ab)
     {
         abAppend(ab, E.statusmsg, msglen);
     }
+    frameEndLine(f);
+}
+
+// Draws screen columns [from, from + screen width) of a row with their
+// highlighting. filerow is only used to look up selection and bracket marks,
+// which like hl are indexed by render byte. ASCII rows map bytes to columns
+// one to one; other rows are decoded as they are drawn, a wide character cut
+// by either edge showing as blanks.
+void drawSpan(struct abuf *ab, int filerow, const char *render, const unsigned char *hl, int rsize, int from)
+{
+    int ascii = utf8Ascii(render, rsize);
+    int i = 0, col = 0, n = 1, w = 1;
+
+    if (ascii)
+        i = col = from < rsize ? from : rsize;
+    else
+    {
+        for (; i < rsize; i += n, col += w)
+        {
+            n = utf8Char(&render[i], rsize - i, &w);
+            if (col + w > from)
+                break;
+        }
+        if (i < rsize && col < from)
+        {
+            for (int k = from; k < col + w; k++)
+                abAppend(ab, " ", 1);
+            col += w;
+            i += n;
+        }
+    }
+
+    int x = col - from;
+    int current_color = HL_NORMAL;
+
+    for (; i < rsize && x < E.screenCls; i += n, x += w)
+    {
+        if (!ascii)
+            n = utf8Char(&render[i], rsize - i, &w);
+        if (x + w > E.screenCls)
+        {
+            abAppend(ab, " ", 1);
+            break;
+        }
+
+        int hlj = hl[i];
+        if (visualMarked(filerow, i))
+            hlj = HL_VISUAL;
+        else if (bracketMarked(filerow, i))
+            hlj = HL_MATCH;
+        if (hlj == HL_NORMAL)
+        {
+            if (current_color != HL_NORMAL)
+            {
+                abAppend(ab, "\033[39m", 5); // Reset foreground color
+                current_color = HL_NORMAL;
+            }
+        }
+        // syntaxToColor reuses one buffer, so compare classes
+        else if (hlj != current_color)
+        {
+            const char *color = syntaxToColor(hlj);
+            current_color = hlj;
+            abAppend(ab, color, strlen(color));
+        }
+
+        // the pager draws file bytes as they are, which need not be valid
+        if (!ascii && n == 1 && (unsigned char)render[i] >= 0x80)
+            abAppend(ab, UTF8_REPLACEMENT, sizeof(UTF8_REPLACEMENT) - 1);
+        else
+            abAppend(ab, &render[i], n);
+    }
+    if (current_color != HL_NORMAL)
+    {
+
+        abAppend(ab, "\033[39m", 5); // Reset foreground color
+    }
 }
 
-void drawRws(struct abuf *ab)
+void drawRws(struct frame *f)
 {
+    struct abuf *ab = &f->ab;
     int y;
 
     const char *foreground_color = hexToAnsiFore("#1E1D2D");
-    abAppend(ab, foreground_color, strlen(foreground_color)); // Set the global background color
+
+    // with soft wrap on, seg is the screen line of filerow being drawn
+    int wrap = wrapOn() && !E.pager;
+    int filerow = E.rowOff;
+    int seg = wrap ? E.wrapOff : 0;
+    int numRws = E.pager ? pagerScreenLines() : E.numRws;
 
     for (y = 0; y < E.screenRws; y++)
     {
-        int filerow = y + E.rowOff;
-        if (filerow >= E.numRws)
+        // every line sets its own colors, it may be sent on its own
+        abAppend(ab, foreground_color, strlen(foreground_color));
+
+        if (filerow >= numRws)
         {
             abAppend(ab, "~", 1);
         }
+        else if (E.pager)
+        {
+            pagerDrawRow(ab, filerow);
+        }
         else
         {
-            int len = E.row[filerow].rsize - E.colOff;
-            if (len < 0)
-                len = 0;
-            if (len > E.screenCls)
-                len = E.screenCls;
-
-            char *c = &E.row[filerow].render[E.colOff];
-            unsigned char *hl = &E.row[filerow].hl[E.colOff];
-            const char *current_color = NULL;
+            syntaxEnsure(filerow);
 
-            for (int j = 0; j < len; j++)
-            {
-                if (hl[j] == HL_NORMAL)
-                {
-                    if (current_color != NULL)
-                    {
-                        abAppend(ab, "\033[39m", 5); // Reset foreground color
-                        current_color = NULL;
-                    }
-                    abAppend(ab, &c[j], 1);
-                }
-                else
-                {
-                    const char *color = syntaxToColor(hl[j]);
-                    if (color != current_color)
-                    {
-                        current_color = color;
-                        abAppend(ab, color, strlen(color));
-                    }
-                    abAppend(ab, &c[j], 1);
-                }
-            }
-            if (current_color != NULL)
-            {
-
-                abAppend(ab, "\033[39m", 5); // Reset foreground color
-            }
+            erow *row = &E.row[filerow];
+            drawSpan(ab, filerow, row->render, row->hl, row->rsize, wrap ? seg * E.screenCls : E.colOff);
         }
 
-        abAppend(ab, "\x1b[K", 3); // Clear to the end of the line
-        abAppend(ab, "\r\n", 2);   // New line
+        abAppend(ab, "\x1b[K", 3);  // Clear to the end of the line
+        abAppend(ab, "\x1b[0m", 4); // Reset all attributes
+        completeDraw(ab, y);
+        frameEndLine(f);
+
+        if (wrap && filerow < E.numRws && ++seg < wrapCount(&E.row[filerow]))
+            continue;
+        filerow++;
+        seg = 0;
     }
-    abAppend(ab, "\x1b[0m", 4); // Reset all attributes at the end
+}
+
+// highlighting of the row the incremental search marked, put back before
+// the next keystroke
+static int saved_hl_line;
+static char *saved_hl = NULL;
+
+size_t searchMemory()
+{
+    return matSize(saved_hl);
 }
 
 void searchCallback(char *query, int key)
@@ -733,13 +1312,10 @@ void searchCallback(char *query, int key)
     static int last_match = -1;
     static int direction = 1;
 
-    static int saved_hl_line;
-    static char *saved_hl = NULL;
-
     if (saved_hl)
     {
         memcpy(E.row[saved_hl_line].hl, saved_hl, E.row[saved_hl_line].rsize);
-        free(saved_hl);
+        matFree(saved_hl);
         saved_hl = NULL;
     }
 
@@ -760,8 +1336,9 @@ void searchCallback(char *query, int key)
             E.cx = rwsRxToCx(row, match - row->render);
             E.rowOff = E.numRws;
 
+            syntaxEnsure(i);
             saved_hl_line = i;
-            saved_hl = malloc(row->rsize);
+            saved_hl = matMalloc(ALLOC_SEARCH, row->rsize);
 
             memcpy(saved_hl, row->hl, row->rsize);
 
@@ -782,7 +1359,7 @@ void search()
     char *query = prompt("/", searchCallback);
 
     if (query)
-        free(query);
+        matFree(query);
     else
     {
         E.cy = saved_cy;
@@ -797,17 +1374,36 @@ void save()
     if (E.current_file_name == NULL)
         return;
 
+    if (E.pager)
+    {
+        pagerSave();
+        return;
+    }
+
     if (E.dirty)
     {
         char *response = prompt("File not saved. Save? (y/n) ", NULL);
         if (strcmp(response, "y") != 0)
         {
-            free(response);
+            matFree(response);
             return;
         }
         selectSyntaxHighlight();
     }
 
+    // another program rewrote the file since it was read
+    if (reloadChanged())
+    {
+        char *response = prompt("File changed on disk. Overwrite? (y/n) %s", NULL);
+        int overwrite = response && strcmp(response, "y") == 0;
+        matFree(response);
+        if (!overwrite)
+        {
+            setStatusMessage("Not saved, :reload loads the file from disk");
+            return;
+        }
+    }
+
     int len;
     char *buf = rwsToString(&len);
 
@@ -828,40 +1424,67 @@ void save()
     free(buf);
     fclose(file);
 
+    struct stat st;
+    if (stat(E.current_file_name, &st) == 0)
+    {
+        E.diskSize = st.st_size;
+        E.diskMtime = reloadMtime(&st);
+    }
+
     setStatusMessage("File saved: %s", E.current_file_name);
     E.dirty = 0;
+    journalReset(E.current_file_name);
 }
 
 void refreshScreen()
 {
+    // the terminal is still taking the last frame; this one would be stale
+    // before it got there, so it is drawn once the output drains instead
+    if (outputBusy())
+        return;
+
     scroll();
+    bracketScopeUpdate();
+    visualUpdate();
+
+    int wrap = wrapOn() && !E.pager;
+    int cursorY = E.cy - E.rowOff, cursorX = E.rx - E.colOff;
+    if (wrap)
+        wrapCursor(&cursorY, &cursorX);
+    completePlace(cursorY, cursorX);
+
+    struct frame frame = {ABUF_INIT, NULL, 0};
+    drawRws(&frame);
+    drawStatus(&frame);
+    drawMessage(&frame);
 
     struct abuf ab = ABUF_INIT;
-    abAppend(&ab, "\x1b[?25l", 6);
-    abAppend(&ab, "\x1b[H", 3);
-    drawRws(&ab);
-    drawStatus(&ab);
-    drawMessage(&ab);
+    screenBegin(&ab);
+    screenPresent(&ab, &frame, wrap ? wrapTopLine() : E.rowOff);
+    frameFree(&frame);
 
     char buf[32];
-    snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (E.cy - E.rowOff) + 1,
-             (E.rx - E.colOff) + 1);
+    snprintf(buf, sizeof(buf), "\x1b[%d;%dH", cursorY + 1, cursorX + 1);
 
     abAppend(&ab, buf, strlen(buf));
+    screenEnd(&ab);
 
-    abAppend(&ab, "\x1b[?25h", 6);
-
-    write(STDOUT_FILENO, ab.b, ab.len);
+    outputWrite(ab.b, ab.len);
     abFree(&ab);
 }
 
 // input
+
+// nonzero while prompt() waits for its answer
+static int prompting;
+
 char *prompt(char *prompt, void (*callback)(char *, int))
 {
     E.current_mode = INSERT;
+    prompting++;
 
     size_t bufsize = 128;
-    char *buf = malloc(bufsize);
+    char *buf = matMalloc(ALLOC_PROMPT, bufsize);
 
     size_t buflen = 0;
     buf[0] = '\0';
@@ -874,8 +1497,12 @@ char *prompt(char *prompt, void (*callback)(char *, int))
         int c = readKey();
         if (c == BACKSPACE)
         {
+            // a whole character: continuation bytes, then the byte they follow
+            while (buflen != 0 && (buf[buflen - 1] & 0xc0) == 0x80)
+                buflen--;
             if (buflen != 0)
-                buf[--buflen] = '\0';
+                buflen--;
+            buf[buflen] = '\0';
         }
         else if (c == '\x1b')
         {
@@ -886,7 +1513,8 @@ char *prompt(char *prompt, void (*callback)(char *, int))
             if (callback)
                 callback(buf, c);
 
-            free(buf);
+            matFree(buf);
+            prompting--;
             return NULL;
         }
         else if (c == '\r')
@@ -900,15 +1528,16 @@ char *prompt(char *prompt, void (*callback)(char *, int))
                 if (callback)
                     callback(buf, c);
 
+                prompting--;
                 return buf;
             }
         }
-        else if (!iscntrl(c) && c < 128)
+        else if (c >= 0 && !iscntrl(c))
         {
             if (buflen == bufsize - 1)
             {
                 bufsize *= 2;
-                buf = realloc(buf, bufsize);
+                buf = matRealloc(ALLOC_PROMPT, buf, bufsize);
             }
 
             buf[buflen++] = c;
@@ -928,6 +1557,8 @@ void moveCursor(int key)
     {
 
     case KEY_K: // UP
+        if (wrapVertical(-1))
+            break;
         if (E.cy != 0)
         {
             E.cy--;
@@ -940,6 +1571,8 @@ void moveCursor(int key)
         break;
 
     case KEY_J: // DOWN
+        if (wrapVertical(1))
+            break;
         if (E.cy < E.numRws)
         {
             E.cy++;
@@ -949,14 +1582,14 @@ void moveCursor(int key)
     case KEY_H: // LEFT
         if (E.cx != 0)
         {
-            E.cx--;
+            E.cx = rwsPrevCx(row, E.cx);
         }
         break;
 
     case KEY_L: // RIGHT
         if (row && E.cx < row->size)
         {
-            E.cx++;
+            E.cx = rwsNextCx(row, E.cx);
         }
         else if (row && E.cx == row->size)
         {
@@ -973,6 +1606,74 @@ void moveCursor(int key)
     }
 }
 
+// called by readKey whenever it times out waiting for input
+void idleTick()
+{
+    if (windowResized)
+    {
+        windowResized = 0;
+        handleWindowSizeChange();
+    }
+    journalSync(E.journal, 0);
+
+    // rows must not change under a prompt, search keeps pointers into them
+    if (!prompting && E.current_mode == NORMAL)
+    {
+        reloadPoll();
+        filterPoll();
+    }
+    if (!prompting)
+        serverPoll();
+}
+
+// Opens the files of a command line and shows the first one. Files after -R
+// open in the read-only pager, files after -x as bytes, and +N goes to line
+// N of the first file.
+void openArgs(int argc, char *argv[])
+{
+    int line = 0, readonly = 0, hex = 0, first = -1;
+    for (int i = 1; i < argc; i++)
+    {
+        int opened = -1;
+        if (argv[i][0] == '+')
+            line = atoi(argv[i] + 1);
+        else if (strcmp(argv[i], "-R") == 0 || strcmp(argv[i], "-x") == 0)
+        {
+            readonly = argv[i][1] == 'R';
+            hex = argv[i][1] == 'x';
+        }
+        else if (strcmp(argv[i], "-") == 0)
+        {
+            streamOpen();
+            opened = B.current;
+        }
+        else if (hex)
+            opened = pagerOpenHex(argv[i]) == 0 ? B.current : -1;
+        else if (readonly)
+            opened = pagerOpen(argv[i]) == 0 ? B.current : -1;
+        else
+            opened = bufferOpen(argv[i]);
+
+        if (first == -1)
+            first = opened;
+    }
+    if (first == -1)
+        return;
+    bufferSwitch(first);
+
+    // rows above line N are only lexed back to a checkpoint
+    if (line > 0 && E.pager)
+        pagerGotoLine(line);
+    else if (line > 0)
+    {
+        E.cy = line > E.numRws ? E.numRws : line - 1;
+        E.rowOff = E.cy > E.screenRws / 2 ? E.cy - E.screenRws / 2 : 0;
+    }
+
+    if (E.current_file_name)
+        setStatusMessage("%s", E.current_file_name);
+}
+
 // init
 void init()
 {
@@ -998,25 +1699,45 @@ void init()
         die("getWindowSize");
     }
 
-    signal(SIGWINCH, handleWindowSizeChange);
+    initSyntax();
+
+    signal(SIGWINCH, onWindowResize);
 
     E.screenRws -= 2;
 }
 
 int main(int argc, char *argv[])
 {
+#ifdef MAT_ALLOC_STATS
+    atexit(allocReportAtExit);
+#endif
+    // `mat -s` hands its command line to a server, starting one when none is
+    // running; of the processes that makes, only the server's editor goes on
+    // from here, and it gets its files from the client
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-s") == 0)
+        {
+            int status = serverMain(argc, argv);
+            if (status != SERVER_EDITOR)
+                return status;
+            argc = 1;
+        }
+    }
+
+    // `mat -` reads stdin, so keys have to come from the terminal instead
+    for (int i = 1; i < argc; i++)
+        if (strcmp(argv[i], "-") == 0)
+            streamAttach();
+
     enableRawMode();
     init();
+    screenDetect();
+    outputInit();
 
-    if (argc >= 2)
-    {
-        E.current_file_name = argv[1];
-
-        open(E.current_file_name);
-        E.current_file_extension = get_file_extension(E.current_file_name);
-    }
+    initBuffers();
 
-    setStatusMessage("%s", E.current_file_name);
+    openArgs(argc, argv);
 
     while (1)
     {
@@ -1,39 +1,65 @@
 #pragma once
 
+#include "alloc.h"
 #include "input.h"
+#include "line.h"
 #include <termios.h>
 #include <time.h>
 
+// the nanosecond file times, which macOS names after the timespec
+#ifdef __APPLE__
+#define st_mtim st_mtimespec
+#define st_ctim st_ctimespec
+#endif
+
 void moveCursor(int key);
 void search();
+size_t searchMemory();
 void deleteChar();
 void insertNewLine();
 void insertChar(int c);
 void save();
 void die(const char *s);
+void refreshScreen();
+void setStatusMessage(const char *fmt, ...);
+char *prompt(char *prompt, void (*callback)(char *, int));
 
 typedef struct erow
 {
     int idx;
     int size;
     int rsize;
+    int rwidth; // screen columns of render; equal to rsize only for ASCII rows
     char *chars;
     char *render;
     unsigned char *hl;
     int hl_open_comment;
 } erow;
 
+// A row that is not plain ASCII keeps, after the NUL of its render block, a
+// mark for every RENDER_STEP bytes of text: where the character holding the
+// stretch's first byte starts, in chars, in render and on screen.
+#define RENDER_STEP 64
+#define RENDER_MARKS(rsize) (((size_t)(rsize) + sizeof(int)) / sizeof(int) * sizeof(int))
+
+struct render_mark
+{
+    int cx, rx, col;
+};
+
 enum mode
 {
     NORMAL,
     INSERT,
-    VISUAL
+    VISUAL,
+    VISUAL_LINE
 };
 
 struct config
 {
     int cx, cy, rx;
     int rowOff, colOff;
+    int vx, vy; // visual mode anchor
     int screenRws, screenCls;
     int numRws;
     erow *row;
@@ -44,11 +70,20 @@ struct config
 
     char *current_file_extension;
     char *current_file_name;
+    long long diskSize; // the file as last read or written
+    long long diskMtime; // in nanoseconds, see reloadMtime
 
     char statusmsg[80];
     time_t statusmsg_time;
 
     struct syntax *syntax;
+    struct journal *journal;
+    struct rowtree *brackets;
+    struct undo *undo;
+    struct rowtree *wraps;
+    int wrapWidth, wrapOff;
+    struct words *words; // identifiers for completion, see words.c
+    struct pager *pager; // rows served from the file itself, see pager.c
     struct termios orig_termios;
 };
 
@@ -59,3 +94,49 @@ struct abuf
 };
 
 void abAppend(struct abuf *ab, const char *s, int len);
+void abFree(struct abuf *ab);
+void drawSpan(struct abuf *ab, int filerow, const char *render, const unsigned char *hl, int rsize, int from);
+
+// a frame being composed: its text and where each screen line of it ends
+struct frame
+{
+    struct abuf ab;
+    int *ends;
+    int lines;
+};
+
+void insertRws(int at, char *s, size_t len);
+void deleteRws(int at);
+void rwsInsertChar(erow *row, int at, int c);
+void rwsDeleteChar(erow *row, int at);
+void rwsAppendString(erow *row, char *s, size_t len);
+void rwsTruncate(erow *row, int at);
+void rwsInsertString(erow *row, int at, char *s, size_t len);
+void rwsDeleteSpan(erow *row, int at, int len);
+void rwsSetLine(erow *row, char *chars, int size);
+void insertRwsBlock(int at, char *s, size_t len);
+void insertRwsSlices(int at, struct line_slice *slices, int count);
+void deleteRwsRange(int at, int count);
+void idleTick();
+void openArgs(int argc, char *argv[]);
+
+int syntaxLexRow(erow *row, int in_comment);
+void syntaxInvalidate(int from);
+void syntaxEnsure(int at);
+void updateSyntax(erow *row);
+size_t rwsRenderBytes(erow *row);
+int rwsCxToRx(erow *row, int cx);
+int rwsRxToCx(erow *row, int rx);
+int rwsRxToCol(erow *row, int rx);
+int rwsColToRx(erow *row, int col);
+int rwsCxToCol(erow *row, int cx);
+int rwsColToCx(erow *row, int col);
+int rwsNextCx(erow *row, int cx);
+int rwsPrevCx(erow *row, int cx);
+int rwsCharStart(erow *row, int cx);
+
+void updateRender(erow *row);
+void updateRws(erow *row);
+void openFile(char *filename);
+char *get_file_extension(const char *filename);
+void selectSyntaxHighlight();
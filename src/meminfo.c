@@ -0,0 +1,139 @@
+#include "meminfo.h"
+#include "alloc.h"
+#include "buffer.h"
+#include "mat.h"
+#include "output.h"
+#include "pager.h"
+#include "rowtree.h"
+#include "screen.h"
+#include "undo.h"
+#include "words.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+extern struct config E;
+
+// Sizes are what the allocator set aside, from allocUsable, so slack
+// inside blocks is counted where it sits; the few bytes of chunk header per
+// block are not.
+struct meminfo
+{
+    long long lines;
+    size_t chars, render, hl, erow, spare, trees, words, pager, search, frame, output;
+    size_t shared;                      // rows whose text a register or undo holds too
+    size_t renderSame, hlHidden, slack; // reclaimable
+};
+
+static void meminfoMeasure(struct meminfo *m)
+{
+    memset(m, 0, sizeof(*m));
+    m->lines = E.pager ? pagerLines() : E.numRws;
+
+    for (int i = 0; i < E.numRws; i++)
+    {
+        erow *row = &E.row[i];
+        size_t chars = lineBytes(row->chars);
+        size_t render = matSize(row->render);
+        size_t hl = matSize(row->hl);
+
+        m->chars += chars;
+        m->render += render;
+        m->hl += hl;
+        if (lineShared(row->chars))
+            m->shared++;
+
+        // without tabs the render is a copy of the text, and highlighting
+        // off screen is lexed again when it is next drawn; slack is only
+        // counted for blocks that are kept
+        m->slack += lineSlack(row->chars, row->size);
+        if (row->rsize == row->size)
+            m->renderSame += render;
+        else if (row->render)
+            m->slack += render - rwsRenderBytes(row);
+        if (i < E.rowOff || i >= E.rowOff + E.screenRws)
+            m->hlHidden += hl;
+        else if (row->hl)
+            m->slack += hl - row->rsize;
+    }
+
+    m->erow = sizeof(erow) * E.numRws;
+    m->spare = E.row ? matSize(E.row) - m->erow : 0;
+    m->trees = rowtreeMemory(E.brackets) + rowtreeMemory(E.wraps);
+    m->words = wordsMemory(E.words);
+    m->pager = pagerMemory();
+    m->search = searchMemory();
+    m->frame = screenMemory();
+    m->output = outputMemory();
+}
+
+static void meminfoPrintf(struct abuf *ab, const char *fmt, ...)
+{
+    char line[128];
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    if (len >= (int)sizeof(line))
+        len = sizeof(line) - 1;
+    abAppend(ab, line, len);
+}
+
+// lines is 0 for memory that does not grow with the buffer
+static void meminfoRow(struct abuf *ab, const char *what, size_t bytes, long long lines, const char *note)
+{
+    if (lines)
+        meminfoPrintf(ab, "%-22s %12zu %10.1f  %s\n", what, bytes, (double)bytes / lines, note);
+    else
+        meminfoPrintf(ab, "%-22s %12zu %10s  %s\n", what, bytes, "", note);
+}
+
+// Breaks down what the current buffer costs and opens the report in a new
+// buffer of its own.
+void meminfoReport()
+{
+    struct meminfo m;
+    meminfoMeasure(&m);
+
+    struct abuf ab = {NULL, 0};
+    char shared[48];
+    snprintf(shared, sizeof(shared), "%zu rows shared with registers/undo", m.shared);
+
+    size_t buffer = m.chars + m.render + m.hl + m.erow + m.spare + m.trees + m.words + m.pager;
+    size_t editor = m.search + m.frame + m.output;
+    size_t reclaim = m.renderSame + m.hlHidden + m.spare + m.slack;
+
+    meminfoPrintf(&ab, "memory for %s, %lld lines\n\n", E.current_file_name ? E.current_file_name : "[No Name]",
+                  m.lines);
+    meminfoPrintf(&ab, "%-22s %12s %10s\n", "", "bytes", "per line");
+    meminfoRow(&ab, "chars", m.chars, m.lines, shared);
+    meminfoRow(&ab, "render", m.render, m.lines, "");
+    meminfoRow(&ab, "hl", m.hl, m.lines, "");
+    meminfoRow(&ab, "erow structs", m.erow, m.lines, "");
+    meminfoRow(&ab, "row array spare", m.spare, m.lines, "");
+    meminfoRow(&ab, "bracket/wrap trees", m.trees, m.lines, "");
+    meminfoRow(&ab, "word index", m.words, m.lines, E.words ? "" : "built on first completion");
+    if (E.pager)
+        meminfoRow(&ab, "pager index", m.pager, m.lines, "file pages not counted");
+    meminfoRow(&ab, "buffer total", buffer, m.lines, "");
+    meminfoPrintf(&ab, "\nshared by all buffers\n");
+    meminfoRow(&ab, "search save", m.search, 0, "");
+    meminfoRow(&ab, "frame", m.frame, 0, "screen model");
+    meminfoRow(&ab, "output queue", m.output, 0, "");
+    meminfoRow(&ab, "total", buffer + editor, m.lines, "");
+
+    meminfoPrintf(&ab, "\nreclaimable, about %zu bytes (%.0f%% of the buffer)\n", reclaim,
+                  buffer ? 100.0 * reclaim / buffer : 0.0);
+    meminfoRow(&ab, "render same as chars", m.renderSame, m.lines, "rows without tabs");
+    meminfoRow(&ab, "hl off screen", m.hlHidden, m.lines, "lexed again when drawn");
+    meminfoRow(&ab, "row array spare", m.spare, m.lines, "");
+    meminfoRow(&ab, "block slack", m.slack, m.lines, "allocated past the text");
+
+    bufferNew();
+    undoSuspend(1);
+    insertRwsBlock(0, ab.b, ab.len);
+    undoSuspend(0);
+    E.dirty = 0;
+    abFree(&ab);
+}
@@ -0,0 +1,186 @@
+#include "motion.h"
+#include "mat.h"
+#include "wrap.h"
+
+#include <ctype.h>
+
+extern struct config E;
+
+// Motions compute their target straight from the row array instead of
+// stepping the cursor, so a count or a jump costs the same however far it
+// goes. scroll() then moves the view once to follow the cursor.
+
+static int motionLastRow()
+{
+    return E.numRws > 0 ? E.numRws - 1 : 0;
+}
+
+static void motionClampX()
+{
+    int rowlen = E.cy < E.numRws ? E.row[E.cy].size : 0;
+    if (E.cx > rowlen)
+        E.cx = rowlen;
+    if (E.cx < 0)
+        E.cx = 0;
+    // a column kept from another row can fall inside a character here
+    if (E.cy < E.numRws)
+        E.cx = rwsCharStart(&E.row[E.cy], E.cx);
+}
+
+void motionVertical(int n)
+{
+    if (wrapVertical(n))
+        return;
+
+    E.cy += n;
+    if (E.cy > motionLastRow())
+        E.cy = motionLastRow();
+    if (E.cy < 0)
+        E.cy = 0;
+    motionClampX();
+}
+
+void motionHorizontal(int n)
+{
+    // n characters, not bytes
+    if (E.cy < E.numRws)
+    {
+        erow *row = &E.row[E.cy];
+        for (; n > 0 && E.cx < row->size; n--)
+            E.cx = rwsNextCx(row, E.cx);
+        for (; n < 0 && E.cx > 0; n++)
+            E.cx = rwsPrevCx(row, E.cx);
+    }
+    motionClampX();
+}
+
+// line is 1-based; 0 means the last line
+void motionGotoLine(int line)
+{
+    E.cy = line > 0 ? line - 1 : motionLastRow();
+    if (E.cy > motionLastRow())
+        E.cy = motionLastRow();
+    E.cx = 0;
+
+    // center the target when it is off screen
+    if (E.cy < E.rowOff || E.cy >= E.rowOff + E.screenRws)
+        E.rowOff = E.cy > E.screenRws / 2 ? E.cy - E.screenRws / 2 : 0;
+    E.wrapOff = 0;
+}
+
+// moves cursor and view together by n rows, as for page up and down
+void motionScroll(int n)
+{
+    if (wrapScrollBy(n))
+        return;
+
+    E.rowOff += n;
+    if (E.rowOff > motionLastRow())
+        E.rowOff = motionLastRow();
+    if (E.rowOff < 0)
+        E.rowOff = 0;
+    motionVertical(n);
+}
+
+// 0 for blanks and line ends, 1 for word characters, 2 for punctuation
+static int motionClass(int y, int x)
+{
+    if (y >= E.numRws || x >= E.row[y].size)
+        return 0;
+
+    unsigned char c = E.row[y].chars[x];
+    if (isspace(c))
+        return 0;
+    if (isalnum(c) || c == '_' || c >= 0x80)
+        return 1;
+    return 2;
+}
+
+// Positions run from 0 to size in every row, size standing for the line end,
+// and step over whole characters.
+static int motionNext(int *y, int *x)
+{
+    if (*x < E.row[*y].size)
+        *x = rwsNextCx(&E.row[*y], *x);
+    else if (*y + 1 < E.numRws)
+    {
+        (*y)++;
+        *x = 0;
+    }
+    else
+        return 0;
+    return 1;
+}
+
+static int motionPrev(int *y, int *x)
+{
+    if (*x > 0)
+        *x = rwsPrevCx(&E.row[*y], *x);
+    else if (*y > 0)
+    {
+        (*y)--;
+        *x = E.row[*y].size;
+    }
+    else
+        return 0;
+    return 1;
+}
+
+static void motionWordForward(int *y, int *x)
+{
+    int cls = motionClass(*y, *x);
+    if (cls != 0)
+        while (motionClass(*y, *x) == cls && motionNext(y, x))
+            ;
+    while (motionClass(*y, *x) == 0 && motionNext(y, x))
+        ;
+}
+
+static void motionWordEnd(int *y, int *x)
+{
+    motionNext(y, x);
+    while (motionClass(*y, *x) == 0 && motionNext(y, x))
+        ;
+
+    int cls = motionClass(*y, *x);
+    int ny = *y, nx = *x;
+    while (motionNext(&ny, &nx) && motionClass(ny, nx) == cls)
+    {
+        *y = ny;
+        *x = nx;
+    }
+}
+
+static void motionWordBack(int *y, int *x)
+{
+    motionPrev(y, x);
+    while (motionClass(*y, *x) == 0 && motionPrev(y, x))
+        ;
+
+    int cls = motionClass(*y, *x);
+    int py = *y, px = *x;
+    while (motionPrev(&py, &px) && motionClass(py, px) == cls)
+    {
+        *y = py;
+        *x = px;
+    }
+}
+
+void motionWord(int key, int n)
+{
+    if (E.cy >= E.numRws)
+        return;
+
+    int y = E.cy, x = E.cx;
+    while (n-- > 0)
+    {
+        if (key == 'w')
+            motionWordForward(&y, &x);
+        else if (key == 'e')
+            motionWordEnd(&y, &x);
+        else
+            motionWordBack(&y, &x);
+    }
+    E.cy = y;
+    E.cx = x;
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+void motionVertical(int n);
+void motionHorizontal(int n);
+void motionGotoLine(int line);
+void motionScroll(int n);
+void motionWord(int key, int n);
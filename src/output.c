@@ -0,0 +1,136 @@
+#include "output.h"
+#include "alloc.h"
+#include "event.h"
+#include "mat.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+
+// Frames leave through a non-blocking descriptor, so a congested link never
+// stalls the editor inside write(). Bytes the terminal has not taken yet wait
+// in a queue that the event loop drains. No frame is composed while it is
+// draining; the first one after it empties is diffed against the screen
+// model, which counts everything queued as already shown, so the terminal
+// catches up with one frame however many were skipped.
+static struct
+{
+    int fd;
+    char *buf;
+    size_t off, len, cap;
+    int deferred; // a frame was skipped while the queue drained
+} OUT = {STDOUT_FILENO, NULL, 0, 0, 0, 0};
+
+// The terminal gets a descriptor of its own so O_NONBLOCK is not shared with
+// stdin, whose reads rely on VTIME, or left on the shell's terminal at exit.
+void outputInit()
+{
+    if (!isatty(STDOUT_FILENO))
+        return;
+
+    int fd = open("/dev/tty", O_WRONLY | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (fd != -1)
+        OUT.fd = fd;
+}
+
+size_t outputPending()
+{
+    return OUT.len - OUT.off;
+}
+
+static void outputWritable(int fd, short revents, void *arg);
+
+// writes as much of the queue as the terminal takes without blocking
+static void outputTry()
+{
+    while (OUT.off < OUT.len)
+    {
+        ssize_t n = write(OUT.fd, OUT.buf + OUT.off, OUT.len - OUT.off);
+        if (n > 0)
+            OUT.off += n;
+        else if (n == -1 && errno == EINTR)
+            continue;
+        else if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        else
+            OUT.off = OUT.len; // the terminal is gone, nobody to show it to
+    }
+
+    if (OUT.off == OUT.len)
+    {
+        OUT.off = OUT.len = 0;
+        eventWatch(OUT.fd, 0, NULL, NULL);
+    }
+    else
+        eventWatch(OUT.fd, POLLOUT, outputWritable, NULL);
+}
+
+static void outputWritable(int fd, short revents, void *arg)
+{
+    (void)fd;
+    (void)revents;
+    (void)arg;
+
+    outputTry();
+    if (outputPending() == 0 && OUT.deferred)
+    {
+        OUT.deferred = 0;
+        refreshScreen();
+    }
+}
+
+void outputWrite(const char *s, size_t len)
+{
+    if (OUT.off > 0 && OUT.len + len > OUT.cap)
+    {
+        memmove(OUT.buf, OUT.buf + OUT.off, OUT.len - OUT.off);
+        OUT.len -= OUT.off;
+        OUT.off = 0;
+    }
+    if (OUT.len + len > OUT.cap)
+    {
+        size_t cap = OUT.cap ? OUT.cap : 4096;
+        while (cap < OUT.len + len)
+            cap *= 2;
+        char *buf = matRealloc(ALLOC_FRAME, OUT.buf, cap);
+        if (buf == NULL)
+            return;
+        OUT.buf = buf;
+        OUT.cap = cap;
+    }
+
+    memcpy(OUT.buf + OUT.len, s, len);
+    OUT.len += len;
+    outputTry();
+}
+
+// True while an earlier frame is still on its way out. The caller skips its
+// frame and one is drawn as soon as the queue empties.
+int outputBusy()
+{
+    if (outputPending() == 0)
+        return 0;
+
+    OUT.deferred = 1;
+    return 1;
+}
+
+// blocks until everything queued has been written
+void outputFlush()
+{
+    outputTry();
+    while (outputPending() > 0)
+    {
+        struct pollfd p = {OUT.fd, POLLOUT, 0};
+        if (poll(&p, 1, -1) == -1 && errno != EINTR)
+            break;
+        outputTry();
+    }
+}
+
+size_t outputMemory()
+{
+    return matSize(OUT.buf);
+}
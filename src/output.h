@@ -0,0 +1,10 @@
+#pragma once
+
+#include <stddef.h>
+
+void outputInit();
+void outputWrite(const char *s, size_t len);
+size_t outputPending();
+int outputBusy();
+void outputFlush();
+size_t outputMemory();
@@ -0,0 +1,456 @@
+#include "pager.h"
+#include "alloc.h"
+#include "buffer.h"
+#include "hex.h"
+#include "index.h"
+#include "lexer.h"
+#include "mat.h"
+#include "syntax.h"
+#include "utf8.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+extern struct config E;
+extern int MAT_TABSTOP;
+
+// A read-only view of a mapped file. Rows are never materialized: the line
+// index gives each line's offset, 8 bytes a line, and a line is expanded
+// and highlighted into one scratch buffer only while it is being drawn. The
+// buffer's E.numRws stays 0, so nothing that walks rows ever sees it.
+struct pager
+{
+    char *map;
+    size_t size;
+    struct line_index idx;
+    size_t known; // checkpoints in idx.states whose comment state is known
+
+    // comment state at the start of row lexRow, so drawing consecutive rows
+    // lexes each only once
+    size_t lexRow;
+    int lexState;
+
+    char *render;
+    unsigned char *hl;
+    int cap;
+
+    char *query; // last search, repeated by n
+
+    struct hexview *hex; // rows of bytes instead of lines, see hex.c
+};
+
+long long pagerLines()
+{
+    if (E.pager == NULL)
+        return 0;
+    return E.pager->hex ? hexRows(E.pager->hex) : (long long)E.pager->idx.lines;
+}
+
+// the line the view is at, for the status bar
+long long pagerPosition()
+{
+    return E.pager->hex ? hexRow(E.pager->hex) : E.cy;
+}
+
+// lines drawRws may ask for from E.rowOff; the hex view keeps its own top
+int pagerScreenLines()
+{
+    return E.pager->hex ? hexScreenRows(E.pager->hex) : (int)E.pager->idx.lines;
+}
+
+// the line index and scratch rows; the mapping itself is page cache
+size_t pagerMemory()
+{
+    struct pager *p = E.pager;
+    if (p == NULL)
+        return 0;
+    return matSize(p) + matSize(p->idx.offsets) + matSize(p->idx.states) + matSize(p->render) + matSize(p->hl) +
+           matSize(p->query) + (p->hex ? hexMemory(p->hex) : 0);
+}
+
+static const char *pagerLine(struct pager *p, size_t i, int *len)
+{
+    const char *s = p->map + p->idx.offsets[i];
+    size_t n = p->idx.offsets[i + 1] - p->idx.offsets[i];
+    while (n > 0 && (s[n - 1] == '\n' || s[n - 1] == '\r'))
+        n--;
+    *len = n;
+    return s;
+}
+
+// expands tabs of line i into the scratch buffer, returning its width
+static int pagerRender(struct pager *p, size_t i)
+{
+    int len;
+    const char *s = pagerLine(p, i, &len);
+
+    int tabs = 0;
+    for (int j = 0; j < len; j++)
+        if (s[j] == '\t')
+            tabs++;
+
+    int need = len + tabs * (MAT_TABSTOP - 1) + 1;
+    if (need > p->cap)
+    {
+        p->cap = need;
+        p->render = matRealloc(ALLOC_RENDER, p->render, need);
+        p->hl = matRealloc(ALLOC_HL, p->hl, need);
+    }
+
+    // bytes are copied as they are, but tab stops go by screen column
+    int idx = 0, col = 0;
+    for (int j = 0; j < len; j++)
+    {
+        if (s[j] == '\t')
+        {
+            do
+            {
+                p->render[idx++] = ' ';
+            } while (++col % MAT_TABSTOP != 0);
+        }
+        else if ((unsigned char)s[j] < 0x80)
+        {
+            p->render[idx++] = s[j];
+            col++;
+        }
+        else
+        {
+            int w;
+            int n = utf8Char(&s[j], len - j, &w);
+            memcpy(&p->render[idx], &s[j], n);
+            idx += n;
+            col += w;
+            j += n - 1;
+        }
+    }
+    return idx;
+}
+
+// highlights the rendered line i, returning the comment state it ends in
+static int pagerLex(struct pager *p, int rsize, int state)
+{
+    memset(p->hl, HL_NORMAL, rsize);
+    if (E.syntax == NULL)
+        return 0;
+    return lexerRun(E.syntax->lexer, p->render, rsize, p->hl, state);
+}
+
+// Comment state at the start of line i. Checkpoints are filled in the first
+// time the view passes them, and lexing starts from the nearest one, or from
+// the line drawn last when that is closer.
+static int pagerState(struct pager *p, size_t i)
+{
+    if (E.syntax == NULL)
+        return 0;
+
+    size_t k = i / INDEX_INTERVAL;
+    while (p->known <= k)
+    {
+        size_t from = (p->known - 1) * INDEX_INTERVAL;
+        int state = p->idx.states[p->known - 1];
+        for (size_t j = from; j < from + INDEX_INTERVAL; j++)
+            state = pagerLex(p, pagerRender(p, j), state);
+        p->idx.states[p->known++] = state;
+    }
+
+    size_t from = k * INDEX_INTERVAL;
+    int state = p->idx.states[k];
+    if (p->lexRow <= i && p->lexRow >= from)
+    {
+        from = p->lexRow;
+        state = p->lexState;
+    }
+    for (size_t j = from; j < i; j++)
+        state = pagerLex(p, pagerRender(p, j), state);
+    return state;
+}
+
+void pagerDrawRow(struct abuf *ab, int filerow)
+{
+    struct pager *p = E.pager;
+    if (p->hex)
+    {
+        hexDrawRow(p->hex, ab, filerow);
+        return;
+    }
+
+    int state = pagerState(p, filerow);
+    int rsize = pagerRender(p, filerow);
+
+    p->lexState = pagerLex(p, rsize, state);
+    p->lexRow = filerow + 1;
+    drawSpan(ab, filerow, p->render, p->hl, rsize, E.colOff);
+}
+
+static void pagerScrollTo(long top)
+{
+    long last = (long)pagerLines() - E.screenRws;
+    if (top > last)
+        top = last;
+    if (top < 0)
+        top = 0;
+    E.rowOff = top;
+}
+
+// the line holding byte offset off
+static size_t pagerLineAt(struct pager *p, size_t off)
+{
+    size_t lo = 0, hi = p->idx.lines;
+    while (hi - lo > 1)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (p->idx.offsets[mid] <= off)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static void pagerFind(struct pager *p)
+{
+    if (p->query == NULL || p->idx.lines == 0)
+        return;
+
+    size_t from = (size_t)E.rowOff + 1 < p->idx.lines ? p->idx.offsets[E.rowOff + 1] : p->size;
+    char *hit = memmem(p->map + from, p->size - from, p->query, strlen(p->query));
+    if (hit == NULL)
+        hit = memmem(p->map, from, p->query, strlen(p->query));
+
+    if (hit == NULL)
+    {
+        setStatusMessage("Not found: %s", p->query);
+        return;
+    }
+
+    size_t line = pagerLineAt(p, hit - p->map);
+    E.rowOff = line;
+    setStatusMessage("/%s: line %zu", p->query, line + 1);
+}
+
+static void pagerSearch(struct pager *p)
+{
+    char *query = prompt("/%s", NULL);
+    if (query == NULL)
+        return;
+
+    matFree(p->query);
+    p->query = query;
+    pagerFind(p);
+}
+
+// line is 1-based; 0 means the last line
+void pagerGotoLine(long long line)
+{
+    if (E.pager->hex)
+        hexGotoRow(E.pager->hex, line > 0 ? line - 1 : pagerLines() - 1);
+    else
+        pagerScrollTo(line > 0 ? line - 1 : pagerLines());
+}
+
+// the text view parks the cursor in its corner; the hex view has a cursor
+void pagerCursor()
+{
+    if (E.pager->hex)
+    {
+        hexCursor(E.pager->hex);
+        return;
+    }
+    E.cy = E.rowOff;
+    E.rx = E.colOff;
+}
+
+// Only the hex view writes anything back, and only the bytes overwritten.
+void pagerSave()
+{
+    struct pager *p = E.pager;
+    if (p->hex == NULL)
+    {
+        setStatusMessage("Read-only: %s is open in the pager", E.current_file_name);
+        return;
+    }
+
+    if (hexSave(p->hex, E.current_file_name) == -1)
+    {
+        setStatusMessage("Failed to write file: %s", strerror(errno));
+        return;
+    }
+    setStatusMessage("File saved: %s", E.current_file_name);
+    E.dirty = 0;
+}
+
+// Keys that move the view; anything that would edit is refused. Returns 0
+// for keys the normal handler should see, such as ':' and 'q'.
+int pagerKey(int c, int count, int counted, int gg)
+{
+    struct pager *p = E.pager;
+    if (p->hex)
+        return hexKey(p->hex, c, count, counted, gg);
+
+    switch (c)
+    {
+    case KEY_J:
+    case '\r':
+        pagerScrollTo(E.rowOff + count);
+        break;
+    case KEY_K:
+        pagerScrollTo(E.rowOff - count);
+        break;
+    case KEY_H:
+        E.colOff = E.colOff > count ? E.colOff - count : 0;
+        break;
+    case KEY_L:
+        E.colOff += count;
+        break;
+    case CTRL_KEY('d'):
+        pagerScrollTo(E.rowOff + count * (E.screenRws / 2));
+        break;
+    case CTRL_KEY('u'):
+        pagerScrollTo(E.rowOff - count * (E.screenRws / 2));
+        break;
+    case CTRL_KEY('f'):
+    case ' ':
+        pagerScrollTo(E.rowOff + count * E.screenRws);
+        break;
+    case CTRL_KEY('b'):
+        pagerScrollTo(E.rowOff - count * E.screenRws);
+        break;
+    case KEY_SHIFT_G:
+        pagerGotoLine(counted ? count : 0);
+        break;
+    case KEY_G:
+        if (!gg)
+            return 0;
+        pagerGotoLine(count);
+        break;
+    case KEY_SLASH:
+        pagerSearch(p);
+        break;
+    case 'n':
+        pagerFind(p);
+        break;
+
+    case KEY_COLON:
+    case KEY_Q:
+    case CTRL_KEY('n'):
+    case CTRL_KEY('p'):
+    case CTRL_KEY('a'):
+        return 0;
+
+    default:
+        setStatusMessage("Read-only: %s is open in the pager", E.current_file_name);
+        break;
+    }
+    return 1;
+}
+
+// maps filename into a new buffer's pager
+static struct pager *pagerMap(char *filename, struct stat *st)
+{
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd == -1 || fstat(fd, st) == -1)
+    {
+        if (fd != -1)
+            close(fd);
+        setStatusMessage("Cannot open %s", filename);
+        return NULL;
+    }
+
+    char *map = NULL;
+    if (st->st_size > 0)
+    {
+        map = mmap(NULL, st->st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED)
+        {
+            close(fd);
+            setStatusMessage("Cannot map %s", filename);
+            return NULL;
+        }
+    }
+    close(fd);
+
+    bufferNew();
+    E.current_file_name = strdup(filename);
+    E.current_file_extension = get_file_extension(E.current_file_name);
+
+    struct pager *p = matMalloc(ALLOC_INDEX, sizeof(struct pager));
+    memset(p, 0, sizeof(*p));
+    p->map = map;
+    p->size = st->st_size;
+    return p;
+}
+
+// Opens filename in a new buffer as rows of bytes. Nothing is read up front,
+// so a file of any size opens at once.
+int pagerOpenHex(char *filename)
+{
+    struct stat st;
+    struct pager *p = pagerMap(filename, &st);
+    if (p == NULL)
+        return -1;
+
+    p->hex = hexNew(p->map, p->size);
+    E.pager = p;
+    return 0;
+}
+
+// Opens filename read-only in a new buffer. The line index comes from the
+// sidecar cache when there is one, otherwise from one memchr pass over the
+// mapping.
+int pagerOpen(char *filename)
+{
+    struct stat st;
+    struct pager *p = pagerMap(filename, &st);
+    if (p == NULL)
+        return -1;
+
+    char *map = p->map;
+    selectSyntaxHighlight();
+
+    const char *filetype = E.syntax ? E.syntax->filetype : "";
+    int cached = indexEnabled() && (size_t)st.st_size >= INDEX_MIN_SIZE;
+
+    size_t checkpoints;
+    if (cached && indexLoad(filename, &st, filetype, &p->idx) == 0)
+        checkpoints = p->idx.lines / INDEX_INTERVAL + 1;
+    else
+    {
+        size_t off = 0;
+        while (off < p->size)
+        {
+            indexAppend(&p->idx, off);
+            char *nl = memchr(map + off, '\n', p->size - off);
+            off = nl ? (size_t)(nl - map) + 1 : p->size;
+        }
+        indexAppend(&p->idx, p->size);
+        p->idx.lines--;
+        checkpoints = p->idx.lines / INDEX_INTERVAL + 1;
+    }
+
+    // a sidecar written under another syntax comes without states, like a
+    // fresh scan; they are found as the view passes them
+    if (p->idx.states)
+        p->known = checkpoints;
+    else
+    {
+        p->idx.states = matMalloc(ALLOC_INDEX, checkpoints);
+        memset(p->idx.states, 0, checkpoints);
+        p->known = 1;
+
+        // without a syntax every state is 0 and the index is complete
+        if (E.syntax == NULL)
+        {
+            p->known = checkpoints;
+            if (cached)
+                indexStore(filename, &st, filetype, &p->idx);
+        }
+    }
+
+    E.pager = p;
+    return 0;
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "mat.h"
+
+int pagerOpen(char *filename);
+int pagerOpenHex(char *filename);
+long long pagerLines();
+long long pagerPosition();
+int pagerScreenLines();
+size_t pagerMemory();
+void pagerDrawRow(struct abuf *ab, int filerow);
+void pagerGotoLine(long long line);
+void pagerCursor();
+void pagerSave();
+int pagerKey(int c, int count, int counted, int gg);
@@ -0,0 +1,186 @@
+#include "register.h"
+#include "mat.h"
+#include "output.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+extern struct config E;
+
+// The unnamed register holds one slice per yanked row, each referencing the
+// row's text block, so a yank costs a pointer per row whatever the size of
+// the text. Rows copy their block before the next change while the register
+// still refers to it.
+static struct
+{
+    struct line_slice *slices;
+    int count;
+    int linewise;
+} R;
+
+static void registerClear()
+{
+    for (int j = 0; j < R.count; j++)
+        lineFree(R.slices[j].chars);
+    matFree(R.slices);
+    R.slices = NULL;
+    R.count = 0;
+}
+
+// Yanks from (y1, x1) up to but not including (y2, x2).
+void registerYank(int y1, int x1, int y2, int x2, int linewise)
+{
+    registerClear();
+
+    R.count = y2 - y1 + 1;
+    R.slices = matMalloc(ALLOC_REGISTER, sizeof(struct line_slice) * R.count);
+    R.linewise = linewise;
+
+    for (int j = y1; j <= y2; j++)
+    {
+        struct line_slice *sl = &R.slices[j - y1];
+        sl->chars = lineRef(E.row[j].chars);
+        sl->from = j == y1 ? x1 : 0;
+        sl->to = j == y2 ? x2 : E.row[j].size;
+    }
+
+    if (getenv("MAT_OSC52"))
+        registerExport();
+}
+
+static void registerPutChars(int after)
+{
+    if (E.cy >= E.numRws)
+        insertRws(E.numRws, "", 0);
+
+    erow *row = &E.row[E.cy];
+    int at = E.cx + (after && row->size > 0);
+    if (at > row->size)
+        at = row->size;
+
+    struct line_slice *first = &R.slices[0];
+    if (R.count == 1)
+    {
+        rwsInsertString(row, at, &first->chars[first->from], first->to - first->from);
+        E.cx = at + first->to - first->from - 1;
+        if (E.cx < at)
+            E.cx = at;
+        return;
+    }
+
+    // the first slice joins the text before the cursor and the last one the
+    // text after it; the slices in between become rows of their own
+    struct line_slice *last = &R.slices[R.count - 1];
+    size_t lastlen = last->to - last->from;
+    size_t tail = row->size - at;
+    char *joined = matMalloc(ALLOC_REGISTER, lastlen + tail);
+    memcpy(joined, &last->chars[last->from], lastlen);
+    memcpy(joined + lastlen, &row->chars[at], tail);
+
+    rwsTruncate(row, at);
+    rwsAppendString(&E.row[E.cy], &first->chars[first->from], first->to - first->from);
+    insertRwsSlices(E.cy + 1, &R.slices[1], R.count - 2);
+    insertRws(E.cy + R.count - 1, joined, lastlen + tail);
+    matFree(joined);
+    E.cx = at;
+}
+
+// Puts the register after (p) or before (P) the cursor. Whole rows are put
+// back by reference; only text joined with an existing row is copied.
+void registerPut(int after, int count)
+{
+    if (R.count == 0)
+        return;
+
+    while (count-- > 0)
+    {
+        if (R.linewise)
+        {
+            int at = E.cy < E.numRws ? E.cy + after : E.numRws;
+            insertRwsSlices(at, R.slices, R.count);
+            E.cy = at;
+            E.cx = 0;
+        }
+        else
+            registerPutChars(after);
+    }
+}
+
+// the export goes through the frame queue so it cannot land in the middle of
+// a frame, and waits for each chunk to drain so only one is ever held
+static void registerWrite(const char *s, size_t len)
+{
+    outputWrite(s, len);
+    outputFlush();
+}
+
+// base64 encoder that keeps up to two bytes between calls and flushes its
+// output in fixed-size chunks
+static struct
+{
+    unsigned char carry[3];
+    int ncarry;
+    char out[4096];
+    size_t nout;
+} B64;
+
+static void registerEncodeTriple(const unsigned char *in, int n)
+{
+    static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    unsigned v = in[0] << 16 | (n > 1 ? in[1] << 8 : 0) | (n > 2 ? in[2] : 0);
+
+    if (B64.nout + 4 > sizeof(B64.out))
+    {
+        registerWrite(B64.out, B64.nout);
+        B64.nout = 0;
+    }
+    B64.out[B64.nout++] = digits[v >> 18 & 63];
+    B64.out[B64.nout++] = digits[v >> 12 & 63];
+    B64.out[B64.nout++] = n > 1 ? digits[v >> 6 & 63] : '=';
+    B64.out[B64.nout++] = n > 2 ? digits[v & 63] : '=';
+}
+
+static void registerEncode(const char *s, size_t len)
+{
+    const unsigned char *p = (const unsigned char *)s;
+
+    while (len > 0 && B64.ncarry > 0)
+    {
+        B64.carry[B64.ncarry++] = *p++;
+        len--;
+        if (B64.ncarry == 3)
+        {
+            registerEncodeTriple(B64.carry, 3);
+            B64.ncarry = 0;
+        }
+    }
+    for (; len >= 3; p += 3, len -= 3)
+        registerEncodeTriple(p, 3);
+    while (len-- > 0)
+        B64.carry[B64.ncarry++] = *p++;
+}
+
+// Sends the register to the terminal clipboard with OSC 52. The text is
+// encoded and written a chunk at a time straight from the slices.
+void registerExport()
+{
+    if (R.count == 0)
+        return;
+
+    B64.ncarry = 0;
+    B64.nout = 0;
+    registerWrite("\x1b]52;c;", 7);
+
+    for (int j = 0; j < R.count; j++)
+    {
+        struct line_slice *sl = &R.slices[j];
+        registerEncode(&sl->chars[sl->from], sl->to - sl->from);
+        if (j < R.count - 1 || R.linewise)
+            registerEncode("\n", 1);
+    }
+
+    if (B64.ncarry > 0)
+        registerEncodeTriple(B64.carry, B64.ncarry);
+    registerWrite(B64.out, B64.nout);
+    registerWrite("\a", 1);
+}
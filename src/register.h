@@ -0,0 +1,5 @@
+#pragma once
+
+void registerYank(int y1, int x1, int y2, int x2, int linewise);
+void registerPut(int after, int count);
+void registerExport();
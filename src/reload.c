@@ -0,0 +1,194 @@
+#include "reload.h"
+#include "alloc.h"
+#include "buffer.h"
+#include "diff.h"
+#include "follow.h"
+#include "journal.h"
+#include "mat.h"
+#include "undo.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+extern struct config E;
+extern struct buffers B;
+
+// A file's mtime to the nanosecond, as E.diskMtime keeps it; whole seconds
+// would miss a rewrite of the same size within one.
+long long reloadMtime(struct stat *st)
+{
+    return st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+}
+
+static int reloadStat(struct stat *st)
+{
+    if (E.current_file_name == NULL || E.diskMtime == 0 || stat(E.current_file_name, st) == -1)
+        return 0;
+    return reloadMtime(st) != E.diskMtime || st->st_size != E.diskSize;
+}
+
+// True when the file on disk is not the one last read or written.
+int reloadChanged()
+{
+    struct stat st;
+    return reloadStat(&st);
+}
+
+// where row y ends up once the hunks are applied
+static int reloadMapRow(struct diff_hunk *h, int count, int y)
+{
+    int shift = 0;
+    for (int i = 0; i < count && h[i].a <= y; i++)
+    {
+        if (y < h[i].a + h[i].alen)
+        {
+            int off = y - h[i].a;
+            return h[i].b + (off < h[i].blen ? off : h[i].blen ? h[i].blen - 1 : 0);
+        }
+        shift += h[i].blen - h[i].alen;
+    }
+    return y + shift;
+}
+
+// Brings the buffer in line with the file on disk. Only the row ranges a line
+// diff finds changed are replaced, so the others keep their highlighting and
+// anything in undo that refers to them; the reload itself is one undo step.
+void reloadBuffer()
+{
+    if (E.current_file_name == NULL || E.pager)
+        return;
+
+    int fd = open(E.current_file_name, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1)
+    {
+        if (fd != -1)
+            close(fd);
+        setStatusMessage("Cannot reload %s", E.current_file_name);
+        return;
+    }
+
+    char *map = NULL;
+    if (st.st_size > 0)
+    {
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED)
+        {
+            close(fd);
+            setStatusMessage("Cannot reload %s", E.current_file_name);
+            return;
+        }
+    }
+    close(fd);
+
+    // the new lines, cut the way openFile cuts them
+    int m = 0, cap = 0;
+    char **starts = NULL;
+    int *lens = NULL;
+    for (char *p = map, *end = map + st.st_size; p < end;)
+    {
+        char *nl = memchr(p, '\n', end - p);
+        int len = (nl ? nl : end) - p;
+        while (len > 0 && p[len - 1] == '\r')
+            len--;
+
+        if (m == cap)
+        {
+            cap = cap ? cap * 2 : 1024;
+            starts = matRealloc(ALLOC_ROWS, starts, sizeof(char *) * cap);
+            lens = matRealloc(ALLOC_ROWS, lens, sizeof(int) * cap);
+        }
+        starts[m] = p;
+        lens[m++] = len;
+        p = nl ? nl + 1 : end;
+    }
+
+    uint64_t *a = matMalloc(ALLOC_ROWS, sizeof(uint64_t) * (E.numRws + 1));
+    uint64_t *b = matMalloc(ALLOC_ROWS, sizeof(uint64_t) * (m + 1));
+    for (int i = 0; i < E.numRws; i++)
+        a[i] = diffHash(E.row[i].chars, E.row[i].size);
+    for (int i = 0; i < m; i++)
+        b[i] = diffHash(starts[i], lens[i]);
+
+    struct diff_hunk *h;
+    int count = diffLines(a, E.numRws, b, m, &h);
+    matFree(a);
+    matFree(b);
+
+    int cy = reloadMapRow(h, count, E.cy);
+    int rowOff = reloadMapRow(h, count, E.rowOff);
+
+    undoBoundary();
+    for (int i = count - 1; i >= 0; i--)
+    {
+        deleteRwsRange(h[i].a, h[i].alen);
+        if (h[i].blen == 0)
+            continue;
+
+        size_t len = 0;
+        for (int j = h[i].b; j < h[i].b + h[i].blen; j++)
+            len += lens[j] + 1;
+        char *block = matMalloc(ALLOC_ROWS, len), *p = block;
+        for (int j = h[i].b; j < h[i].b + h[i].blen; j++)
+        {
+            memcpy(p, starts[j], lens[j]);
+            p += lens[j];
+            *p++ = '\n';
+        }
+        insertRwsBlock(h[i].a, block, len);
+        matFree(block);
+    }
+    undoBoundary();
+
+    matFree(h);
+    matFree(starts);
+    matFree(lens);
+    if (map)
+        munmap(map, st.st_size);
+
+    E.cy = cy < E.numRws ? cy : E.numRws;
+    E.rowOff = rowOff < E.cy ? rowOff : E.cy;
+    if (E.cy < E.numRws && E.cx > E.row[E.cy].size)
+        E.cx = E.row[E.cy].size;
+
+    E.diskSize = st.st_size;
+    E.diskMtime = reloadMtime(&st);
+    E.dirty = 0;
+    journalReset(E.current_file_name);
+
+    setStatusMessage("Reloaded %s: %d changed range%s", E.current_file_name, count, count == 1 ? "" : "s");
+}
+
+// Checked about once a second while waiting for keys. A clean buffer follows
+// the file; one with edits only gets a warning, once per change on disk.
+void reloadPoll()
+{
+    static time_t last;
+    static long long warned;
+
+    time_t now = time(NULL);
+    struct stat st;
+    if (now == last)
+        return;
+    last = now;
+    // a followed file only grows, and follow mode reads that itself
+    if (followed(B.current) || !reloadStat(&st))
+        return;
+
+    if (!E.dirty)
+    {
+        reloadBuffer();
+        refreshScreen();
+    }
+    else if (warned != reloadMtime(&st))
+    {
+        warned = reloadMtime(&st);
+        setStatusMessage("%s changed on disk, :reload drops your edits", E.current_file_name);
+        refreshScreen();
+    }
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <sys/stat.h>
+
+long long reloadMtime(struct stat *st);
+int reloadChanged();
+void reloadBuffer();
+void reloadPoll();
@@ -0,0 +1,353 @@
+#include "rowtree.h"
+#include "mat.h"
+
+#include <string.h>
+
+static unsigned int rtSeed = 2463534242u;
+
+static unsigned int rtRandom()
+{
+    rtSeed ^= rtSeed << 13;
+    rtSeed ^= rtSeed >> 17;
+    rtSeed ^= rtSeed << 5;
+    return rtSeed;
+}
+
+static int rtSize(struct rtnode *n)
+{
+    return n ? n->size : 0;
+}
+
+static void rtPull(struct rtnode *n)
+{
+    n->size = 1 + rtSize(n->left) + rtSize(n->right);
+
+    for (int ch = 0; ch < RT_CHANNELS; ch++)
+    {
+        int sum = 0, min = 0;
+        if (n->left)
+        {
+            sum = n->left->agg[ch].delta;
+            min = n->left->agg[ch].min;
+        }
+        if (sum + n->own[ch].min < min)
+            min = sum + n->own[ch].min;
+        sum += n->own[ch].delta;
+        if (n->right)
+        {
+            if (sum + n->right->agg[ch].min < min)
+                min = sum + n->right->agg[ch].min;
+            sum += n->right->agg[ch].delta;
+        }
+        n->agg[ch].delta = sum;
+        n->agg[ch].min = min;
+    }
+
+    n->firstIn = n->left ? n->left->firstIn : n->in;
+    n->lastOut = n->right ? n->right->lastOut : n->out;
+    n->broken = n->in < 0 || (n->left && (n->left->broken || n->left->lastOut != n->in)) ||
+                (n->right && (n->right->broken || n->right->firstIn != n->out));
+}
+
+static struct rtnode *rtNode()
+{
+    struct rtnode *n = matMalloc(ALLOC_ROWTREE, sizeof(struct rtnode));
+    memset(n, 0, sizeof(*n));
+    n->prio = rtRandom();
+    n->size = 1;
+    n->in = n->out = -1;
+    return n;
+}
+
+// splits t into its first k rows and the rest
+static void rtSplit(struct rtnode *t, int k, struct rtnode **l, struct rtnode **r)
+{
+    if (t == NULL)
+    {
+        *l = *r = NULL;
+        return;
+    }
+
+    if (rtSize(t->left) < k)
+    {
+        rtSplit(t->right, k - rtSize(t->left) - 1, &t->right, r);
+        *l = t;
+    }
+    else
+    {
+        rtSplit(t->left, k, l, &t->left);
+        *r = t;
+    }
+    rtPull(t);
+}
+
+static struct rtnode *rtMerge(struct rtnode *a, struct rtnode *b)
+{
+    if (a == NULL)
+        return b;
+    if (b == NULL)
+        return a;
+
+    if (a->prio > b->prio)
+    {
+        a->right = rtMerge(a->right, b);
+        rtPull(a);
+        return a;
+    }
+    b->left = rtMerge(a, b->left);
+    rtPull(b);
+    return b;
+}
+
+static void rtFreeNodes(struct rtnode *n)
+{
+    if (n == NULL)
+        return;
+    rtFreeNodes(n->left);
+    rtFreeNodes(n->right);
+    matFree(n);
+}
+
+static void rtPullAll(struct rtnode *n)
+{
+    if (n == NULL)
+        return;
+    rtPullAll(n->left);
+    rtPullAll(n->right);
+    rtPull(n);
+}
+
+// Builds a tree for `count` rows in O(n) as a Cartesian tree of random
+// priorities, keeping the right spine on a stack. states[i], when given, is
+// the state row i leaves for the next one; the first row starts from 0.
+static struct rtnode *rtBuild(struct rtbrackets (*values)[RT_CHANNELS], const int *states, int count)
+{
+    struct rtnode **spine = matMalloc(ALLOC_ROWTREE, sizeof(struct rtnode *) * (count + 1));
+    int depth = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        struct rtnode *n = rtNode();
+        if (values)
+            memcpy(n->own, values[i], sizeof(n->own));
+        if (states)
+        {
+            n->in = i > 0 ? states[i - 1] : 0;
+            n->out = states[i];
+        }
+
+        struct rtnode *last = NULL;
+        while (depth > 0 && spine[depth - 1]->prio < n->prio)
+            last = spine[--depth];
+        n->left = last;
+        if (depth > 0)
+            spine[depth - 1]->right = n;
+        spine[depth++] = n;
+    }
+
+    struct rtnode *root = depth > 0 ? spine[0] : NULL;
+    matFree(spine);
+    rtPullAll(root);
+    return root;
+}
+
+struct rowtree *rowtreeBuild(struct rtbrackets (*values)[RT_CHANNELS], const int *states, int count)
+{
+    struct rowtree *t = matMalloc(ALLOC_ROWTREE, sizeof(struct rowtree));
+    t->root = rtBuild(values, states, count);
+    return t;
+}
+
+void rowtreeFree(struct rowtree *t)
+{
+    if (t == NULL)
+        return;
+    rtFreeNodes(t->root);
+    matFree(t);
+}
+
+// nodes are all the same size, so one stands for the rest
+size_t rowtreeMemory(struct rowtree *t)
+{
+    if (t == NULL)
+        return 0;
+    return matSize(t) + (t->root ? t->root->size * matSize(t->root) : 0);
+}
+
+// inserts `count` empty rows before row `at`
+void rowtreeInsert(struct rowtree *t, int at, int count)
+{
+    struct rtnode *l, *r;
+    rtSplit(t->root, at, &l, &r);
+    t->root = rtMerge(rtMerge(l, rtBuild(NULL, NULL, count)), r);
+}
+
+void rowtreeDelete(struct rowtree *t, int at, int count)
+{
+    struct rtnode *l, *m, *r;
+    rtSplit(t->root, at, &l, &r);
+    rtSplit(r, count, &m, &r);
+    rtFreeNodes(m);
+    t->root = rtMerge(l, r);
+}
+
+static void rtSet(struct rtnode *n, int at, struct rtbrackets values[RT_CHANNELS])
+{
+    int left = rtSize(n->left);
+    if (at < left)
+        rtSet(n->left, at, values);
+    else if (at > left)
+        rtSet(n->right, at - left - 1, values);
+    else
+        memcpy(n->own, values, sizeof(n->own));
+    rtPull(n);
+}
+
+void rowtreeSet(struct rowtree *t, int at, struct rtbrackets values[RT_CHANNELS])
+{
+    if (at >= 0 && at < rtSize(t->root))
+        rtSet(t->root, at, values);
+}
+
+static void rtLink(struct rtnode *n, int at, int in, int out)
+{
+    int left = rtSize(n->left);
+    if (at < left)
+        rtLink(n->left, at, in, out);
+    else if (at > left)
+        rtLink(n->right, at - left - 1, in, out);
+    else
+    {
+        n->in = in;
+        n->out = out;
+    }
+    rtPull(n);
+}
+
+void rowtreeLink(struct rowtree *t, int at, int in, int out)
+{
+    if (at >= 0 && at < rtSize(t->root))
+        rtLink(t->root, at, in, out);
+}
+
+// first row of n that was not computed from `prev`, the state left by the
+// row before n's first, or -1
+static int rtBroken(struct rtnode *n, int prev, int base)
+{
+    if (n->left && (n->left->broken || n->left->firstIn != prev))
+        return rtBroken(n->left, prev, base);
+    int at = base + rtSize(n->left);
+    if (n->in < 0 || n->in != (n->left ? n->left->lastOut : prev))
+        return at;
+    if (n->right && (n->right->broken || n->right->firstIn != n->out))
+        return rtBroken(n->right, n->out, at + 1);
+    return -1;
+}
+
+// The first row whose values were computed from a state other than the one
+// the row above now leaves, or -1 when every row follows from the first.
+int rowtreeBroken(struct rowtree *t)
+{
+    return t->root ? rtBroken(t->root, 0, 0) : -1;
+}
+
+// depth at the start of row `at`: the sum of the deltas of the rows above it
+int rowtreeDepth(struct rowtree *t, int at, int ch)
+{
+    int depth = 0;
+    struct rtnode *n = t->root;
+
+    while (n)
+    {
+        int left = rtSize(n->left);
+        if (at <= left)
+            n = n->left;
+        else
+        {
+            depth += (n->left ? n->left->agg[ch].delta : 0) + n->own[ch].delta;
+            at -= left + 1;
+            n = n->right;
+        }
+    }
+    return depth;
+}
+
+// first row >= from (relative to n) whose lowest depth is <= threshold;
+// base is the depth at the start of n's subtree
+static int rtForward(struct rtnode *n, int from, int ch, int threshold, int base)
+{
+    if (n == NULL || from >= n->size)
+        return -1;
+    if (from <= 0 && base + n->agg[ch].min > threshold)
+        return -1;
+
+    int left = rtSize(n->left);
+    int found = rtForward(n->left, from, ch, threshold, base);
+    if (found >= 0)
+        return found;
+
+    int at = base + (n->left ? n->left->agg[ch].delta : 0);
+    if (from <= left && at + n->own[ch].min <= threshold)
+        return left;
+
+    found = rtForward(n->right, from - left - 1, ch, threshold, at + n->own[ch].delta);
+    return found >= 0 ? found + left + 1 : -1;
+}
+
+// last row <= to (relative to n) whose lowest depth is <= threshold
+static int rtBackward(struct rtnode *n, int to, int ch, int threshold, int base)
+{
+    if (n == NULL || to < 0)
+        return -1;
+    if (to >= n->size - 1 && base + n->agg[ch].min > threshold)
+        return -1;
+
+    int left = rtSize(n->left);
+    int at = base + (n->left ? n->left->agg[ch].delta : 0);
+
+    int found = rtBackward(n->right, to - left - 1, ch, threshold, at + n->own[ch].delta);
+    if (found >= 0)
+        return found + left + 1;
+
+    if (to >= left && at + n->own[ch].min <= threshold)
+        return left;
+
+    return rtBackward(n->left, to, ch, threshold, base);
+}
+
+// Finds the row holding unit `target` (counting from 0) of channel ch when
+// every delta is a non-negative count; returns the row count if past the end.
+int rowtreeFindSum(struct rowtree *t, int ch, int target)
+{
+    int idx = 0;
+    struct rtnode *n = t->root;
+
+    while (n)
+    {
+        int left = n->left ? n->left->agg[ch].delta : 0;
+        if (target < left)
+        {
+            n = n->left;
+            continue;
+        }
+
+        target -= left;
+        if (target < n->own[ch].delta)
+            return idx + rtSize(n->left);
+
+        target -= n->own[ch].delta;
+        idx += rtSize(n->left) + 1;
+        n = n->right;
+    }
+    return idx;
+}
+
+int rowtreeFindForward(struct rowtree *t, int from, int ch, int threshold)
+{
+    return rtForward(t->root, from, ch, threshold, 0);
+}
+
+int rowtreeFindBackward(struct rowtree *t, int to, int ch, int threshold)
+{
+    return rtBackward(t->root, to, ch, threshold, 0);
+}
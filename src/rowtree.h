@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stddef.h>
+
+// An implicit treap with one node per row, ordered like E.row. Nodes carry
+// per-row values and subtree aggregates, so prefix sums and "first row past
+// a threshold" searches take O(log n), and inserting or deleting rows only
+// splits and merges along one path.
+#define RT_CHANNELS 3
+
+struct rtbrackets
+{
+    int delta; // opens minus closes
+    int min;   // lowest depth reached relative to the start, never above 0
+};
+
+struct rtnode
+{
+    struct rtnode *left, *right;
+    unsigned int prio;
+    int size;
+    struct rtbrackets own[RT_CHANNELS];
+    struct rtbrackets agg[RT_CHANNELS];
+    // the state the row's values were computed from and the one it leaves
+    // for the next row, -1 until it is first set; the subtree keeps the ends
+    // and whether some row does not start from the state before it
+    signed char in, out;
+    signed char firstIn, lastOut, broken;
+};
+
+struct rowtree
+{
+    struct rtnode *root;
+};
+
+struct rowtree *rowtreeBuild(struct rtbrackets (*values)[RT_CHANNELS], const int *states, int count);
+void rowtreeFree(struct rowtree *t);
+size_t rowtreeMemory(struct rowtree *t);
+void rowtreeInsert(struct rowtree *t, int at, int count);
+void rowtreeDelete(struct rowtree *t, int at, int count);
+void rowtreeSet(struct rowtree *t, int at, struct rtbrackets values[RT_CHANNELS]);
+void rowtreeLink(struct rowtree *t, int at, int in, int out);
+int rowtreeBroken(struct rowtree *t);
+int rowtreeDepth(struct rowtree *t, int at, int ch);
+int rowtreeFindSum(struct rowtree *t, int ch, int target);
+int rowtreeFindForward(struct rowtree *t, int from, int ch, int threshold);
+int rowtreeFindBackward(struct rowtree *t, int to, int ch, int threshold);
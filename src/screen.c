@@ -0,0 +1,222 @@
+#include "screen.h"
+#include "input.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+extern struct config E;
+
+// What the terminal is showing, one entry per screen line, so a frame only
+// sends the lines that changed. When the view moved by fewer lines than the
+// text area holds, the terminal shifts the kept lines itself inside a scroll
+// region and only the exposed ones are drawn.
+static struct
+{
+    int lines; // screen lines in the model, text rows plus status and message
+    int rows;  // text rows, the part that scrolls
+    int cols;
+    char **text;
+    int *len;
+    int top; // first screen line of the buffer shown in the last frame
+    int valid;
+    int sync; // terminal handles synchronized output (mode 2026)
+} SCR;
+
+void frameEndLine(struct frame *f)
+{
+    f->ends = matRealloc(ALLOC_FRAME, f->ends, sizeof(int) * (f->lines + 1));
+    f->ends[f->lines++] = f->ab.len;
+}
+
+void frameFree(struct frame *f)
+{
+    matFree(f->ab.b);
+    matFree(f->ends);
+}
+
+static int frameLine(struct frame *f, int i, const char **s)
+{
+    int start = i ? f->ends[i - 1] : 0;
+    *s = f->ab.b + start;
+    return f->ends[i] - start;
+}
+
+// How far s is into a reply to screenDetect: 0 while it may still become
+// one, 1 for the device attributes reply ESC [ ? ... c, 2 for the DECRQM
+// reply ESC [ ? ... $ y and -1 once it cannot be either.
+static int screenReply(const char *s, int len)
+{
+    if (s[0] != '\x1b' || (len > 1 && s[1] != '[') || (len > 2 && s[2] != '?'))
+        return -1;
+    for (int i = 3; i < len; i++)
+    {
+        if ((s[i] >= '0' && s[i] <= '9') || s[i] == ';')
+            continue;
+        if (s[i] == 'c')
+            return i == len - 1 ? 1 : -1;
+        if (s[i] == '$' && i == len - 1)
+            return 0;
+        if (s[i] == '$' && s[i + 1] == 'y')
+            return i + 1 == len - 1 ? 2 : -1;
+        return -1;
+    }
+    return 0;
+}
+
+// Asks whether mode 2026 is supported with DECRQM. The device attributes
+// query after it is answered by every terminal, so there is no waiting on
+// one that ignores the first. Keys typed meanwhile are handed to readKey.
+void screenDetect()
+{
+    char seq[32], typed[64];
+    int len = 0, ntyped = 0, reply = 0;
+
+    if (write(STDOUT_FILENO, "\x1b[?2026$p\x1b[c", 13) != 13)
+        return;
+
+    while (reply != 1 && inputByte(&seq[len]) == 1)
+    {
+        len++;
+        while (len > 0 && ((reply = screenReply(seq, len)) == -1 || len == (int)sizeof(seq)))
+        {
+            // the first byte starts no reply, so it was typed
+            if (ntyped < (int)sizeof(typed))
+                typed[ntyped++] = seq[0];
+            memmove(seq, seq + 1, --len);
+        }
+        if (reply == 2)
+        {
+            SCR.sync = len == 11 && (!memcmp(seq, "\x1b[?2026;1$y", 11) || !memcmp(seq, "\x1b[?2026;2$y", 11));
+            len = 0;
+        }
+    }
+    inputUnread(typed, ntyped);
+    // a reply cut short by the timeout was typed too
+    if (reply != 1)
+        inputUnread(seq, len);
+}
+
+void screenInvalidate()
+{
+    SCR.valid = 0;
+}
+
+static void screenReset(int lines)
+{
+    for (int i = 0; i < SCR.lines; i++)
+        matFree(SCR.text[i]);
+    matFree(SCR.text);
+    matFree(SCR.len);
+
+    SCR.lines = lines;
+    SCR.rows = E.screenRws;
+    SCR.cols = E.screenCls;
+    SCR.text = matMalloc(ALLOC_FRAME, sizeof(char *) * lines);
+    SCR.len = matMalloc(ALLOC_FRAME, sizeof(int) * lines);
+    memset(SCR.text, 0, sizeof(char *) * lines);
+    memset(SCR.len, 0, sizeof(int) * lines);
+    SCR.valid = 1;
+}
+
+static int screenSame(int i, const char *s, int len)
+{
+    return SCR.text[i] && SCR.len[i] == len && memcmp(SCR.text[i], s, len) == 0;
+}
+
+// A shift is only worth it when most of the kept lines would then be right.
+static int screenShiftPays(struct frame *f, int d)
+{
+    int matches = 0, overlap = SCR.rows - abs(d);
+
+    for (int i = 0; i < SCR.rows; i++)
+    {
+        int old = i + d;
+        const char *s;
+        int len = frameLine(f, i, &s);
+        if (old >= 0 && old < SCR.rows && screenSame(old, s, len))
+            matches++;
+    }
+    return matches * 2 >= overlap && matches > 0;
+}
+
+static void screenShift(struct abuf *ab, int d)
+{
+    char buf[32];
+    int n = abs(d);
+    snprintf(buf, sizeof(buf), "\x1b[0m\x1b[1;%dr\x1b[%d%c\x1b[r", SCR.rows, n, d > 0 ? 'S' : 'T');
+    abAppend(ab, buf, strlen(buf));
+
+    if (d > 0)
+    {
+        for (int i = 0; i < n; i++)
+            matFree(SCR.text[i]);
+        memmove(&SCR.text[0], &SCR.text[n], sizeof(char *) * (SCR.rows - n));
+        memmove(&SCR.len[0], &SCR.len[n], sizeof(int) * (SCR.rows - n));
+        memset(&SCR.text[SCR.rows - n], 0, sizeof(char *) * n);
+    }
+    else
+    {
+        for (int i = SCR.rows - n; i < SCR.rows; i++)
+            matFree(SCR.text[i]);
+        memmove(&SCR.text[n], &SCR.text[0], sizeof(char *) * (SCR.rows - n));
+        memmove(&SCR.len[n], &SCR.len[0], sizeof(int) * (SCR.rows - n));
+        memset(&SCR.text[0], 0, sizeof(char *) * n);
+    }
+}
+
+// Appends to ab what it takes to turn the screen the terminal shows into
+// frame f. `top` is the first screen line of the buffer the frame shows.
+void screenPresent(struct abuf *ab, struct frame *f, int top)
+{
+    if (!SCR.valid || SCR.lines != f->lines || SCR.rows != E.screenRws || SCR.cols != E.screenCls)
+    {
+        screenReset(f->lines);
+        abAppend(ab, "\x1b[2J", 4);
+    }
+    else if (top != SCR.top && abs(top - SCR.top) < SCR.rows && screenShiftPays(f, top - SCR.top))
+        screenShift(ab, top - SCR.top);
+
+    SCR.top = top;
+
+    for (int i = 0; i < f->lines; i++)
+    {
+        const char *s;
+        int len = frameLine(f, i, &s);
+        if (screenSame(i, s, len))
+            continue;
+
+        char buf[16];
+        snprintf(buf, sizeof(buf), "\x1b[%d;1H", i + 1);
+        abAppend(ab, buf, strlen(buf));
+        abAppend(ab, s, len);
+
+        matFree(SCR.text[i]);
+        SCR.text[i] = matMalloc(ALLOC_FRAME, len + 1);
+        memcpy(SCR.text[i], s, len);
+        SCR.len[i] = len;
+    }
+}
+
+void screenBegin(struct abuf *ab)
+{
+    if (SCR.sync)
+        abAppend(ab, "\x1b[?2026h", 8);
+    abAppend(ab, "\x1b[?25l", 6);
+}
+
+void screenEnd(struct abuf *ab)
+{
+    abAppend(ab, "\x1b[?25h", 6);
+    if (SCR.sync)
+        abAppend(ab, "\x1b[?2026l", 8);
+}
+
+// bytes held by the model of what the terminal shows
+size_t screenMemory()
+{
+    size_t bytes = matSize(SCR.text) + matSize(SCR.len);
+    for (int i = 0; i < SCR.lines; i++)
+        bytes += matSize(SCR.text[i]);
+    return bytes;
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "mat.h"
+
+void frameEndLine(struct frame *f);
+void frameFree(struct frame *f);
+
+void screenDetect();
+void screenInvalidate();
+void screenPresent(struct abuf *ab, struct frame *f, int top);
+void screenBegin(struct abuf *ab);
+void screenEnd(struct abuf *ab);
+size_t screenMemory();
@@ -0,0 +1,872 @@
+#include "server.h"
+#include "alloc.h"
+#include "event.h"
+#include "input.h"
+#include "mat.h"
+#include "output.h"
+#include "screen.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+extern struct config E;
+
+// `mat -s` keeps the editor running between invocations. The first one
+// starts a server in the background: a relay process that owns a
+// pseudo-terminal, and the editor running on the other end of it just as it
+// would on a real terminal. Every `mat -s` is then a thin client: it puts its
+// terminal in raw mode, connects to the relay's Unix socket, hands over its
+// command line and from there on only copies bytes, keys to the relay and
+// the editor's output back. Files stay loaded from one client to the next,
+// so opening one again is a buffer switch. Clients attached at the same time
+// all see the same screen, sized to the smallest of them.
+//
+// Clients talk to the relay, and the relay to the editor over a socket pair,
+// in framed messages; screen bytes go to the clients as they are.
+enum server_msg
+{
+    SERVER_KEYS,   // client to relay: bytes typed
+    SERVER_SIZE,   // client to relay: rows and columns of its terminal
+    SERVER_OPEN,   // client to editor: its command line, NUL terminated args
+    SERVER_STOP,   // client to editor: quit for good
+    SERVER_REDRAW, // relay to editor: a client needs a whole frame
+    SERVER_DETACH  // editor to relay: let go of the client that typed quit,
+                   // given as the count of key bytes the editor had used up
+};
+
+struct server_header
+{
+    uint32_t type, len;
+};
+
+// one end of a connection, with a partly received message and the bytes
+// the descriptor has not taken yet
+struct server_link
+{
+    int fd;
+    int rows, cols; // a client's terminal, 0 until it has said
+    int resync;     // bytes were dropped and a whole frame was asked for
+    char *in;
+    size_t inLen;
+    char *out;
+    size_t outLen, outCap;
+};
+
+typedef void (*server_fn)(struct server_link *link, int type, char *data, size_t len);
+
+// the editor's side
+static struct
+{
+    struct server_link link; // to the relay; fd is -1 when not serving
+    char *pending;           // a command line to open once no prompt is up
+    size_t pendingLen;
+} SV = {{-1, 0, 0, 0, NULL, 0, NULL, 0, 0}, NULL, 0};
+
+// the relay's side; keys keeps the last batches of keys passed on to the
+// editor, so that a byte the editor read can be traced to its client
+static struct
+{
+    struct server_link master, ctl;
+    struct server_link clients[SERVER_MAX_CLIENTS];
+    int count;
+    struct
+    {
+        int fd;
+        uint64_t start, end;
+    } keys[SERVER_KEY_LOG];
+    int keysAt;
+    uint64_t keysSent;
+    int rows, cols;
+} RL;
+
+// Without a runtime directory the socket goes in a directory of our own
+// under /tmp, so nobody else can put a socket at its path first. One that
+// already exists has to be ours and closed to everyone else.
+static int serverPrivateDir(const char *dir)
+{
+    struct stat st;
+    if (mkdir(dir, 0700) == -1 && errno != EEXIST)
+        return -1;
+    if (lstat(dir, &st) == -1)
+        return -1;
+    if (!S_ISDIR(st.st_mode) || st.st_uid != getuid() || (st.st_mode & 077))
+    {
+        errno = EPERM;
+        return -1;
+    }
+    return 0;
+}
+
+// Says what went wrong itself and returns -1 when there is no usable path.
+static int serverAddress(struct sockaddr_un *addr)
+{
+    const char *path = getenv("MAT_SERVER");
+    const char *dir = getenv("XDG_RUNTIME_DIR");
+    char own[64];
+    int len;
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (path && *path)
+        len = snprintf(addr->sun_path, sizeof(addr->sun_path), "%s", path);
+    else if (dir && *dir)
+        len = snprintf(addr->sun_path, sizeof(addr->sun_path), "%s/mat.sock", dir);
+    else
+    {
+        snprintf(own, sizeof(own), "/tmp/mat-%d", (int)getuid());
+        if (serverPrivateDir(own) == -1)
+        {
+            fprintf(stderr, "mat: cannot use %s: %s\n", own, strerror(errno));
+            return -1;
+        }
+        len = snprintf(addr->sun_path, sizeof(addr->sun_path), "%s/mat.sock", own);
+    }
+
+    if (len >= (int)sizeof(addr->sun_path))
+    {
+        fprintf(stderr, "mat: server socket path too long\n");
+        return -1;
+    }
+    return 0;
+}
+
+// whether the process at the other end of a connection runs as this user;
+// keys and screen bytes go to nobody else
+static int serverPeerOwned(int fd)
+{
+#ifdef __linux__
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 && cred.uid == getuid();
+#else
+    // the BSDs and macOS ask the same through getpeereid
+    uid_t uid;
+    gid_t gid;
+    return getpeereid(fd, &uid, &gid) == 0 && uid == getuid();
+#endif
+}
+
+static int serverWriteAll(int fd, const char *s, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(fd, s, len);
+        if (n > 0)
+        {
+            s += n;
+            len -= n;
+        }
+        else if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            struct pollfd p = {fd, POLLOUT, 0};
+            poll(&p, 1, -1);
+        }
+        else if (n == -1 && errno != EINTR)
+            return -1;
+    }
+    return 0;
+}
+
+static int serverSend(int fd, int type, const void *data, size_t len)
+{
+    struct server_header h = {type, len};
+    if (serverWriteAll(fd, (const char *)&h, sizeof(h)) == -1)
+        return -1;
+    return serverWriteAll(fd, data, len);
+}
+
+// Reads what has arrived and runs fn on every complete message. Returns -1
+// when the other end is gone or sent something too large to be a message.
+static int serverReceive(struct server_link *link, server_fn fn)
+{
+    size_t cap = sizeof(struct server_header) + SERVER_MSG_MAX;
+    if (link->in == NULL)
+        link->in = matMalloc(ALLOC_FRAME, cap);
+
+    ssize_t n = read(link->fd, link->in + link->inLen, cap - link->inLen);
+    if (n == -1 && (errno == EINTR || errno == EAGAIN))
+        return 0;
+    if (n <= 0)
+        return -1;
+    link->inLen += n;
+
+    size_t at = 0;
+    while (link->inLen - at >= sizeof(struct server_header))
+    {
+        struct server_header h;
+        memcpy(&h, link->in + at, sizeof(h));
+        if (h.len > SERVER_MSG_MAX)
+            return -1;
+        if (link->inLen - at < sizeof(h) + h.len)
+            break;
+        fn(link, h.type, link->in + at + sizeof(h), h.len);
+        at += sizeof(h) + h.len;
+    }
+
+    memmove(link->in, link->in + at, link->inLen - at);
+    link->inLen -= at;
+    return 0;
+}
+
+static void serverQueue(struct server_link *link, const char *s, size_t len)
+{
+    if (link->outLen + len > link->outCap)
+    {
+        size_t cap = link->outCap ? link->outCap : 4096;
+        while (cap < link->outLen + len)
+            cap *= 2;
+        link->out = matRealloc(ALLOC_FRAME, link->out, cap);
+        link->outCap = cap;
+    }
+    memcpy(link->out + link->outLen, s, len);
+    link->outLen += len;
+}
+
+// writes as much of the queue as the descriptor takes without blocking
+static int serverFlush(struct server_link *link)
+{
+    size_t off = 0;
+    while (off < link->outLen)
+    {
+        ssize_t n = write(link->fd, link->out + off, link->outLen - off);
+        if (n > 0)
+            off += n;
+        else if (n == -1 && errno == EINTR)
+            continue;
+        else if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        else
+            return -1;
+    }
+
+    memmove(link->out, link->out + off, link->outLen - off);
+    link->outLen -= off;
+    if (link->outLen == 0)
+        link->resync = 0;
+    return 0;
+}
+
+static void serverFreeLink(struct server_link *link)
+{
+    close(link->fd);
+    matFree(link->in);
+    matFree(link->out);
+    memset(link, 0, sizeof(*link));
+    link->fd = -1;
+}
+
+// relay
+
+// The editor's terminal takes the smallest size among the clients that have
+// said theirs; the kernel tells the editor with SIGWINCH.
+static void serverResize()
+{
+    int rows = 0, cols = 0;
+    for (int i = 0; i < RL.count; i++)
+    {
+        struct server_link *c = &RL.clients[i];
+        if (c->rows > 0 && (rows == 0 || c->rows < rows))
+            rows = c->rows;
+        if (c->cols > 0 && (cols == 0 || c->cols < cols))
+            cols = c->cols;
+    }
+
+    if (rows == 0 || (rows == RL.rows && cols == RL.cols))
+        return;
+
+    struct winsize ws = {rows, cols, 0, 0};
+    ioctl(RL.master.fd, TIOCSWINSZ, &ws);
+    RL.rows = rows;
+    RL.cols = cols;
+}
+
+static int serverFind(int fd)
+{
+    for (int i = 0; i < RL.count; i++)
+        if (RL.clients[i].fd == fd)
+            return i;
+    return -1;
+}
+
+// clients after i move down, so callers walk the list backwards
+static void serverDrop(int i)
+{
+    for (int k = 0; k < SERVER_KEY_LOG; k++)
+        if (RL.keys[k].fd == RL.clients[i].fd)
+            RL.keys[k].fd = -1;
+    serverFreeLink(&RL.clients[i]);
+    memmove(&RL.clients[i], &RL.clients[i + 1], sizeof(struct server_link) * (RL.count - i - 1));
+    RL.count--;
+    serverResize();
+}
+
+// A client that has fallen too far behind loses what is queued for it; the
+// whole frame the editor is asked for makes up for it.
+static void serverBroadcast(const char *s, size_t len)
+{
+    for (int i = RL.count - 1; i >= 0; i--)
+    {
+        struct server_link *c = &RL.clients[i];
+        if (c->outLen + len > SERVER_QUEUE_MAX)
+        {
+            c->outLen = 0;
+            if (!c->resync)
+                serverSend(RL.ctl.fd, SERVER_REDRAW, NULL, 0);
+            c->resync = 1;
+        }
+        serverQueue(c, s, len);
+        if (serverFlush(c) == -1)
+            serverDrop(i);
+    }
+}
+
+static void serverFromClient(struct server_link *link, int type, char *data, size_t len)
+{
+    uint32_t size[2];
+
+    switch (type)
+    {
+    case SERVER_KEYS:
+        serverQueue(&RL.master, data, len);
+        serverFlush(&RL.master);
+        RL.keys[RL.keysAt].fd = link->fd;
+        RL.keys[RL.keysAt].start = RL.keysSent;
+        RL.keys[RL.keysAt].end = RL.keysSent += len;
+        RL.keysAt = (RL.keysAt + 1) % SERVER_KEY_LOG;
+        break;
+
+    case SERVER_SIZE:
+        if (len != sizeof(size))
+            break;
+        memcpy(size, data, sizeof(size));
+        link->rows = size[0];
+        link->cols = size[1];
+        serverResize();
+        serverSend(RL.ctl.fd, SERVER_REDRAW, NULL, 0);
+        break;
+
+    case SERVER_OPEN:
+    case SERVER_STOP:
+        serverSend(RL.ctl.fd, type, data, len);
+        break;
+    }
+}
+
+// Other clients may have typed since the quit, so the batch holding the
+// byte it ended at is looked up; a quit older than the log detaches nobody.
+static void serverFromEditor(struct server_link *link, int type, char *data, size_t len)
+{
+    (void)link;
+
+    uint64_t taken;
+    if (type != SERVER_DETACH || len != sizeof(taken))
+        return;
+    memcpy(&taken, data, sizeof(taken));
+
+    for (int k = 0; k < SERVER_KEY_LOG; k++)
+    {
+        if (RL.keys[k].fd != -1 && RL.keys[k].start < taken && taken <= RL.keys[k].end)
+        {
+            int at = serverFind(RL.keys[k].fd);
+            if (at != -1)
+                serverDrop(at);
+            return;
+        }
+    }
+}
+
+static void serverAccept(int listener)
+{
+    int fd = accept(listener, NULL, NULL);
+    if (fd == -1)
+        return;
+    if (RL.count == SERVER_MAX_CLIENTS || !serverPeerOwned(fd))
+    {
+        close(fd);
+        return;
+    }
+
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    struct server_link *c = &RL.clients[RL.count++];
+    memset(c, 0, sizeof(*c));
+    c->fd = fd;
+}
+
+// Runs until the editor exits, which closes its end of the socket pair.
+static void serverRelay(int listener, const char *path)
+{
+    signal(SIGPIPE, SIG_IGN);
+    for (int k = 0; k < SERVER_KEY_LOG; k++)
+        RL.keys[k].fd = -1;
+
+    while (1)
+    {
+        struct pollfd fds[3 + SERVER_MAX_CLIENTS];
+        int count = RL.count;
+
+        fds[0] = (struct pollfd){listener, POLLIN, 0};
+        fds[1] = (struct pollfd){RL.master.fd, POLLIN | (RL.master.outLen ? POLLOUT : 0), 0};
+        fds[2] = (struct pollfd){RL.ctl.fd, POLLIN, 0};
+        for (int i = 0; i < count; i++)
+            fds[3 + i] = (struct pollfd){RL.clients[i].fd, POLLIN | (RL.clients[i].outLen ? POLLOUT : 0), 0};
+
+        if (poll(fds, 3 + count, -1) == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        if (fds[1].revents & POLLIN)
+        {
+            char buf[1 << 16];
+            ssize_t n = read(RL.master.fd, buf, sizeof(buf));
+            if (n > 0)
+                serverBroadcast(buf, n);
+        }
+        if (fds[1].revents & POLLOUT)
+            serverFlush(&RL.master);
+
+        // the broadcast may have dropped clients, so each is looked up again
+        for (int i = count - 1; i >= 0; i--)
+        {
+            int at = serverFind(fds[3 + i].fd);
+            short revents = fds[3 + i].revents;
+            if (at == -1)
+                continue;
+            if ((revents & POLLOUT) && serverFlush(&RL.clients[at]) == -1)
+                serverDrop(at);
+            else if ((revents & (POLLIN | POLLHUP | POLLERR)) && serverReceive(&RL.clients[at], serverFromClient) == -1)
+                serverDrop(at);
+        }
+
+        if (fds[2].revents && serverReceive(&RL.ctl, serverFromEditor) == -1)
+            break;
+        if (fds[0].revents & POLLIN)
+            serverAccept(listener);
+    }
+
+    unlink(path);
+    while (RL.count > 0)
+        serverDrop(RL.count - 1);
+    wait(NULL);
+}
+
+// editor
+
+static void serverFromRelay(struct server_link *link, int type, char *data, size_t len)
+{
+    (void)link;
+
+    switch (type)
+    {
+    case SERVER_OPEN:
+        // a later command line replaces one not opened yet
+        if (len == 0 || data[len - 1] != '\0')
+            break;
+        SV.pending = matRealloc(ALLOC_PROMPT, SV.pending, len);
+        memcpy(SV.pending, data, len);
+        SV.pendingLen = len;
+        break;
+
+    case SERVER_REDRAW:
+        screenInvalidate();
+        refreshScreen();
+        break;
+
+    case SERVER_STOP:
+        outputFlush();
+        write(STDOUT_FILENO, "\x1b[2J", 4);
+        write(STDOUT_FILENO, "\x1b[H", 3);
+        exit(0);
+    }
+}
+
+static void serverControl(int fd, short revents, void *arg)
+{
+    (void)fd;
+    (void)revents;
+    (void)arg;
+
+    // with the relay gone nobody can reach the editor any more
+    if (serverReceive(&SV.link, serverFromRelay) == -1)
+        exit(0);
+}
+
+// Opens the command line a client sent. Called from idleTick while no prompt
+// is up, since a prompt keeps pointers into the current buffer's rows.
+void serverPoll()
+{
+    if (SV.pending == NULL)
+        return;
+
+    int argc = 1;
+    for (size_t i = 0; i < SV.pendingLen; i++)
+        if (SV.pending[i] == '\0')
+            argc++;
+
+    char **argv = matMalloc(ALLOC_PROMPT, sizeof(char *) * argc);
+    char *s = SV.pending;
+    argv[0] = "mat";
+    for (int i = 1; i < argc; i++, s += strlen(s) + 1)
+        argv[i] = s;
+
+    openArgs(argc, argv);
+    matFree(argv);
+    matFree(SV.pending);
+    SV.pending = NULL;
+    refreshScreen();
+}
+
+int serverActive()
+{
+    return SV.link.fd != -1;
+}
+
+// In server mode quitting lets go of the client that asked instead of
+// ending the editor, whose buffers stay loaded for the next one.
+int serverDetach()
+{
+    if (SV.link.fd == -1)
+        return 0;
+    uint64_t taken = inputTaken();
+    serverSend(SV.link.fd, SERVER_DETACH, &taken, sizeof(taken));
+    return 1;
+}
+
+// Forks the editor onto a new pseudo-terminal and runs the relay in this
+// process. Returns only in the editor.
+static int serverStart(int listener, const char *path, struct winsize *ws)
+{
+    int pair[2];
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master == -1 || grantpt(master) == -1 || unlockpt(master) == -1 ||
+        socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == -1)
+    {
+        unlink(path);
+        exit(1);
+    }
+    fcntl(pair[0], F_SETFD, FD_CLOEXEC);
+    fcntl(pair[1], F_SETFD, FD_CLOEXEC);
+    ioctl(master, TIOCSWINSZ, ws);
+
+    // the relay keeps the terminal open as well, so reading the master does
+    // not fail before the editor has opened it or after it exits
+    int slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+    pid_t pid = slave == -1 ? -1 : fork();
+
+    if (pid == 0)
+    {
+        close(listener);
+        close(master);
+        close(pair[0]);
+
+        setsid();
+        ioctl(slave, TIOCSCTTY, 0);
+        dup2(slave, STDIN_FILENO);
+        dup2(slave, STDOUT_FILENO);
+        dup2(slave, STDERR_FILENO);
+        if (slave > STDERR_FILENO)
+            close(slave);
+
+        SV.link.fd = pair[1];
+        eventWatch(pair[1], POLLIN, serverControl, NULL);
+        return SERVER_EDITOR;
+    }
+
+    close(pair[1]);
+    if (pid == -1)
+    {
+        unlink(path);
+        exit(1);
+    }
+
+    fcntl(master, F_SETFL, O_NONBLOCK);
+    RL.master.fd = master;
+    RL.ctl.fd = pair[0];
+    RL.rows = ws->ws_row;
+    RL.cols = ws->ws_col;
+    serverRelay(listener, path);
+    exit(0);
+}
+
+// Starts a server detached from this terminal. The socket is bound here so
+// the caller can connect as soon as this returns. Returns 0 in the client,
+// -1 when no server could be started, and SERVER_EDITOR in the editor.
+static int serverSpawn(struct sockaddr_un *addr)
+{
+    struct winsize ws = {24, 80, 0, 0};
+    ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener == -1)
+        return -1;
+    fcntl(listener, F_SETFD, FD_CLOEXEC);
+
+    mode_t mask = umask(077);
+    int bound = bind(listener, (struct sockaddr *)addr, sizeof(*addr));
+    umask(mask);
+    if (bound == -1 || listen(listener, SERVER_MAX_CLIENTS) == -1)
+    {
+        int err = errno;
+        close(listener);
+        errno = err;
+        return err == EADDRINUSE ? 0 : -1; // another client got there first
+    }
+
+    pid_t pid = fork();
+    if (pid == -1)
+    {
+        int err = errno;
+        close(listener);
+        unlink(addr->sun_path);
+        errno = err;
+        return -1;
+    }
+    if (pid > 0)
+    {
+        close(listener);
+        waitpid(pid, NULL, 0);
+        return 0;
+    }
+
+    // this process only leaves the session; its child, the relay, is not a
+    // session leader and cannot pick up a controlling terminal by accident
+    setsid();
+    int null = open("/dev/null", O_RDWR);
+    dup2(null, STDIN_FILENO);
+    dup2(null, STDOUT_FILENO);
+    dup2(null, STDERR_FILENO);
+    if (null > STDERR_FILENO)
+        close(null);
+    if (fork() != 0)
+        _exit(0);
+
+    return serverStart(listener, addr->sun_path, &ws);
+}
+
+static int serverConnect(struct sockaddr_un *addr)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1)
+        return -1;
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    if (connect(fd, (struct sockaddr *)addr, sizeof(*addr)) == 0)
+    {
+        if (serverPeerOwned(fd))
+            return fd;
+        errno = EACCES;
+    }
+
+    int err = errno;
+    close(fd);
+    errno = err;
+    return -1;
+}
+
+// client
+
+static volatile sig_atomic_t serverResized;
+
+static void serverOnResize(int sig)
+{
+    (void)sig;
+    serverResized = 1;
+}
+
+static void serverSendSize(int fd)
+{
+    struct winsize ws;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0)
+        return;
+    uint32_t size[2] = {ws.ws_row, ws.ws_col};
+    serverSend(fd, SERVER_SIZE, size, sizeof(size));
+}
+
+// Copies keys to the server and its screen back until the server lets go.
+static int serverClient(int fd)
+{
+    struct termios orig, raw;
+    if (tcgetattr(STDIN_FILENO, &orig) == -1)
+    {
+        perror("mat: tcgetattr");
+        return 1;
+    }
+
+    raw = orig;
+    raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+    raw.c_oflag &= ~(OPOST);
+    raw.c_cflag |= (CS8);
+    raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw);
+
+    // without SA_RESTART so a resize wakes up poll
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = serverOnResize;
+    sigaction(SIGWINCH, &sa, NULL);
+    serverSendSize(fd);
+
+    while (1)
+    {
+        if (serverResized)
+        {
+            serverResized = 0;
+            serverSendSize(fd);
+        }
+
+        struct pollfd fds[2] = {{STDIN_FILENO, POLLIN, 0}, {fd, POLLIN, 0}};
+        if (poll(fds, 2, -1) == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        char buf[1 << 16];
+        ssize_t n;
+        if (fds[1].revents)
+        {
+            n = read(fd, buf, sizeof(buf));
+            if (n <= 0 || serverWriteAll(STDOUT_FILENO, buf, n) == -1)
+                break;
+        }
+        if (fds[0].revents)
+        {
+            n = read(STDIN_FILENO, buf, sizeof(buf));
+            if (n <= 0 || serverSend(fd, SERVER_KEYS, buf, n) == -1)
+                break;
+        }
+    }
+
+    tcsetattr(STDIN_FILENO, TCSAFLUSH, &orig);
+    write(STDOUT_FILENO, "\x1b[2J", 4);
+    write(STDOUT_FILENO, "\x1b[H", 3);
+    return 0;
+}
+
+// `mat -s [args]` opens args in the server, starting one when none is
+// running, and `mat -s -k` stops it. Returns the exit status, or
+// SERVER_EDITOR in the process that is to run the server's editor.
+int serverMain(int argc, char *argv[])
+{
+    struct sockaddr_un addr;
+    if (serverAddress(&addr) == -1)
+        return 1;
+
+    // file names are made absolute, the server has a working directory of
+    // its own and tells buffers apart by name
+    struct abuf args = {NULL, 0};
+    int stop = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        char path[PATH_MAX], cwd[PATH_MAX];
+        const char *arg = argv[i];
+
+        if (strcmp(arg, "-s") == 0)
+            continue;
+        if (strcmp(arg, "-k") == 0)
+        {
+            stop = 1;
+            continue;
+        }
+        if (strcmp(arg, "-") == 0)
+        {
+            fprintf(stderr, "mat: the server cannot read stdin\n");
+            abFree(&args);
+            return 1;
+        }
+        if (arg[0] != '+' && arg[0] != '-')
+        {
+            if (realpath(arg, path))
+                arg = path;
+            else if (arg[0] != '/' && getcwd(cwd, sizeof(cwd)) && strlen(cwd) + strlen(arg) + 2 <= sizeof(path))
+            {
+                strcpy(path, cwd);
+                strcat(path, "/");
+                strcat(path, arg);
+                arg = path;
+            }
+        }
+        abAppend(&args, arg, strlen(arg) + 1);
+    }
+
+    int fd = serverConnect(&addr);
+    if (fd == -1 && errno == EACCES)
+    {
+        fprintf(stderr, "mat: %s is served by another user\n", addr.sun_path);
+        abFree(&args);
+        return 1;
+    }
+    if (fd == -1 && stop)
+    {
+        fprintf(stderr, "mat: no server at %s\n", addr.sun_path);
+        abFree(&args);
+        return 1;
+    }
+    if (fd == -1)
+    {
+        // a socket nobody listens on is left from a server that died
+        if (errno == ECONNREFUSED)
+            unlink(addr.sun_path);
+
+        int spawned = serverSpawn(&addr);
+        if (spawned == SERVER_EDITOR)
+        {
+            abFree(&args);
+            return SERVER_EDITOR;
+        }
+        if (spawned == -1)
+        {
+            fprintf(stderr, "mat: cannot start a server at %s: %s\n", addr.sun_path, strerror(errno));
+            abFree(&args);
+            return 1;
+        }
+
+        // a server another client started may take a moment to listen
+        for (int tries = 0; spawned == 0 && fd == -1 && tries < 50; tries++)
+            if ((fd = serverConnect(&addr)) == -1)
+                usleep(10000);
+    }
+    if (fd == -1)
+    {
+        perror("mat: server");
+        abFree(&args);
+        return 1;
+    }
+
+    if (stop)
+    {
+        char c;
+        serverSend(fd, SERVER_STOP, NULL, 0);
+        while (read(fd, &c, 1) > 0)
+            ;
+    }
+    else
+    {
+        serverSend(fd, SERVER_OPEN, args.b, args.len);
+        serverClient(fd);
+    }
+
+    abFree(&args);
+    close(fd);
+    return 0;
+}
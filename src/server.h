@@ -0,0 +1,19 @@
+#pragma once
+
+// what serverMain returns in the process that goes on to run the editor,
+// apart from an exit status and from the -1 of a server that failed to start
+#define SERVER_EDITOR -2
+// most clients one server shows its screen to
+#define SERVER_MAX_CLIENTS 16
+// batches of keys the relay remembers the senders of
+#define SERVER_KEY_LOG 64
+// largest message a client sends, a command line of file names at most
+#define SERVER_MSG_MAX (64 << 10)
+// screen bytes a slow client may fall behind by before it is sent a whole
+// frame instead
+#define SERVER_QUEUE_MAX (4 << 20)
+
+int serverMain(int argc, char *argv[]);
+int serverActive();
+int serverDetach();
+void serverPoll();
@@ -1,14 +1,29 @@
+#include "buffer.h"
 #include "mat.h"
+#include "pager.h"
+#include "screen.h"
 #include "syntax.h"
 
 #include <stdio.h>
 #include <string.h>
 
 extern struct config E;
+extern struct buffers B;
 
-void drawStatus(struct abuf *ab)
+// terminal columns taken by UTF-8 text, counting every character as one
+static int statusWidth(const char *s, int len)
 {
-    char status[80], rstatus[80];
+    int width = 0;
+    for (int i = 0; i < len; i++)
+        if (((unsigned char)s[i] & 0xc0) != 0x80)
+            width++;
+    return width;
+}
+
+void drawStatus(struct frame *f)
+{
+    struct abuf *ab = &f->ab;
+    char status[80], rstatus[80], bufinfo[24] = "";
     char *language_symbol;
 
     if (E.current_file_extension == NULL)
@@ -25,10 +40,16 @@ void drawStatus(struct abuf *ab)
     const char *foreground_color = hexToAnsiFore("#9399b2");
     abAppend(ab, foreground_color, strlen(foreground_color));
 
-    int len = snprintf(status, sizeof(status), " %s Mat | %s ", language_symbol, E.current_mode == NORMAL ? "NORMAL" : "INSERT");
+    static const char *modes[] = {"NORMAL", "INSERT", "VISUAL", "V-LINE"};
+    int len = snprintf(status, sizeof(status), " %s Mat | %s ", language_symbol, modes[E.current_mode]);
 
-    int rlen = snprintf(rstatus, sizeof(rstatus), " %s %s%s - %d/%d ",
-                        "", E.current_file_name, E.dirty ? " *" : "", E.cy, E.numRws);
+    if (B.count > 1)
+        snprintf(bufinfo, sizeof(bufinfo), "[%d/%d] ", B.current + 1, B.count);
+
+    int rlen = snprintf(rstatus, sizeof(rstatus), " %s %s%s%s - %lld/%lld ",
+                        "", bufinfo,
+                        E.current_file_name ? E.current_file_name : "[No Name]", E.dirty ? " *" : "",
+                        E.pager ? pagerPosition() : E.cy, E.pager ? pagerLines() : E.numRws);
 
     if (len > E.screenCls)
         len = E.screenCls;
@@ -37,9 +58,13 @@ void drawStatus(struct abuf *ab)
 
     abAppend(ab, "\x1b[m", 3);
 
-    while (len < E.screenCls)
+    // pad by columns rather than bytes, the icons take several bytes each
+    int width = statusWidth(status, len);
+    int rwidth = statusWidth(rstatus, rlen);
+
+    while (width < E.screenCls)
     {
-        if (E.screenCls - len == rlen)
+        if (E.screenCls - width == rwidth)
         {
             abAppend(ab, foreground_color, strlen(foreground_color));
             abAppend(ab, rstatus, rlen);
@@ -48,10 +73,10 @@ void drawStatus(struct abuf *ab)
         else
         {
             abAppend(ab, " ", 1);
-            len++;
+            width++;
         }
     }
 
     abAppend(ab, "\x1b[m", 3);
-    abAppend(ab, "\r\n", 2);
+    frameEndLine(f);
 }
@@ -0,0 +1,241 @@
+#include "stream.h"
+#include "alloc.h"
+#include "buffer.h"
+#include "event.h"
+#include "mat.h"
+#include "undo.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+extern struct config E;
+extern struct buffers B;
+
+#define STREAM_CHUNK (1 << 20)
+
+// `mat -` reads its input on a background thread so the editor is usable
+// from the first frame. Two chunk buffers circulate: the reader fills one
+// while the main thread turns the other into rows. The reader stalls only
+// when both are full, which leaves the writer on the other end of the pipe
+// blocked rather than growing memory.
+static struct
+{
+    int fd;      // the input, stdin as it was before the terminal replaced it
+    int wake[2]; // the reader writes a byte here whenever a chunk is ready
+    int buffer;  // buffer the rows go to
+    int attached, started;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t taken;
+
+    char *fill, *ready, *spare; // the reader's chunk, the handed over one, a free one
+    size_t flen, rlen;
+    int eof;
+
+    char *work; // chunk being turned into rows on the main thread
+    size_t wlen;
+    char *partial; // an unterminated last line carried over to the next chunk
+    size_t plen;
+    size_t bytes;
+} ST;
+
+// Keeps a piped stdin for the reader and puts the terminal in its place, so
+// raw mode and key reads work as usual. Must run before enableRawMode.
+int streamAttach()
+{
+    if (isatty(STDIN_FILENO))
+        return -1;
+
+    int tty = open("/dev/tty", O_RDWR | O_NOCTTY);
+    if (tty == -1)
+        return -1;
+
+    ST.fd = dup(STDIN_FILENO);
+    if (ST.fd == -1 || dup2(tty, STDIN_FILENO) == -1)
+        die("stdin");
+    close(tty);
+    fcntl(ST.fd, F_SETFD, FD_CLOEXEC);
+    ST.attached = 1;
+    return 0;
+}
+
+static void *streamReader(void *arg)
+{
+    (void)arg;
+
+    int eof = 0;
+    while (!eof)
+    {
+        ssize_t n = read(ST.fd, ST.fill + ST.flen, STREAM_CHUNK - ST.flen);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n > 0)
+            ST.flen += n;
+        else
+            eof = 1;
+
+        pthread_mutex_lock(&ST.lock);
+        // keep reading into the same chunk while the last one is unclaimed,
+        // and wait for it only when there is no room left
+        while ((ST.ready != NULL || ST.spare == NULL) && (ST.flen == STREAM_CHUNK || eof))
+            pthread_cond_wait(&ST.taken, &ST.lock);
+        if (ST.ready == NULL && ST.spare != NULL)
+        {
+            ST.ready = ST.fill;
+            ST.rlen = ST.flen;
+            ST.eof = eof;
+            ST.fill = ST.spare;
+            ST.flen = 0;
+            ST.spare = NULL;
+            ssize_t w = write(ST.wake[1], "", 1);
+            (void)w;
+        }
+        pthread_mutex_unlock(&ST.lock);
+    }
+
+    return NULL;
+}
+
+// appends one chunk to the end of the buffer, called with its state in E
+static void streamAppend(void *arg)
+{
+    int eof = *(int *)arg;
+    char *s = ST.work, *end = ST.work + ST.wlen;
+    int dirty = E.dirty;
+
+    undoSuspend(1);
+
+    // finish the line the previous chunk ended in the middle of
+    if (ST.plen > 0)
+    {
+        char *nl = memchr(s, '\n', end - s);
+        size_t n = (nl ? nl + 1 : end) - s;
+        ST.partial = matRealloc(ALLOC_ROWS, ST.partial, ST.plen + n);
+        memcpy(ST.partial + ST.plen, s, n);
+        ST.plen += n;
+        s += n;
+        if (nl)
+        {
+            insertRwsBlock(E.numRws, ST.partial, ST.plen);
+            ST.plen = 0;
+        }
+    }
+
+    // whole lines up to the last newline, found from the end by hand since
+    // memrchr is not everywhere
+    char *rest = end;
+    while (rest > s && rest[-1] != '\n')
+        rest--;
+    if (rest > s)
+    {
+        insertRwsBlock(E.numRws, s, rest - s);
+        s = rest;
+    }
+
+    if (s < end)
+    {
+        size_t n = end - s;
+        ST.partial = matRealloc(ALLOC_ROWS, ST.partial, ST.plen + n);
+        memcpy(ST.partial + ST.plen, s, n);
+        ST.plen += n;
+    }
+
+    if (eof && ST.plen > 0)
+    {
+        insertRws(E.numRws, ST.partial, ST.plen);
+        ST.plen = 0;
+    }
+
+    undoSuspend(0);
+    E.dirty = dirty;
+}
+
+static void streamFinish()
+{
+    eventWatch(ST.wake[0], 0, NULL, NULL);
+    pthread_join(ST.thread, NULL);
+    close(ST.wake[0]);
+    close(ST.wake[1]);
+    close(ST.fd);
+
+    matFree(ST.fill);
+    matFree(ST.spare);
+    matFree(ST.work);
+    matFree(ST.partial);
+    ST.fill = ST.spare = ST.work = ST.partial = NULL;
+    ST.attached = 0;
+}
+
+static void streamReadable(int fd, short revents, void *arg)
+{
+    (void)revents;
+    (void)arg;
+
+    char drain[16];
+    if (read(fd, drain, sizeof(drain)) <= 0)
+        return;
+
+    pthread_mutex_lock(&ST.lock);
+    char *chunk = ST.ready;
+    size_t len = ST.rlen;
+    int eof = ST.eof;
+    ST.ready = NULL;
+    pthread_mutex_unlock(&ST.lock);
+
+    if (chunk == NULL)
+        return;
+
+    ST.work = chunk;
+    ST.wlen = len;
+    ST.bytes += len;
+    bufferRun(ST.buffer, streamAppend, &eof);
+
+    pthread_mutex_lock(&ST.lock);
+    ST.spare = ST.work;
+    ST.work = NULL;
+    pthread_cond_signal(&ST.taken);
+    pthread_mutex_unlock(&ST.lock);
+
+    int lines = ST.buffer == B.current ? E.numRws : B.b[ST.buffer].state.numRws;
+    if (eof)
+    {
+        streamFinish();
+        setStatusMessage("stdin: %d lines, %.1f MB", lines, ST.bytes / 1048576.0);
+    }
+    else
+        setStatusMessage("reading stdin... %d lines, %.1f MB", lines, ST.bytes / 1048576.0);
+
+    if (ST.buffer == B.current)
+        refreshScreen();
+}
+
+// Starts reading the input kept by streamAttach into a new buffer.
+void streamOpen()
+{
+    if (!ST.attached || ST.started)
+        return;
+    ST.started = 1;
+
+    if (pipe(ST.wake) == -1)
+        die("pipe");
+    fcntl(ST.wake[0], F_SETFD, FD_CLOEXEC);
+    fcntl(ST.wake[1], F_SETFD, FD_CLOEXEC);
+
+    ST.buffer = bufferNew();
+    ST.fill = matMalloc(ALLOC_ROWS, STREAM_CHUNK);
+    ST.spare = matMalloc(ALLOC_ROWS, STREAM_CHUNK);
+    ST.ready = NULL;
+    ST.flen = ST.rlen = 0;
+    pthread_mutex_init(&ST.lock, NULL);
+    pthread_cond_init(&ST.taken, NULL);
+
+    if (pthread_create(&ST.thread, NULL, streamReader, NULL) != 0)
+        die("pthread_create");
+
+    eventWatch(ST.wake[0], POLLIN, streamReadable, NULL);
+    setStatusMessage("reading stdin...");
+}
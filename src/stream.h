@@ -0,0 +1,4 @@
+#pragma once
+
+int streamAttach();
+void streamOpen();
@@ -0,0 +1,236 @@
+#include "substitute.h"
+#include "mat.h"
+
+#include <ctype.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+extern struct config E;
+
+struct substitute_scan
+{
+    int from, to;
+    const char *pat;
+    size_t patlen;
+    unsigned char *hit;
+    pthread_t thread;
+};
+
+// Marks the rows of [from, to) that contain the pattern. Workers only read
+// row text and write their own slice of `hit`, so they need no locking.
+static void *substituteScan(void *arg)
+{
+    struct substitute_scan *s = arg;
+    for (int j = s->from; j < s->to; j++)
+        s->hit[j - s->from] = memmem(E.row[j].chars, E.row[j].size, s->pat, s->patlen) != NULL;
+    return NULL;
+}
+
+static unsigned char *substituteFind(int from, int to, const char *pat, size_t patlen)
+{
+    int rows = to - from;
+    unsigned char *hit = matMalloc(ALLOC_SEARCH, rows + 1);
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads = rows / SUBSTITUTE_MIN_ROWS;
+    if (threads > cpus)
+        threads = cpus;
+    if (threads > SUBSTITUTE_MAX_THREADS)
+        threads = SUBSTITUTE_MAX_THREADS;
+    if (threads < 1)
+        threads = 1;
+
+    struct substitute_scan scans[SUBSTITUTE_MAX_THREADS];
+    for (int t = 0; t < threads; t++)
+    {
+        struct substitute_scan *s = &scans[t];
+        s->from = from + (long)rows * t / threads;
+        s->to = from + (long)rows * (t + 1) / threads;
+        s->pat = pat;
+        s->patlen = patlen;
+        s->hit = hit + (s->from - from);
+    }
+
+    int started = 1;
+    for (; started < threads; started++)
+        if (pthread_create(&scans[started].thread, NULL, substituteScan, &scans[started]) != 0)
+            break;
+
+    // the calling thread takes the first slice, and any a thread could not
+    // be started for
+    substituteScan(&scans[0]);
+    for (int t = started; t < threads; t++)
+        substituteScan(&scans[t]);
+    for (int t = 1; t < started; t++)
+        pthread_join(scans[t].thread, NULL);
+
+    return hit;
+}
+
+// Copies the next delimited field of a command, dropping the backslash from
+// escaped delimiters. Returns the rest of the command, or NULL when the field
+// is unterminated and `last` is not set.
+static char *substituteField(char *p, char delim, char **out, int last)
+{
+    char *w = p;
+    *out = p;
+    while (*p && *p != delim)
+    {
+        if (*p == '\\' && p[1] == delim)
+            p++;
+        *w++ = *p++;
+    }
+    if (*p == '\0' && !last)
+        return NULL;
+    if (*p)
+        p++;
+    *w = '\0';
+    return p;
+}
+
+static char *substituteAddress(char *p, int *line)
+{
+    if (*p == '.')
+    {
+        *line = E.cy + 1;
+        return p + 1;
+    }
+    if (*p == '$')
+    {
+        *line = E.numRws;
+        return p + 1;
+    }
+    if (isdigit((unsigned char)*p))
+    {
+        *line = strtol(p, &p, 10);
+        return p;
+    }
+    return NULL;
+}
+
+// Reads the range a command starts with: %, a line or two lines separated
+// by a comma, each a number, . or $. Lines are 1-based and default to the
+// cursor line. Returns the rest of the command, or NULL for a broken range.
+char *substituteRange(char *cmd, int *first, int *last)
+{
+    char *p;
+
+    *first = *last = E.cy + 1;
+    if (*cmd == '%')
+    {
+        *first = 1;
+        *last = E.numRws;
+        return cmd + 1;
+    }
+    if ((p = substituteAddress(cmd, first)) == NULL)
+        return cmd;
+    *last = *first;
+    if (*p == ',')
+        return substituteAddress(p + 1, last);
+    return p;
+}
+
+// Handles [range]s/pattern/replacement/[g]. Returns 0 when cmd is not a
+// substitute.
+int substituteCommand(char *cmd)
+{
+    int first, last;
+    char *p = substituteRange(cmd, &first, &last);
+
+    if (p == NULL)
+        return 0;
+    if (*p != 's' || p[1] == '\0' || isalnum((unsigned char)p[1]) || isspace((unsigned char)p[1]))
+        return 0;
+
+    char delim = p[1];
+    char *pat, *rep;
+    p = substituteField(p + 2, delim, &pat, 0);
+    if (p == NULL || *pat == '\0')
+    {
+        setStatusMessage("Usage: [range]s/pattern/replacement/[g]");
+        return 1;
+    }
+    p = substituteField(p, delim, &rep, 1);
+    int global = strchr(p, 'g') != NULL;
+
+    if (first < 1)
+        first = 1;
+    if (last > E.numRws)
+        last = E.numRws;
+    if (first > last)
+    {
+        setStatusMessage("Pattern not found: %s", pat);
+        return 1;
+    }
+
+    size_t patlen = strlen(pat), replen = strlen(rep);
+    unsigned char *hit = substituteFind(first - 1, last, pat, patlen);
+
+    // each matching row is rebuilt once and handed over whole, so it is
+    // re-rendered and re-highlighted once however many matches it has
+    char *buf = NULL;
+    size_t cap = 0;
+    long subs = 0, lines = 0;
+
+    for (int j = first - 1; j < last; j++)
+    {
+        if (!hit[j - first + 1])
+            continue;
+
+        erow *row = &E.row[j];
+        char *s = row->chars, *end = row->chars + row->size;
+        size_t len = 0;
+
+        while (s < end)
+        {
+            char *m = memmem(s, end - s, pat, patlen);
+            size_t keep = m ? (size_t)(m - s) : (size_t)(end - s);
+            size_t need = len + keep + (m ? replen : 0);
+            if (need > cap)
+            {
+                cap = need * 2;
+                buf = matRealloc(ALLOC_SEARCH, buf, cap);
+            }
+
+            memcpy(buf + len, s, keep);
+            len += keep;
+            if (m == NULL)
+                break;
+
+            memcpy(buf + len, rep, replen);
+            len += replen;
+            subs++;
+            s = m + patlen;
+
+            if (!global)
+            {
+                size_t rest = end - s;
+                if (len + rest > cap)
+                {
+                    cap = len + rest;
+                    buf = matRealloc(ALLOC_SEARCH, buf, cap);
+                }
+                memcpy(buf + len, s, rest);
+                len += rest;
+                break;
+            }
+        }
+
+        rwsSetLine(row, lineNew(buf ? buf : "", len), len);
+        lines++;
+        E.cy = j;
+        E.cx = 0;
+    }
+
+    matFree(buf);
+    matFree(hit);
+
+    if (subs == 0)
+        setStatusMessage("Pattern not found: %s", pat);
+    else
+        setStatusMessage("%ld substitution%s on %ld line%s", subs, subs == 1 ? "" : "s",
+                         lines, lines == 1 ? "" : "s");
+    return 1;
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+// rows per worker below which the scan is not split across threads
+#define SUBSTITUTE_MIN_ROWS 8192
+#define SUBSTITUTE_MAX_THREADS 16
+
+char *substituteRange(char *cmd, int *first, int *last);
+int substituteCommand(char *cmd);
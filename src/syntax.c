@@ -1,24 +1,16 @@
-#include <stdio.h>
-
-struct syntax
-{
-    char *filetype;
-    char **filematch;
+#include "lexer.h"
+#include "mat.h"
+#include "syntax.h"
 
-    char **keywords;
-    char *singleline_comment_start;
-    char *multiline_comment_start;
-    char *multiline_comment_end;
-
-    int flags;
-};
-
-// data
-#define HL_HIGHLIGHT_NUMBERS (1 << 0)
-#define HL_HIGHLIGHT_STRINGS (1 << 1)
+#include <ctype.h>
+#include <dirent.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 // filetypes
-char *C_HL_extensions[] = {".c", ".h", ".cpp"};
+char *C_HL_extensions[] = {".c", ".h", ".cpp", NULL};
 
 char *C_HL_keywords[] = {
     "switch", "if", "while", "for", "break", "continue", "return", "else",
@@ -27,16 +19,172 @@ char *C_HL_keywords[] = {
     "int|", "long|", "double|", "float|", "char|", "unsigned|", "signed|",
     "void|", "struct|", "enum|", "const|", "#define|", "#include|", NULL};
 
-struct syntax HLDB[] = {
+struct syntax HLDB_BUILTIN[] = {
     {"c",
      C_HL_extensions,
      C_HL_keywords,
      "//",
      "/*", "*/",
-     HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS},
+     HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS,
+     NULL, NULL, NULL},
 };
 
-#define HLDB_ENTRIES (sizeof(HLDB) / sizeof(HLDB[0]))
+#define HLDB_BUILTIN_ENTRIES (sizeof(HLDB_BUILTIN) / sizeof(HLDB_BUILTIN[0]))
+
+// loaded definitions come first so they can override the built-in ones
+struct syntax *HLDB;
+unsigned int HLDB_ENTRIES;
+
+static void syntaxPush(char ***list, int *count, const char *word, int kw2)
+{
+    int len = strlen(word);
+    char *copy = matMalloc(ALLOC_SYNTAX, len + 2);
+    memcpy(copy, word, len);
+    copy[len] = '|';
+    copy[len + kw2] = '\0';
+
+    *list = matRealloc(ALLOC_SYNTAX, *list, sizeof(char *) * (*count + 2));
+    (*list)[(*count)++] = copy;
+    (*list)[*count] = NULL;
+}
+
+static char *syntaxString(const char *s)
+{
+    char *copy = matMalloc(ALLOC_SYNTAX, strlen(s) + 1);
+    strcpy(copy, s);
+    return copy;
+}
+
+// A definition file is a list of "key value..." lines:
+//
+//   filetype   python
+//   match      .py SConstruct
+//   keywords   if elif else while for def return
+//   types      int str float
+//   comment    #
+//   multiline  """ """
+//   strings    "'
+//   numbers
+//
+// Blank lines and lines starting with # are ignored.
+static int syntaxLoadFile(const char *path, struct syntax *s)
+{
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+        return -1;
+
+    memset(s, 0, sizeof(*s));
+    int nmatch = 0, nkeywords = 0;
+    char line[1024];
+
+    while (fgets(line, sizeof(line), fp))
+    {
+        char *save, *key = strtok_r(line, " \t\r\n", &save);
+        if (key == NULL || key[0] == '#')
+            continue;
+
+        char *arg = strtok_r(NULL, " \t\r\n", &save);
+
+        if (!strcmp(key, "filetype") && arg)
+            s->filetype = syntaxString(arg);
+        else if (!strcmp(key, "match"))
+            for (; arg; arg = strtok_r(NULL, " \t\r\n", &save))
+                syntaxPush(&s->filematch, &nmatch, arg, 0);
+        else if (!strcmp(key, "keywords") || !strcmp(key, "types"))
+            for (; arg; arg = strtok_r(NULL, " \t\r\n", &save))
+                syntaxPush(&s->keywords, &nkeywords, arg, key[0] == 't');
+        else if (!strcmp(key, "comment") && arg)
+            s->singleline_comment_start = syntaxString(arg);
+        else if (!strcmp(key, "multiline") && arg)
+        {
+            char *end = strtok_r(NULL, " \t\r\n", &save);
+            if (end)
+            {
+                s->multiline_comment_start = syntaxString(arg);
+                s->multiline_comment_end = syntaxString(end);
+            }
+        }
+        else if (!strcmp(key, "strings"))
+        {
+            s->flags |= HL_HIGHLIGHT_STRINGS;
+            if (arg)
+                s->quotes = syntaxString(arg);
+        }
+        else if (!strcmp(key, "numbers"))
+            s->flags |= HL_HIGHLIGHT_NUMBERS;
+        else if (!strcmp(key, "separators") && arg)
+            s->separators = syntaxString(arg);
+    }
+    fclose(fp);
+
+    if (s->filetype == NULL || s->filematch == NULL)
+        return -1;
+
+    return 0;
+}
+
+static void syntaxLoadDir(const char *dir)
+{
+    DIR *d = opendir(dir);
+    if (d == NULL)
+        return;
+
+    struct dirent *ent;
+    while ((ent = readdir(d)) != NULL)
+    {
+        int len = strlen(ent->d_name);
+        if (len < 8 || strcmp(ent->d_name + len - 7, ".syntax"))
+            continue;
+
+        char path[PATH_MAX];
+        struct syntax s;
+        snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+        if (syntaxLoadFile(path, &s) == -1)
+            continue;
+
+        HLDB = matRealloc(ALLOC_SYNTAX, HLDB, sizeof(struct syntax) * (HLDB_ENTRIES + 1));
+        HLDB[HLDB_ENTRIES++] = s;
+    }
+    closedir(d);
+}
+
+// Definitions are read from every directory in MAT_SYNTAX_PATH (colon
+// separated), or from $XDG_CONFIG_HOME/mat/syntax or ~/.config/mat/syntax,
+// and every definition is compiled to its lexer tables up front.
+void initSyntax()
+{
+    char dir[PATH_MAX];
+    const char *paths = getenv("MAT_SYNTAX_PATH");
+
+    if (paths)
+    {
+        const char *p = paths;
+        while (*p)
+        {
+            int len = strcspn(p, ":");
+            snprintf(dir, sizeof(dir), "%.*s", len, p);
+            syntaxLoadDir(dir);
+            p += len + (p[len] == ':');
+        }
+    }
+    else if (getenv("XDG_CONFIG_HOME"))
+    {
+        snprintf(dir, sizeof(dir), "%s/mat/syntax", getenv("XDG_CONFIG_HOME"));
+        syntaxLoadDir(dir);
+    }
+    else if (getenv("HOME"))
+    {
+        snprintf(dir, sizeof(dir), "%s/.config/mat/syntax", getenv("HOME"));
+        syntaxLoadDir(dir);
+    }
+
+    HLDB = matRealloc(ALLOC_SYNTAX, HLDB, sizeof(struct syntax) * (HLDB_ENTRIES + HLDB_BUILTIN_ENTRIES));
+    for (unsigned int j = 0; j < HLDB_BUILTIN_ENTRIES; j++)
+        HLDB[HLDB_ENTRIES++] = HLDB_BUILTIN[j];
+
+    for (unsigned int j = 0; j < HLDB_ENTRIES; j++)
+        HLDB[j].lexer = lexerCompile(&HLDB[j]);
+}
 
 const char *hexToAnsiBackground(const char *hex)
 {
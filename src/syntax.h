@@ -1,6 +1,44 @@
 #ifndef SYNTAX_H
 #define SYNTAX_H
 
+enum highlight
+{
+    HL_NORMAL = 0,
+    HL_COMMENT,
+    HL_MLCOMMENT,
+    HL_KEYWORD1,
+    HL_KEYWORD2,
+    HL_STRING,
+    HL_NUMBER,
+    HL_MATCH,
+    HL_VISUAL
+};
+
+#define HL_HIGHLIGHT_NUMBERS (1 << 0)
+#define HL_HIGHLIGHT_STRINGS (1 << 1)
+
+struct syntax
+{
+    char *filetype;
+    char **filematch;
+
+    char **keywords;
+    char *singleline_comment_start;
+    char *multiline_comment_start;
+    char *multiline_comment_end;
+
+    int flags;
+
+    char *quotes;
+    char *separators;
+    struct lexer *lexer;
+};
+
+extern struct syntax *HLDB;
+extern unsigned int HLDB_ENTRIES;
+
+void initSyntax();
+
 const char *hexToAnsiBackground(const char *hex);
 const char *hexToAnsiFore(const char *hex);
 
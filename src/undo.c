@@ -0,0 +1,202 @@
+#include "undo.h"
+#include "mat.h"
+
+#include <string.h>
+
+extern struct config E;
+
+// Undo keeps the replaced rows by reference to their text blocks, so
+// recording an edit costs a pointer per row; a block is only copied when the
+// row is changed while the undo history still holds it.
+static int undoSuspended;
+
+void undoSuspend(int on)
+{
+    undoSuspended += on ? 1 : -1;
+}
+
+static void undoFreeStep(struct undo_step *step)
+{
+    for (int i = 0; i < step->count; i++)
+    {
+        struct undo_record *rec = &step->recs[i];
+        for (int j = 0; j < rec->count; j++)
+            lineFree(rec->rows[j].chars);
+        matFree(rec->rows);
+    }
+    matFree(step->recs);
+}
+
+static void undoClearStack(struct undo_stack *s)
+{
+    for (int i = 0; i < s->count; i++)
+        undoFreeStep(&s->steps[i]);
+    s->count = 0;
+}
+
+void undoFree(struct undo *u)
+{
+    if (u == NULL)
+        return;
+    undoClearStack(&u->undo);
+    undoClearStack(&u->redo);
+    matFree(u->undo.steps);
+    matFree(u->redo.steps);
+    matFree(u);
+}
+
+static struct undo_step *undoPush(struct undo_stack *s)
+{
+    if (s->count == UNDO_LEVELS)
+    {
+        undoFreeStep(&s->steps[0]);
+        memmove(&s->steps[0], &s->steps[1], sizeof(struct undo_step) * --s->count);
+    }
+    if (s->count == s->cap)
+    {
+        s->cap = s->cap ? s->cap * 2 : 16;
+        s->steps = matRealloc(ALLOC_UNDO, s->steps, sizeof(struct undo_step) * s->cap);
+    }
+
+    struct undo_step *step = &s->steps[s->count++];
+    memset(step, 0, sizeof(*step));
+    step->cx = E.cx;
+    step->cy = E.cy;
+    return step;
+}
+
+static struct undo_record *undoAppend(struct undo_step *step, int at, int removed, int added)
+{
+    if (step->count == step->cap)
+    {
+        step->cap = step->cap ? step->cap * 2 : 4;
+        step->recs = matRealloc(ALLOC_UNDO, step->recs, sizeof(struct undo_record) * step->cap);
+    }
+
+    struct undo_record *rec = &step->recs[step->count++];
+    rec->at = at;
+    rec->n = added;
+    rec->count = removed;
+    rec->rows = removed ? matMalloc(ALLOC_UNDO, sizeof(struct line_slice) * removed) : NULL;
+
+    for (int j = 0; j < removed; j++)
+    {
+        rec->rows[j].chars = lineRef(E.row[at + j].chars);
+        rec->rows[j].from = 0;
+        rec->rows[j].to = E.row[at + j].size;
+    }
+    return rec;
+}
+
+// Called by the row functions before they replace `removed` rows at `at`
+// with `added` new ones.
+void undoRecord(int at, int removed, int added)
+{
+    if (undoSuspended)
+        return;
+
+    if (E.undo == NULL)
+    {
+        E.undo = matMalloc(ALLOC_UNDO, sizeof(struct undo));
+        memset(E.undo, 0, sizeof(struct undo));
+    }
+
+    struct undo *u = E.undo;
+    undoClearStack(&u->redo);
+
+    struct undo_step *step;
+    if (u->open && u->undo.count > 0)
+        step = &u->undo.steps[u->undo.count - 1];
+    else
+    {
+        step = undoPush(&u->undo);
+        u->open = 1;
+    }
+
+    // a row changed again within the same step already has its old text saved
+    if (removed == 1 && added == 1 && step->count > 0)
+    {
+        struct undo_record *last = &step->recs[step->count - 1];
+        if (last->at == at && last->n == 1 && last->count == 1)
+            return;
+    }
+
+    undoAppend(step, at, removed, added);
+}
+
+// ends the current step; the next edit starts a new one
+void undoBoundary()
+{
+    if (E.undo)
+        E.undo->open = 0;
+}
+
+// Applies the records of a step last to first, recording the inverse of
+// each into `into` so the step can be replayed the other way.
+static void undoApply(struct undo_step *step, struct undo_step *into)
+{
+    undoSuspend(1);
+
+    for (int i = step->count - 1; i >= 0; i--)
+    {
+        struct undo_record *rec = &step->recs[i];
+        undoAppend(into, rec->at, rec->n, rec->count);
+
+        if (rec->n == 1 && rec->count == 1)
+            rwsSetLine(&E.row[rec->at], lineRef(rec->rows[0].chars), rec->rows[0].to);
+        else
+        {
+            deleteRwsRange(rec->at, rec->n);
+            insertRwsSlices(rec->at, rec->rows, rec->count);
+        }
+
+        E.cy = rec->at;
+        E.cx = 0;
+    }
+
+    undoSuspend(0);
+}
+
+static void undoMove(struct undo_stack *from, struct undo_stack *to, const char *name)
+{
+    if (E.undo == NULL || from->count == 0)
+    {
+        setStatusMessage("Already at %s change", name);
+        return;
+    }
+
+    E.undo->open = 0;
+    struct undo_step step = from->steps[--from->count];
+    struct undo_step *inverse = undoPush(to);
+
+    undoApply(&step, inverse);
+    if (to == &E.undo->redo)
+    {
+        E.cx = step.cx;
+        E.cy = step.cy;
+    }
+    inverse->cx = step.cx;
+    inverse->cy = step.cy;
+    undoFreeStep(&step);
+
+    if (E.cy > E.numRws)
+        E.cy = E.numRws;
+    if (E.cy < E.numRws && E.cx > E.row[E.cy].size)
+        E.cx = E.row[E.cy].size;
+}
+
+void undo()
+{
+    if (E.undo)
+        undoMove(&E.undo->undo, &E.undo->redo, "oldest");
+    else
+        setStatusMessage("Already at oldest change");
+}
+
+void redo()
+{
+    if (E.undo)
+        undoMove(&E.undo->redo, &E.undo->undo, "newest");
+    else
+        setStatusMessage("Already at newest change");
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "line.h"
+
+// most undo steps kept per buffer
+#define UNDO_LEVELS 1000
+
+// Replacing rows [at, at + n) with `rows` reverts one row mutation.
+struct undo_record
+{
+    int at;
+    int n;
+    int count;
+    struct line_slice *rows;
+};
+
+// everything done by one command, or by one visit to INSERT mode
+struct undo_step
+{
+    struct undo_record *recs;
+    int count, cap;
+    int cx, cy;
+};
+
+struct undo_stack
+{
+    struct undo_step *steps;
+    int count, cap;
+};
+
+struct undo
+{
+    struct undo_stack undo, redo;
+    int open;
+};
+
+void undoRecord(int at, int removed, int added);
+void undoBoundary();
+void undoSuspend(int on);
+void undoFree(struct undo *u);
+void undo();
+void redo();
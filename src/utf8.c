@@ -0,0 +1,145 @@
+#include "utf8.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// True when no byte of s has its high bit set, sixteen bytes at a time.
+int utf8Ascii(const char *s, int len)
+{
+    int i = 0;
+#ifdef __SSE2__
+    __m128i any = _mm_setzero_si128();
+    for (; i + 16 <= len; i += 16)
+        any = _mm_or_si128(any, _mm_loadu_si128((const __m128i *)(s + i)));
+    if (_mm_movemask_epi8(any))
+        return 0;
+#endif
+    for (; i < len; i++)
+        if ((unsigned char)s[i] >= 0x80)
+            return 0;
+    return 1;
+}
+
+// Decodes the character at s into *cp and returns its length. A byte that
+// does not start a valid, shortest-form sequence is one character of its own
+// with *cp set to -1.
+int utf8Decode(const char *s, int len, int *cp)
+{
+    const unsigned char *u = (const unsigned char *)s;
+    int n, c;
+
+    if (u[0] < 0x80)
+    {
+        *cp = u[0];
+        return 1;
+    }
+    if (u[0] >= 0xc2 && u[0] <= 0xdf)
+        n = 2;
+    else if (u[0] >= 0xe0 && u[0] <= 0xef)
+        n = 3;
+    else if (u[0] >= 0xf0 && u[0] <= 0xf4)
+        n = 4;
+    else
+        n = 0;
+
+    if (n == 0 || n > len)
+    {
+        *cp = -1;
+        return 1;
+    }
+    c = u[0] & (0x7f >> n);
+    for (int i = 1; i < n; i++)
+    {
+        if ((u[i] & 0xc0) != 0x80)
+        {
+            *cp = -1;
+            return 1;
+        }
+        c = c << 6 | (u[i] & 0x3f);
+    }
+
+    // overlong forms, surrogates and anything past U+10FFFF
+    if ((n == 3 && c < 0x800) || (n == 4 && (c < 0x10000 || c > 0x10ffff)) || (c >= 0xd800 && c <= 0xdfff))
+    {
+        *cp = -1;
+        return 1;
+    }
+    *cp = c;
+    return n;
+}
+
+struct utf8_range
+{
+    int32_t from, to;
+};
+
+// Combining marks and other characters that take no column of their own.
+static const struct utf8_range utf8Zero[] = {
+    {0x0300, 0x036f}, {0x0483, 0x0489}, {0x0591, 0x05bd}, {0x05bf, 0x05bf}, {0x05c1, 0x05c2}, {0x05c4, 0x05c5},
+    {0x05c7, 0x05c7}, {0x0610, 0x061a}, {0x064b, 0x065f}, {0x0670, 0x0670}, {0x06d6, 0x06dc}, {0x06df, 0x06e4},
+    {0x06e7, 0x06e8}, {0x06ea, 0x06ed}, {0x0900, 0x0902}, {0x093a, 0x093a}, {0x093c, 0x093c}, {0x0941, 0x0948},
+    {0x094d, 0x094d}, {0x0951, 0x0957}, {0x0e31, 0x0e31}, {0x0e34, 0x0e3a}, {0x0e47, 0x0e4e}, {0x1ab0, 0x1aff},
+    {0x1dc0, 0x1dff}, {0x200b, 0x200f}, {0x202a, 0x202e}, {0x2060, 0x2064}, {0x20d0, 0x20ff}, {0xfe00, 0xfe0f},
+    {0xfe20, 0xfe2f}, {0xfeff, 0xfeff}, {0xe0100, 0xe01ef},
+};
+
+// East Asian wide and fullwidth characters, and emoji, take two columns.
+static const struct utf8_range utf8Wide[] = {
+    {0x1100, 0x115f},   {0x231a, 0x231b},   {0x2329, 0x232a},   {0x23e9, 0x23ec},   {0x23f0, 0x23f0},
+    {0x23f3, 0x23f3},   {0x25fd, 0x25fe},   {0x2614, 0x2615},   {0x2648, 0x2653},   {0x267f, 0x267f},
+    {0x2693, 0x2693},   {0x26a1, 0x26a1},   {0x26aa, 0x26ab},   {0x26bd, 0x26be},   {0x26c4, 0x26c5},
+    {0x26ce, 0x26ce},   {0x26d4, 0x26d4},   {0x26ea, 0x26ea},   {0x26f2, 0x26f3},   {0x26f5, 0x26f5},
+    {0x26fa, 0x26fa},   {0x26fd, 0x26fd},   {0x2705, 0x2705},   {0x270a, 0x270b},   {0x2728, 0x2728},
+    {0x274c, 0x274c},   {0x274e, 0x274e},   {0x2753, 0x2755},   {0x2757, 0x2757},   {0x2795, 0x2797},
+    {0x27b0, 0x27b0},   {0x27bf, 0x27bf},   {0x2b1b, 0x2b1c},   {0x2b50, 0x2b50},   {0x2b55, 0x2b55},
+    {0x2e80, 0x303e},   {0x3041, 0x33ff},   {0x3400, 0x4dbf},   {0x4e00, 0x9fff},   {0xa000, 0xa4cf},
+    {0xa960, 0xa97f},   {0xac00, 0xd7a3},   {0xf900, 0xfaff},   {0xfe10, 0xfe19},   {0xfe30, 0xfe6f},
+    {0xff00, 0xff60},   {0xffe0, 0xffe6},   {0x16fe0, 0x16fe4}, {0x17000, 0x18cff}, {0x1b000, 0x1b2ff},
+    {0x1f004, 0x1f004}, {0x1f0cf, 0x1f0cf}, {0x1f18e, 0x1f18e}, {0x1f191, 0x1f19a}, {0x1f200, 0x1f251},
+    {0x1f300, 0x1f64f}, {0x1f680, 0x1f6ff}, {0x1f7e0, 0x1f7eb}, {0x1f90c, 0x1f9ff}, {0x1fa70, 0x1faff},
+    {0x20000, 0x2fffd}, {0x30000, 0x3fffd},
+};
+
+static int utf8In(const struct utf8_range *r, int count, int cp)
+{
+    int lo = 0, hi = count - 1;
+    if (cp < r[0].from || cp > r[hi].to)
+        return 0;
+    while (lo <= hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (cp > r[mid].to)
+            lo = mid + 1;
+        else if (cp < r[mid].from)
+            hi = mid - 1;
+        else
+            return 1;
+    }
+    return 0;
+}
+
+// Columns a code point takes on a terminal: 0, 1 or 2.
+int utf8Width(int cp)
+{
+    if (cp < 0x300)
+        return 1;
+    if (utf8In(utf8Zero, sizeof(utf8Zero) / sizeof(utf8Zero[0]), cp))
+        return 0;
+    if (utf8In(utf8Wide, sizeof(utf8Wide) / sizeof(utf8Wide[0]), cp))
+        return 2;
+    return 1;
+}
+
+// length and columns of the character at s; invalid bytes are one column,
+// drawn as U+FFFD
+int utf8Char(const char *s, int len, int *width)
+{
+    int cp;
+    int n = utf8Decode(s, len, &cp);
+    *width = cp < 0 ? 1 : utf8Width(cp);
+    return n;
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+// Rows hold UTF-8. The render of a row keeps valid sequences as they are
+// and turns invalid bytes into U+FFFD, so what is drawn is always valid;
+// columns on screen come from utf8Width.
+#define UTF8_REPLACEMENT "\xef\xbf\xbd"
+
+int utf8Ascii(const char *s, int len);
+int utf8Decode(const char *s, int len, int *cp);
+int utf8Width(int cp);
+int utf8Char(const char *s, int len, int *width);
@@ -0,0 +1,241 @@
+#include "visual.h"
+#include "filter.h"
+#include "mat.h"
+#include "register.h"
+
+#include <limits.h>
+#include <string.h>
+
+extern struct config E;
+extern int MAT_TABSTOP;
+
+// selection in render coordinates for the frame being drawn, end exclusive
+static struct
+{
+    int on;
+    int y1, rx1;
+    int y2, rx2;
+} V;
+
+void visualStart(int linewise)
+{
+    E.vy = E.cy < E.numRws ? E.cy : E.numRws - 1;
+    E.vx = E.cx;
+    E.current_mode = linewise ? VISUAL_LINE : VISUAL;
+}
+
+static void visualEnd()
+{
+    E.current_mode = NORMAL;
+}
+
+// Orders anchor and cursor and clamps them to the buffer. Columns are end
+// exclusive; linewise selections cover whole rows.
+static int visualRange(int *y1, int *x1, int *y2, int *x2)
+{
+    if (E.numRws == 0)
+        return 0;
+
+    int ay = E.vy, ax = E.vx;
+    int by = E.cy < E.numRws ? E.cy : E.numRws - 1, bx = E.cx;
+    if (ay > E.numRws - 1)
+        ay = E.numRws - 1;
+
+    if (by < ay || (by == ay && bx < ax))
+    {
+        int ty = ay, tx = ax;
+        ay = by;
+        ax = bx;
+        by = ty;
+        bx = tx;
+    }
+
+    *y1 = ay;
+    *y2 = by;
+    if (E.current_mode == VISUAL_LINE)
+    {
+        *x1 = 0;
+        *x2 = E.row[by].size;
+        return 1;
+    }
+
+    *x1 = ax < E.row[ay].size ? ax : E.row[ay].size;
+    *x2 = rwsNextCx(&E.row[by], bx);
+    return 1;
+}
+
+static void visualDeleteRange(int y1, int x1, int y2, int x2)
+{
+    if (E.current_mode == VISUAL_LINE)
+    {
+        deleteRwsRange(y1, y2 - y1 + 1);
+        E.cy = y1 < E.numRws ? y1 : (E.numRws > 0 ? E.numRws - 1 : 0);
+        E.cx = 0;
+        return;
+    }
+
+    if (y1 == y2)
+        rwsDeleteSpan(&E.row[y1], x1, x2 - x1);
+    else
+    {
+        rwsTruncate(&E.row[y1], x1);
+        rwsAppendString(&E.row[y1], &E.row[y2].chars[x2], E.row[y2].size - x2);
+        deleteRwsRange(y1 + 1, y2 - y1);
+    }
+    E.cy = y1;
+    E.cx = x1;
+}
+
+// Shifts rows by `count` tab stops. Each row is edited once; only rows that
+// change are rewritten.
+static void visualShiftRange(int y1, int y2, int dir, int count)
+{
+    char tabs[64];
+    if (count > (int)sizeof(tabs))
+        count = sizeof(tabs);
+    memset(tabs, '\t', count);
+
+    for (int j = y1; j <= y2; j++)
+    {
+        erow *row = &E.row[j];
+        if (dir > 0)
+        {
+            if (row->size > 0)
+                rwsInsertString(row, 0, tabs, count);
+            continue;
+        }
+
+        int n = 0;
+        for (int k = 0; k < count && n < row->size; k++)
+        {
+            if (row->chars[n] == '\t')
+                n++;
+            else
+                for (int sp = 0; sp < MAT_TABSTOP && n < row->size && row->chars[n] == ' '; sp++)
+                    n++;
+        }
+        rwsDeleteSpan(row, 0, n);
+    }
+
+    E.cy = y1;
+    E.cx = 0;
+}
+
+// Handles a key typed in VISUAL or VISUAL-LINE mode. Returns 0 for keys that
+// should fall through to the NORMAL mode motions.
+int visualKey(int c, int count)
+{
+    int y1, x1, y2, x2;
+
+    switch (c)
+    {
+    case KEY_ESC:
+        visualEnd();
+        return 1;
+
+    case KEY_V:
+    case KEY_SHIFT_V:
+        if ((c == KEY_V) == (E.current_mode == VISUAL))
+            visualEnd();
+        else
+            E.current_mode = c == KEY_V ? VISUAL : VISUAL_LINE;
+        return 1;
+
+    case KEY_D:
+    case KEY_X:
+        if (visualRange(&y1, &x1, &y2, &x2))
+        {
+            registerYank(y1, x1, y2, x2, E.current_mode == VISUAL_LINE);
+            visualDeleteRange(y1, x1, y2, x2);
+            if (y2 > y1)
+                setStatusMessage("%d fewer lines", y2 - y1 + (E.current_mode == VISUAL_LINE));
+        }
+        visualEnd();
+        return 1;
+
+    case KEY_Y:
+        if (visualRange(&y1, &x1, &y2, &x2))
+        {
+            registerYank(y1, x1, y2, x2, E.current_mode == VISUAL_LINE);
+            E.cy = y1;
+            E.cx = x1;
+            if (y2 > y1)
+                setStatusMessage("%d lines yanked", y2 - y1 + 1);
+        }
+        visualEnd();
+        return 1;
+
+    case KEY_GT:
+    case KEY_LT:
+        if (visualRange(&y1, &x1, &y2, &x2))
+            visualShiftRange(y1, y2, c == KEY_GT ? 1 : -1, count);
+        visualEnd();
+        return 1;
+
+    // filters whole lines, as :!
+    case '!':
+        if (visualRange(&y1, &x1, &y2, &x2))
+        {
+            visualEnd();
+            char *cmd = prompt("!%s", NULL);
+            if (cmd)
+                filterStart(y1 + 1, y2 + 1, cmd);
+            matFree(cmd);
+        }
+        else
+            visualEnd();
+        return 1;
+
+    case KEY_K:
+    case KEY_J:
+    case KEY_H:
+    case KEY_L:
+    case KEY_W:
+    case KEY_B:
+    case KEY_E:
+    case KEY_G:
+    case KEY_SHIFT_G:
+    case KEY_PERCENT:
+    case KEY_LBRACKET:
+    case KEY_RBRACKET:
+    case CTRL_KEY('u'):
+    case CTRL_KEY('d'):
+    case CTRL_KEY('b'):
+    case CTRL_KEY('f'):
+        return 0;
+    }
+
+    return 1;
+}
+
+void visualUpdate()
+{
+    int y1, x1, y2, x2;
+
+    V.on = (E.current_mode == VISUAL || E.current_mode == VISUAL_LINE) &&
+           visualRange(&y1, &x1, &y2, &x2);
+    if (!V.on)
+        return;
+
+    V.y1 = y1;
+    V.y2 = y2;
+    if (E.current_mode == VISUAL_LINE)
+    {
+        V.rx1 = 0;
+        V.rx2 = INT_MAX;
+        return;
+    }
+    V.rx1 = rwsCxToRx(&E.row[y1], x1);
+    V.rx2 = rwsCxToRx(&E.row[y2], x2);
+}
+
+int visualMarked(int filerow, int rx)
+{
+    if (!V.on || filerow < V.y1 || filerow > V.y2)
+        return 0;
+    if (filerow == V.y1 && rx < V.rx1)
+        return 0;
+    if (filerow == V.y2 && rx >= V.rx2)
+        return 0;
+    return 1;
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+void visualStart(int linewise);
+int visualKey(int c, int count);
+void visualUpdate();
+int visualMarked(int filerow, int rx);
@@ -0,0 +1,329 @@
+#include "words.h"
+#include "alloc.h"
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+extern struct config E;
+
+// Every identifier in a buffer with the number of times it occurs, kept in
+// E.words for completion. It is built from all rows on the first lookup and
+// from then on the row functions keep it current: a row's words are counted
+// out before it is edited or deleted and counted back in from its new text
+// in updateRws, so an edit costs the words of one row, never a rescan.
+// Lookups binary search an array of the words in order. Words first seen
+// since that array was sorted wait in a short list that lookups scan, and are
+// merged in once there are enough of them. A word whose count drops to zero
+// keeps its place, since the typing that removed it usually brings it back;
+// dead words are swept out once they outnumber the live ones.
+struct word
+{
+    int count;
+    int len;
+    uint32_t hash;
+    char text[];
+};
+
+struct words
+{
+    struct word **slots; // open addressing on the hash, cap a power of two
+    int cap, used;
+    struct word **sorted;
+    int nsorted;
+    struct word **recent; // not in sorted yet, in no order
+    int nrecent, recentCap;
+    int live; // words with a count above zero
+};
+
+int wordsChar(int c)
+{
+    return isalnum(c) || c == '_' || c >= 0x80;
+}
+
+static uint32_t wordsHash(const char *s, int len)
+{
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < len; i++)
+        h = (h ^ (unsigned char)s[i]) * 16777619u;
+    return h;
+}
+
+static struct word **wordsSlot(struct words *w, const char *s, int len, uint32_t hash)
+{
+    for (uint32_t i = hash & (w->cap - 1);; i = (i + 1) & (w->cap - 1))
+    {
+        struct word *wd = w->slots[i];
+        if (wd == NULL || (wd->hash == hash && wd->len == len && memcmp(wd->text, s, len) == 0))
+            return &w->slots[i];
+    }
+}
+
+static void wordsPlace(struct words *w, struct word *wd)
+{
+    *wordsSlot(w, wd->text, wd->len, wd->hash) = wd;
+}
+
+static void wordsRehash(struct words *w, int cap)
+{
+    struct word **old = w->slots;
+    int oldCap = w->cap;
+
+    w->cap = cap;
+    w->slots = matMalloc(ALLOC_WORDS, sizeof(struct word *) * cap);
+    memset(w->slots, 0, sizeof(struct word *) * cap);
+    for (int i = 0; i < oldCap; i++)
+        if (old[i])
+            wordsPlace(w, old[i]);
+    matFree(old);
+}
+
+static void wordsAdd(struct words *w, const char *s, int len)
+{
+    uint32_t hash = wordsHash(s, len);
+    struct word **slot = wordsSlot(w, s, len, hash);
+    if (*slot)
+    {
+        if ((*slot)->count++ == 0)
+            w->live++;
+        return;
+    }
+
+    struct word *wd = matMalloc(ALLOC_WORDS, sizeof(struct word) + len + 1);
+    wd->count = 1;
+    wd->len = len;
+    wd->hash = hash;
+    memcpy(wd->text, s, len);
+    wd->text[len] = '\0';
+    *slot = wd;
+    w->used++;
+    w->live++;
+
+    if (w->nrecent == w->recentCap)
+    {
+        w->recentCap = w->recentCap ? w->recentCap * 2 : WORDS_RECENT;
+        w->recent = matRealloc(ALLOC_WORDS, w->recent, sizeof(struct word *) * w->recentCap);
+    }
+    w->recent[w->nrecent++] = wd;
+
+    // kept at most half full
+    if (w->used * 2 > w->cap)
+        wordsRehash(w, w->cap * 2);
+}
+
+static void wordsRemove(struct words *w, const char *s, int len)
+{
+    struct word *wd = *wordsSlot(w, s, len, wordsHash(s, len));
+    if (wd && wd->count > 0 && --wd->count == 0)
+        w->live--;
+}
+
+// counts the words of a row in, or out when add is 0; runs of word
+// characters that start with a digit are numbers
+static void wordsScan(struct words *w, erow *row, int add)
+{
+    const char *s = row->chars;
+    int i = 0;
+
+    while (i < row->size)
+    {
+        if (!wordsChar((unsigned char)s[i]))
+        {
+            i++;
+            continue;
+        }
+
+        int start = i;
+        while (i < row->size && wordsChar((unsigned char)s[i]))
+            i++;
+
+        int len = i - start;
+        if (len < WORDS_MIN || len > WORDS_MAX || isdigit((unsigned char)s[start]))
+            continue;
+        if (add)
+            wordsAdd(w, &s[start], len);
+        else
+            wordsRemove(w, &s[start], len);
+    }
+}
+
+static int wordsCompare(const void *a, const void *b)
+{
+    const struct word *x = *(struct word *const *)a;
+    const struct word *y = *(struct word *const *)b;
+    int c = memcmp(x->text, y->text, x->len < y->len ? x->len : y->len);
+    return c ? c : x->len - y->len;
+}
+
+static void wordsMerge(struct words *w)
+{
+    qsort(w->recent, w->nrecent, sizeof(struct word *), wordsCompare);
+
+    struct word **all = matMalloc(ALLOC_WORDS, sizeof(struct word *) * (w->nsorted + w->nrecent + 1));
+    int i = 0, j = 0, n = 0;
+    while (i < w->nsorted || j < w->nrecent)
+    {
+        if (j == w->nrecent || (i < w->nsorted && wordsCompare(&w->sorted[i], &w->recent[j]) < 0))
+            all[n++] = w->sorted[i++];
+        else
+            all[n++] = w->recent[j++];
+    }
+
+    matFree(w->sorted);
+    w->sorted = all;
+    w->nsorted = n;
+    w->nrecent = 0;
+}
+
+// sorts the recent words in, then frees the dead ones and rebuilds the table
+// from what is left
+static void wordsSweep(struct words *w)
+{
+    wordsMerge(w);
+
+    int n = 0;
+    for (int i = 0; i < w->nsorted; i++)
+    {
+        if (w->sorted[i]->count > 0)
+            w->sorted[n++] = w->sorted[i];
+        else
+            matFree(w->sorted[i]);
+    }
+    w->nsorted = n;
+
+    memset(w->slots, 0, sizeof(struct word *) * w->cap);
+    for (int i = 0; i < w->nsorted; i++)
+        wordsPlace(w, w->sorted[i]);
+    w->used = w->live;
+}
+
+static struct words *wordsBuild()
+{
+    if (E.words)
+        return E.words;
+
+    struct words *w = matMalloc(ALLOC_WORDS, sizeof(struct words));
+    memset(w, 0, sizeof(*w));
+    w->cap = 1024;
+    w->slots = matMalloc(ALLOC_WORDS, sizeof(struct word *) * w->cap);
+    memset(w->slots, 0, sizeof(struct word *) * w->cap);
+
+    for (int j = 0; j < E.numRws; j++)
+        wordsScan(w, &E.row[j], 1);
+    wordsMerge(w);
+    matFree(w->recent);
+    w->recent = NULL;
+    w->recentCap = 0;
+
+    E.words = w;
+    return w;
+}
+
+void wordsRowChanging(erow *row)
+{
+    if (E.words)
+        wordsScan(E.words, row, 0);
+}
+
+void wordsRowChanged(erow *row)
+{
+    struct words *w = E.words;
+    if (w == NULL)
+        return;
+
+    wordsScan(w, row, 1);
+    if (w->used - w->live > w->live && w->used - w->live > WORDS_RECENT)
+        wordsSweep(w);
+}
+
+void wordsRowsDeleted(int at, int count)
+{
+    if (E.words)
+        for (int j = at; j < at + count; j++)
+            wordsScan(E.words, &E.row[j], 0);
+}
+
+// whether wd sorts before every word starting with prefix
+static int wordsBefore(const struct word *wd, const char *prefix, int len)
+{
+    int c = memcmp(wd->text, prefix, wd->len < len ? wd->len : len);
+    return c < 0 || (c == 0 && wd->len < len);
+}
+
+static int wordsStarts(const struct word *wd, const char *prefix, int len)
+{
+    return wd->len >= len && memcmp(wd->text, prefix, len) == 0;
+}
+
+// Copies the first max words in the buffer that start with prefix and are
+// longer than it, in order, to out and returns how many it found.
+int wordsComplete(const char *prefix, int len, char (*out)[WORDS_MAX + 1], int max)
+{
+    struct words *w = wordsBuild();
+    if (w->nrecent > WORDS_RECENT)
+        wordsMerge(w);
+
+    struct word *hits[WORDS_RECENT];
+    int nhits = 0;
+    for (int i = 0; i < w->nrecent; i++)
+        if (wordsStarts(w->recent[i], prefix, len))
+            hits[nhits++] = w->recent[i];
+    qsort(hits, nhits, sizeof(struct word *), wordsCompare);
+
+    int lo = 0, hi = w->nsorted;
+    while (lo < hi)
+    {
+        int mid = lo + (hi - lo) / 2;
+        if (wordsBefore(w->sorted[mid], prefix, len))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    int n = 0, h = 0;
+    while (n < max)
+    {
+        struct word *wd;
+        int more = lo < w->nsorted && wordsStarts(w->sorted[lo], prefix, len);
+        if (more && (h == nhits || wordsCompare(&w->sorted[lo], &hits[h]) < 0))
+            wd = w->sorted[lo++];
+        else if (h < nhits)
+            wd = hits[h++];
+        else
+            break;
+
+        if (wd->count > 0 && wd->len > len)
+        {
+            memcpy(out[n], wd->text, wd->len + 1);
+            n++;
+        }
+    }
+    return n;
+}
+
+size_t wordsMemory(struct words *w)
+{
+    if (w == NULL)
+        return 0;
+
+    size_t bytes = matSize(w) + matSize(w->slots) + matSize(w->sorted) + matSize(w->recent);
+    for (int i = 0; i < w->cap; i++)
+        if (w->slots[i])
+            bytes += matSize(w->slots[i]);
+    return bytes;
+}
+
+// the index is built again on the next lookup
+void wordsFree(struct words *w)
+{
+    if (w == NULL)
+        return;
+
+    for (int i = 0; i < w->cap; i++)
+        matFree(w->slots[i]);
+    matFree(w->slots);
+    matFree(w->sorted);
+    matFree(w->recent);
+    matFree(w);
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "mat.h"
+
+// identifiers shorter or longer than this are not worth completing
+#define WORDS_MIN 3
+#define WORDS_MAX 64
+// words first seen since the last sort that a lookup still scans one by one
+#define WORDS_RECENT 256
+
+struct words;
+
+int wordsChar(int c);
+void wordsRowChanging(erow *row);
+void wordsRowChanged(erow *row);
+void wordsRowsDeleted(int at, int count);
+int wordsComplete(const char *prefix, int len, char (*out)[WORDS_MAX + 1], int max);
+size_t wordsMemory(struct words *w);
+void wordsFree(struct words *w);
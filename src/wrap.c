@@ -0,0 +1,190 @@
+#include "wrap.h"
+#include "rowtree.h"
+
+#include <string.h>
+
+extern struct config E;
+
+// In soft-wrap mode every row takes rwidth / width screen lines, rounded up
+// and at least one. The
+// counts are kept in a row tree of their own (E.wraps, channel 0), so
+// converting between screen lines and rows takes O(log n). The tree is built
+// on first use, kept current by the row functions, and rebuilt when the
+// width it was built for changes.
+static int wrapEnabled;
+
+static int wrapWidth()
+{
+    return E.screenCls > 0 ? E.screenCls : 1;
+}
+
+int wrapOn()
+{
+    return wrapEnabled;
+}
+
+int wrapCount(erow *row)
+{
+    int w = wrapWidth();
+    return row->rwidth ? (row->rwidth + w - 1) / w : 1;
+}
+
+// the screen line of a row that column col is on; a cursor just past the
+// end of a row that fills its last line stays on that line
+static int wrapSegment(erow *row, int col)
+{
+    int seg = col / wrapWidth();
+    return seg < wrapCount(row) ? seg : wrapCount(row) - 1;
+}
+
+static void wrapValues(erow *row, struct rtbrackets out[RT_CHANNELS])
+{
+    memset(out, 0, sizeof(struct rtbrackets) * RT_CHANNELS);
+    out[0].delta = wrapCount(row);
+}
+
+static void wrapEnsure()
+{
+    if (E.wraps && E.wrapWidth == wrapWidth())
+        return;
+
+    rowtreeFree(E.wraps);
+
+    struct rtbrackets(*values)[RT_CHANNELS] = matMalloc(ALLOC_ROWTREE, sizeof(*values) * (E.numRws + 1));
+    for (int j = 0; j < E.numRws; j++)
+        wrapValues(&E.row[j], values[j]);
+
+    E.wraps = rowtreeBuild(values, NULL, E.numRws);
+    E.wrapWidth = wrapWidth();
+    matFree(values);
+}
+
+void wrapToggle()
+{
+    wrapEnabled = !wrapEnabled;
+    E.wrapOff = 0;
+    setStatusMessage("wrap %s", wrapEnabled ? "on" : "off");
+}
+
+void wrapRowChanged(erow *row)
+{
+    if (E.wraps == NULL)
+        return;
+
+    struct rtbrackets values[RT_CHANNELS];
+    wrapValues(row, values);
+    rowtreeSet(E.wraps, row->idx, values);
+}
+
+// new rows are filled in by wrapRowChanged once they are rendered
+void wrapRowsInserted(int at, int count)
+{
+    if (E.wraps)
+        rowtreeInsert(E.wraps, at, count);
+}
+
+void wrapRowsDeleted(int at, int count)
+{
+    if (E.wraps)
+        rowtreeDelete(E.wraps, at, count);
+}
+
+// screen line of the start of row `at`, counted from the top of the buffer
+static int wrapLineOf(int at)
+{
+    return rowtreeDepth(E.wraps, at, 0);
+}
+
+static int wrapTotal()
+{
+    return wrapLineOf(E.numRws);
+}
+
+// moves the top of the view to screen line `top`
+static void wrapSetTop(int top)
+{
+    if (top > wrapTotal())
+        top = wrapTotal();
+    if (top < 0)
+        top = 0;
+
+    E.rowOff = rowtreeFindSum(E.wraps, 0, top);
+    E.wrapOff = top - wrapLineOf(E.rowOff);
+}
+
+static int wrapCursorLine()
+{
+    if (E.cy >= E.numRws)
+        return wrapTotal();
+    return wrapLineOf(E.cy) + wrapSegment(&E.row[E.cy], E.rx);
+}
+
+int wrapTopLine()
+{
+    if (E.rowOff > E.numRws)
+        E.rowOff = E.numRws;
+    return wrapLineOf(E.rowOff) + E.wrapOff;
+}
+
+// scroll() for soft-wrap mode: keeps the cursor's screen line in view
+int wrapScroll()
+{
+    if (!wrapEnabled)
+        return 0;
+
+    wrapEnsure();
+
+    int line = wrapCursorLine();
+    int top = wrapTopLine();
+    if (line < top)
+        top = line;
+    if (line >= top + E.screenRws)
+        top = line - E.screenRws + 1;
+
+    wrapSetTop(top);
+    E.colOff = 0;
+    return 1;
+}
+
+// moves the view and the cursor together by n screen lines
+int wrapScrollBy(int n)
+{
+    if (!wrapEnabled || E.numRws == 0)
+        return 0;
+
+    wrapEnsure();
+    wrapSetTop(wrapTopLine() + n);
+    wrapVertical(n);
+    return 1;
+}
+
+// Moves the cursor n screen lines up or down, keeping its screen column.
+int wrapVertical(int n)
+{
+    if (!wrapEnabled || E.numRws == 0)
+        return 0;
+
+    wrapEnsure();
+
+    int w = wrapWidth();
+    int cy = E.cy < E.numRws ? E.cy : E.numRws - 1;
+    int col = E.cy < E.numRws ? rwsCxToCol(&E.row[cy], E.cx) : 0;
+    int line = wrapLineOf(cy) + (E.cy < E.numRws ? wrapSegment(&E.row[cy], col) : 0) + n;
+
+    if (line >= wrapTotal())
+        line = wrapTotal() - 1;
+    if (line < 0)
+        line = 0;
+
+    int row = rowtreeFindSum(E.wraps, 0, line);
+    int seg = line - wrapLineOf(row);
+    E.cy = row;
+    E.cx = rwsColToCx(&E.row[row], seg * w + col % w);
+    return 1;
+}
+
+void wrapCursor(int *y, int *x)
+{
+    *y = wrapCursorLine() - wrapTopLine();
+    *x = E.cy < E.numRws ? E.rx - wrapSegment(&E.row[E.cy], E.rx) * wrapWidth() : 0;
+}
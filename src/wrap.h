@@ -0,0 +1,15 @@
+#pragma once
+
+#include "mat.h"
+
+void wrapToggle();
+int wrapOn();
+int wrapCount(erow *row);
+void wrapRowChanged(erow *row);
+void wrapRowsInserted(int at, int count);
+void wrapRowsDeleted(int at, int count);
+int wrapScroll();
+int wrapScrollBy(int n);
+int wrapVertical(int n);
+void wrapCursor(int *y, int *x);
+int wrapTopLine();